@@ -0,0 +1,73 @@
+#include "buffer_pool.h"
+#include "huge_pages.h"
+
+#include <pthread.h>
+
+typedef struct free_buffer {
+    struct free_buffer * next;
+} free_buffer;
+
+typedef struct {
+    pthread_mutex_t lock;
+    free_buffer * free_list;
+} size_class;
+
+static size_class classes[BUFFER_POOL_CLASSES] = {
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+    { PTHREAD_MUTEX_INITIALIZER, NULL },
+};
+
+static int class_of(size_t size);
+static free_buffer * carve_slab(size_t buffer_size);
+
+void * buffer_pool_get(size_t size) {
+    int index = class_of(size);
+    if (index == -1) return NULL;
+    size_class * class = &classes[index];
+
+    pthread_mutex_lock(&class->lock);
+    if (class->free_list == NULL) {
+        class->free_list = carve_slab((size_t) 1 << (BUFFER_POOL_MIN_SHIFT + index));
+    }
+    free_buffer * buf = class->free_list;
+    if (buf != NULL) class->free_list = buf->next;
+    pthread_mutex_unlock(&class->lock);
+    return buf;
+}
+
+void buffer_pool_put(void * buf, size_t size) {
+    if (buf == NULL) return;
+    size_class * class = &classes[class_of(size)];
+
+    free_buffer * node = buf;
+    pthread_mutex_lock(&class->lock);
+    node->next = class->free_list;
+    class->free_list = node;
+    pthread_mutex_unlock(&class->lock);
+}
+
+static int class_of(size_t size) {
+    for (int index = 0; index < BUFFER_POOL_CLASSES; index++) {
+        if (size <= (size_t) 1 << (BUFFER_POOL_MIN_SHIFT + index)) return index;
+    }
+    return -1;
+}
+
+// Splits a fresh slab into buffers linked in address order. With huge pages
+// enabled slabs grow to a whole 2 MB page
+static free_buffer * carve_slab(size_t buffer_size) {
+    size_t slab_size;
+    char * slab = huge_pages_map(BUFFER_POOL_SLAB_SIZE, &slab_size);
+    if (slab == NULL) return NULL;
+
+    free_buffer * head = NULL;
+    for (size_t offset = slab_size; offset >= buffer_size; offset -= buffer_size) {
+        free_buffer * node = (free_buffer *) (slab + offset - buffer_size);
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
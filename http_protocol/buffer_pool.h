@@ -0,0 +1,26 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#define BUFFER_POOL_MIN_SHIFT 12
+#define BUFFER_POOL_CLASSES 5
+#define BUFFER_POOL_SLAB_SIZE (256 * 1024)
+
+/**
+ * Returns a buffer of at least size bytes, at most 64 KB, from the slab of
+ * its size class. Sizes are rounded up to a power of two from 4 KB. The
+ * contents are not cleared. Slabs are carved from huge_pages_map and
+ * buffers are recycled through a free list per class rather than returned
+ * to malloc, so connections can hand them back whenever they go idle.
+ * Returns NULL if size is too large or no memory is left.
+ */
+void * buffer_pool_get(size_t size);
+
+/**
+ * Hands back a buffer from buffer_pool_get. size must be the size it was
+ * requested with. Does nothing if buf is NULL.
+ */
+void buffer_pool_put(void * buf, size_t size);
+
+#endif
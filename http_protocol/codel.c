@@ -0,0 +1,113 @@
+#include "codel.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define NS_PER_MS 1000000LL
+
+static const long long target = CODEL_TARGET_MS * NS_PER_MS;
+static const long long interval = CODEL_INTERVAL_MS * NS_PER_MS;
+
+/**
+ * Returns whether the sojourn time has been above target for a full interval.
+ * @param state
+ * @param sojourn
+ * @param now
+ * @return 1 if shedding is allowed
+ */
+static int ok_to_shed(codel * state, long long sojourn, long long now);
+/**
+ * Schedules the next shed interval / sqrt(count) after t.
+ * @param t
+ * @param count
+ * @return time of the next shed
+ */
+static long long control_law(long long t, unsigned int count);
+/**
+ * Integer square root, so the control law does not need libm.
+ * @param n
+ * @return floor(sqrt(n))
+ */
+static unsigned int isqrt(unsigned int n);
+
+long long codel_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long codel_arrival(int cfd) {
+    long long now = codel_now();
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(cfd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1)
+        return now;
+    return now - info.tcpi_last_data_recv * NS_PER_MS;
+}
+
+// The dequeue side of RFC 8289, shedding at most one connection per call
+int codel_should_shed(codel * state, long long enqueued_at) {
+    long long now = codel_now();
+    int ok = ok_to_shed(state, now - enqueued_at, now);
+
+    if (state->dropping) {
+        if (!ok) {
+            state->dropping = 0;
+            return 0;
+        }
+        if (now < state->drop_next)
+            return 0;
+        state->count++;
+        state->drop_next = control_law(state->drop_next, state->count);
+        return 1;
+    }
+
+    if (!ok)
+        return 0;
+
+    // Resume near the previous rate if the last shedding ended recently
+    state->dropping = 1;
+    unsigned int delta = state->count - state->last_count;
+    if (delta > 1 && now - state->drop_next < 16 * interval)
+        state->count = delta;
+    else
+        state->count = 1;
+    state->drop_next = control_law(now, state->count);
+    state->last_count = state->count;
+    return 1;
+}
+
+static int ok_to_shed(codel * state, long long sojourn, long long now) {
+    if (sojourn < target) {
+        state->first_above_time = 0;
+        return 0;
+    }
+    if (state->first_above_time == 0) {
+        state->first_above_time = now + interval;
+        return 0;
+    }
+    return now >= state->first_above_time;
+}
+
+static long long control_law(long long t, unsigned int count) {
+    return t + interval / isqrt(count);
+}
+
+static unsigned int isqrt(unsigned int n) {
+    unsigned int root = 0;
+    unsigned int bit = 1u << 30;
+    while (bit > n)
+        bit >>= 2;
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
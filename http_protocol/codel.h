@@ -0,0 +1,42 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#define CODEL_TARGET_MS 20
+#define CODEL_INTERVAL_MS 100
+
+/**
+ * CoDel state for one queue of connections waiting for a worker. A queue
+ * whose waits stay above CODEL_TARGET_MS for CODEL_INTERVAL_MS starts
+ * shedding, and sheds more often the longer that lasts. Zero initialize it
+ * before use. It is not thread safe, so the caller must serialize access.
+ * Arrival times only have jiffy resolution, so the target is kept well above
+ * one jiffy.
+ */
+typedef struct {
+    long long first_above_time;
+    long long drop_next;
+    unsigned int count;
+    unsigned int last_count;
+    int dropping;
+} codel;
+
+/**
+ * Returns the CLOCK_MONOTONIC time in nanoseconds, the clock enqueue times
+ * must be taken from.
+ */
+long long codel_now(void);
+
+/**
+ * Returns when the request on the accepted socket cfd arrived, which predates
+ * the accept by however long the connection sat in the listen backlog. Falls
+ * back to the current time if the kernel cannot tell.
+ */
+long long codel_arrival(int cfd);
+
+/**
+ * Called when a connection enqueued at enqueued_at is taken off the queue.
+ * Returns 1 if it should be shed instead of served, 0 otherwise.
+ */
+int codel_should_shed(codel * state, long long enqueued_at);
+
+#endif
@@ -4,6 +4,7 @@
 #include <getopt.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "config.h"
 
 #define CONFIG_PATH "../config.cfg"
@@ -12,6 +13,14 @@
 #define DEFAULT_ROOT_DIR "../server_directory"
 #define DEFAULT_INDEX_PAGE "/index.html"
 #define DEFAULT_NOT_FOUND_PAGE "/404.html"
+#define DEFAULT_NUMA 0
+#define DEFAULT_HUGE_PAGES 0
+#define DEFAULT_SRPT 0
+#define DEFAULT_DEFER_ACCEPT 1
+#define DEFAULT_FASTOPEN 256
+#define DEFAULT_ZEROCOPY_THRESHOLD 32768
+#define DEFAULT_RATE_LIMIT 0
+#define DEFAULT_RATE_BURST 32
 
 static void set_default_config(config *cfg);
 static void set_file_config(config *cfg);
@@ -22,6 +31,14 @@ static void set_cmd_line_config(config *cfg, config *cmd_cfg);
 config *get_cmd_config(int argc, char **argv) {
     config *cfg = calloc(1, sizeof(config));
     cfg->port = -1; // 0 is still "valid".
+    cfg->numa = -1;
+    cfg->huge_pages = -1;
+    cfg->srpt = -1;
+    cfg->defer_accept = -1;
+    cfg->fastopen = -1;
+    cfg->zerocopy_threshold = -1;
+    cfg->rate_limit = -1;
+    cfg->rate_burst = -1;
     parse_cmd_line_options(cfg, argc, argv);
     return cfg;
 }
@@ -39,6 +56,14 @@ void destroy_config(config *cfg) {
     free(cfg->root_dir);
     free(cfg->not_found_page);
     free(cfg->index_page);
+    free(cfg->upload_dir);
+    free(cfg->tls_cert);
+    free(cfg->tls_key);
+    free(cfg->acl_file);
+    free(cfg->rewrite_file);
+    free(cfg->modules);
+    free(cfg->fastcgi_socket);
+    free(cfg->fastcgi_prefix);
     free(cfg);
 }
 
@@ -51,6 +76,36 @@ static int is_valid_port(int port) {
     return port >= 0 && port <= MAX_PORT;
 }
 
+/**
+ * Returns whether the value is valid for a TCP listener option,
+ * where 0 turns the option off.
+ * @param value - the value
+ * @return whether the value is valid
+ */
+static int is_valid_tcp_option(int value) {
+    return value >= 0 && value <= MAX_TCP_OPTION;
+}
+
+/**
+ * Returns whether the value is a valid zerocopy threshold in bytes,
+ * where 0 turns zerocopy sends off.
+ * @param value - the value
+ * @return whether the value is valid
+ */
+static int is_valid_zerocopy_threshold(int value) {
+    return value >= 0 && value <= MAX_ZEROCOPY_THRESHOLD;
+}
+
+/**
+ * Returns whether the value is a valid per client rate in requests per
+ * second or burst in requests, where a rate of 0 turns rate limiting off.
+ * @param value - the value
+ * @return whether the value is valid
+ */
+static int is_valid_rate(int value) {
+    return value >= 0 && value <= MAX_RATE_LIMIT;
+}
+
 /**
  * Returns whether the mode is a valid mode.
  * Valid modes are 'p' and 't'.
@@ -61,6 +116,16 @@ static int is_valid_mode(const char mode) {
     return mode == 'p' || mode == 't';
 }
 
+/**
+ * Returns whether the switch is a valid switch.
+ * Valid switches begin with 'y' or 'n' (case insensitive).
+ * @param value - the switch
+ * @return whether the switch is valid
+ */
+static int is_valid_switch(const char *value) {
+    return value != NULL && (tolower(value[0]) == 'y' || tolower(value[0]) == 'n');
+}
+
 /**
  * Returns whether the path is a valid directory.
  * @param path - the path to check
@@ -72,6 +137,37 @@ static int is_valid_directory(const char *path) {
     return !(stat(path, &s) != 0 || !S_ISDIR(s.st_mode));
 }
 
+/**
+ * Returns whether the path is a readable regular file.
+ * @param path - the path to check
+ * @return whether the path is valid
+ */
+static int is_valid_file(const char *path) {
+    if (path == NULL) return 0;
+    struct stat s;
+    return stat(path, &s) == 0 && S_ISREG(s.st_mode) && access(path, R_OK) == 0;
+}
+
+/**
+ * Returns whether the path is a UNIX socket.
+ * @param path - the path to check
+ * @return whether the path is valid
+ */
+static int is_valid_socket(const char *path) {
+    if (path == NULL) return 0;
+    struct stat s;
+    return stat(path, &s) == 0 && S_ISSOCK(s.st_mode);
+}
+
+/**
+ * Returns whether the prefix is a path that routes can be added under.
+ * @param prefix - the prefix to check
+ * @return whether the prefix is valid
+ */
+static int is_valid_prefix(const char *prefix) {
+    return prefix != NULL && prefix[0] == '/' && strpbrk(prefix, ":*?") == NULL;
+}
+
 /**
  * Sets the default values for the config.
  * @param cfg - the config
@@ -82,6 +178,14 @@ static void set_default_config(config *cfg) {
     cfg->not_found_page = strdup(DEFAULT_NOT_FOUND_PAGE);
     cfg->mode = DEFAULT_MODE;
     cfg->port = DEFAULT_PORT;
+    cfg->numa = DEFAULT_NUMA;
+    cfg->huge_pages = DEFAULT_HUGE_PAGES;
+    cfg->srpt = DEFAULT_SRPT;
+    cfg->defer_accept = DEFAULT_DEFER_ACCEPT;
+    cfg->fastopen = DEFAULT_FASTOPEN;
+    cfg->zerocopy_threshold = DEFAULT_ZEROCOPY_THRESHOLD;
+    cfg->rate_limit = DEFAULT_RATE_LIMIT;
+    cfg->rate_burst = DEFAULT_RATE_BURST;
 }
 
 /**
@@ -98,8 +202,8 @@ static void set_file_config(config *cfg) {
         return;
     }
 
-    int port;
-    const char *root_dir, *index_page, *not_found_page, *mode;
+    int port, defer_accept, fastopen, zerocopy_threshold, rate_limit, rate_burst;
+    const char *root_dir, *index_page, *not_found_page, *upload_dir, *tls_cert, *tls_key, *acl_file, *rewrite_file, *modules, *fastcgi_socket, *fastcgi_prefix, *mode, *numa, *huge_pages, *srpt;
     if (config_lookup_int(&lib_config, "port", &port) != CONFIG_FALSE) {
         if (is_valid_port(port)) {
             cfg->port = port;
@@ -124,6 +228,92 @@ static void set_file_config(config *cfg) {
         free(cfg->not_found_page);
         cfg->not_found_page = strdup(not_found_page);
     }
+    if (config_lookup_string(&lib_config, "upload_dir", &upload_dir) != CONFIG_FALSE) {
+        if (is_valid_directory(upload_dir)) {
+            free(cfg->upload_dir);
+            cfg->upload_dir = strdup(upload_dir);
+        }
+    }
+    if (config_lookup_string(&lib_config, "tls_cert", &tls_cert) != CONFIG_FALSE) {
+        if (is_valid_file(tls_cert)) {
+            free(cfg->tls_cert);
+            cfg->tls_cert = strdup(tls_cert);
+        }
+    }
+    if (config_lookup_string(&lib_config, "tls_key", &tls_key) != CONFIG_FALSE) {
+        if (is_valid_file(tls_key)) {
+            free(cfg->tls_key);
+            cfg->tls_key = strdup(tls_key);
+        }
+    }
+    if (config_lookup_string(&lib_config, "acl_file", &acl_file) != CONFIG_FALSE) {
+        if (is_valid_file(acl_file)) {
+            free(cfg->acl_file);
+            cfg->acl_file = strdup(acl_file);
+        }
+    }
+    if (config_lookup_string(&lib_config, "rewrite_file", &rewrite_file) != CONFIG_FALSE) {
+        if (is_valid_file(rewrite_file)) {
+            free(cfg->rewrite_file);
+            cfg->rewrite_file = strdup(rewrite_file);
+        }
+    }
+    if (config_lookup_string(&lib_config, "modules", &modules) != CONFIG_FALSE) {
+        free(cfg->modules);
+        cfg->modules = strdup(modules);
+    }
+    if (config_lookup_string(&lib_config, "fastcgi_socket", &fastcgi_socket) != CONFIG_FALSE) {
+        if (is_valid_socket(fastcgi_socket)) {
+            free(cfg->fastcgi_socket);
+            cfg->fastcgi_socket = strdup(fastcgi_socket);
+        }
+    }
+    if (config_lookup_string(&lib_config, "fastcgi_prefix", &fastcgi_prefix) != CONFIG_FALSE) {
+        if (is_valid_prefix(fastcgi_prefix)) {
+            free(cfg->fastcgi_prefix);
+            cfg->fastcgi_prefix = strdup(fastcgi_prefix);
+        }
+    }
+    if (config_lookup_string(&lib_config, "numa", &numa) != CONFIG_FALSE) {
+        if (is_valid_switch(numa)) {
+            cfg->numa = tolower(numa[0]) == 'y';
+        }
+    }
+    if (config_lookup_string(&lib_config, "huge_pages", &huge_pages) != CONFIG_FALSE) {
+        if (is_valid_switch(huge_pages)) {
+            cfg->huge_pages = tolower(huge_pages[0]) == 'y';
+        }
+    }
+    if (config_lookup_string(&lib_config, "srpt", &srpt) != CONFIG_FALSE) {
+        if (is_valid_switch(srpt)) {
+            cfg->srpt = tolower(srpt[0]) == 'y';
+        }
+    }
+    if (config_lookup_int(&lib_config, "defer_accept", &defer_accept) != CONFIG_FALSE) {
+        if (is_valid_tcp_option(defer_accept)) {
+            cfg->defer_accept = defer_accept;
+        }
+    }
+    if (config_lookup_int(&lib_config, "fastopen", &fastopen) != CONFIG_FALSE) {
+        if (is_valid_tcp_option(fastopen)) {
+            cfg->fastopen = fastopen;
+        }
+    }
+    if (config_lookup_int(&lib_config, "zerocopy_threshold", &zerocopy_threshold) != CONFIG_FALSE) {
+        if (is_valid_zerocopy_threshold(zerocopy_threshold)) {
+            cfg->zerocopy_threshold = zerocopy_threshold;
+        }
+    }
+    if (config_lookup_int(&lib_config, "rate_limit", &rate_limit) != CONFIG_FALSE) {
+        if (is_valid_rate(rate_limit)) {
+            cfg->rate_limit = rate_limit;
+        }
+    }
+    if (config_lookup_int(&lib_config, "rate_burst", &rate_burst) != CONFIG_FALSE) {
+        if (is_valid_rate(rate_burst)) {
+            cfg->rate_burst = rate_burst;
+        }
+    }
 
     config_destroy(&lib_config);
 }
@@ -162,12 +352,110 @@ static void set_env_config(config *cfg) {
         free(cfg->not_found_page);
         cfg->not_found_page = strdup(env_var);
     }
+    if ((env_var = getenv("DC_HTTP_UPLOAD_DIR")) != NULL) {
+        if (is_valid_directory(env_var)) {
+            free(cfg->upload_dir);
+            cfg->upload_dir = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_TLS_CERT")) != NULL) {
+        if (is_valid_file(env_var)) {
+            free(cfg->tls_cert);
+            cfg->tls_cert = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_TLS_KEY")) != NULL) {
+        if (is_valid_file(env_var)) {
+            free(cfg->tls_key);
+            cfg->tls_key = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_ACL_FILE")) != NULL) {
+        if (is_valid_file(env_var)) {
+            free(cfg->acl_file);
+            cfg->acl_file = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_REWRITE_FILE")) != NULL) {
+        if (is_valid_file(env_var)) {
+            free(cfg->rewrite_file);
+            cfg->rewrite_file = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_MODULES")) != NULL) {
+        free(cfg->modules);
+        cfg->modules = strdup(env_var);
+    }
+    if ((env_var = getenv("DC_HTTP_FASTCGI_SOCKET")) != NULL) {
+        if (is_valid_socket(env_var)) {
+            free(cfg->fastcgi_socket);
+            cfg->fastcgi_socket = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_FASTCGI_PREFIX")) != NULL) {
+        if (is_valid_prefix(env_var)) {
+            free(cfg->fastcgi_prefix);
+            cfg->fastcgi_prefix = strdup(env_var);
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_NUMA")) != NULL) {
+        if (is_valid_switch(env_var)) {
+            cfg->numa = tolower(env_var[0]) == 'y';
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_HUGE_PAGES")) != NULL) {
+        if (is_valid_switch(env_var)) {
+            cfg->huge_pages = tolower(env_var[0]) == 'y';
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_SRPT")) != NULL) {
+        if (is_valid_switch(env_var)) {
+            cfg->srpt = tolower(env_var[0]) == 'y';
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_DEFER_ACCEPT")) != NULL) {
+        char *ptr;
+        int defer_accept = (int) strtoul(env_var, &ptr, 0);
+        if (is_valid_tcp_option(defer_accept) && *env_var != '\0' && *ptr == '\0') {
+            cfg->defer_accept = defer_accept;
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_FASTOPEN")) != NULL) {
+        char *ptr;
+        int fastopen = (int) strtoul(env_var, &ptr, 0);
+        if (is_valid_tcp_option(fastopen) && *env_var != '\0' && *ptr == '\0') {
+            cfg->fastopen = fastopen;
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_ZEROCOPY_THRESHOLD")) != NULL) {
+        char *ptr;
+        int zerocopy_threshold = (int) strtoul(env_var, &ptr, 0);
+        if (is_valid_zerocopy_threshold(zerocopy_threshold) && *env_var != '\0' && *ptr == '\0') {
+            cfg->zerocopy_threshold = zerocopy_threshold;
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_RATE_LIMIT")) != NULL) {
+        char *ptr;
+        int rate_limit = (int) strtoul(env_var, &ptr, 0);
+        if (is_valid_rate(rate_limit) && *env_var != '\0' && *ptr == '\0') {
+            cfg->rate_limit = rate_limit;
+        }
+    }
+    if ((env_var = getenv("DC_HTTP_RATE_BURST")) != NULL) {
+        char *ptr;
+        int rate_burst = (int) strtoul(env_var, &ptr, 0);
+        if (is_valid_rate(rate_burst) && *env_var != '\0' && *ptr == '\0') {
+            cfg->rate_burst = rate_burst;
+        }
+    }
 }
 
 /**
  * Parses command line arguments for any options passed in,
  * and sets any valid values for the config.
- * Valid options are: port, mode, root-dir, index-page, not-found-page
+ * Valid options are: port, mode, root-dir, index-page, not-found-page, upload-dir,
+ * tls-cert, tls-key, acl-file, rewrite-file, modules, fastcgi-socket, fastcgi-prefix, numa, huge-pages, srpt, defer-accept, fastopen, zerocopy-threshold,
+ * rate-limit, rate-burst
  * @param cfg - the config
  * @param argc - arg count
  * @param argv - arg values
@@ -183,9 +471,25 @@ static void parse_cmd_line_options(config *cfg, int argc, char **argv) {
             {"root-dir",       optional_argument, 0,          'r'},
             {"index-page",     optional_argument, 0,          'i'},
             {"not-found-page", optional_argument, 0,          'n'},
+            {"upload-dir",     optional_argument, 0,          'u'},
+            {"tls-cert",       optional_argument, 0,          'c'},
+            {"tls-key",        optional_argument, 0,          'k'},
+            {"acl-file",       optional_argument, 0,          'a'},
+            {"rewrite-file",   optional_argument, 0,          'w'},
+            {"modules",        optional_argument, 0,          'M'},
+            {"fastcgi-socket", optional_argument, 0,          'F'},
+            {"fastcgi-prefix", optional_argument, 0,          'P'},
+            {"numa",           optional_argument, 0,          'N'},
+            {"huge-pages",     optional_argument, 0,          'H'},
+            {"srpt",           optional_argument, 0,          'S'},
+            {"defer-accept",   optional_argument, 0,          'd'},
+            {"fastopen",       optional_argument, 0,          'f'},
+            {"zerocopy-threshold", optional_argument, 0,      'z'},
+            {"rate-limit",     optional_argument, 0,          'l'},
+            {"rate-burst",     optional_argument, 0,          'b'},
             {"help",           no_argument,       &help_flag, 1}
     };
-    while ((opt = getopt_long(argc, argv, "p:m:r:i:n:", long_options, &opt_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "p:m:r:i:n:u:c:k:a:w:M:F:P:N:H:S:d:f:z:l:b:", long_options, &opt_index)) != -1) {
         if (help_flag) {
             fprintf(stdout, "%s", "Usage:\n\n");
             fprintf(stdout, "%s", "Command line options:\n");
@@ -194,7 +498,26 @@ static void parse_cmd_line_options(config *cfg, int argc, char **argv) {
             fprintf(stdout, "%s", "                                     Accepts any input which begins with 'p' or 't' (case insensitive). \n");
             fprintf(stdout, "%s", "-r DIR,  --root-dir=DIR              Sets DIR as the directory the html files are served from.\n");
             fprintf(stdout, "%s", "-i PAGE, --index-page=PAGE           Sets PAGE as the index page.\n");
-            fprintf(stdout, "%s", "-n PAGE, --not-found-page=PAGE       Sets PAGE as the 404 page.\n\n");
+            fprintf(stdout, "%s", "-n PAGE, --not-found-page=PAGE       Sets PAGE as the 404 page.\n");
+            fprintf(stdout, "%s", "-u DIR,  --upload-dir=DIR            Sets DIR as the directory POST and PUT bodies are stored in.\n");
+            fprintf(stdout, "%s", "-c FILE, --tls-cert=FILE             Sets FILE as the PEM certificate chain and enables HTTPS.\n");
+            fprintf(stdout, "%s", "-k FILE, --tls-key=FILE              Sets FILE as the PEM private key for the certificate.\n");
+            fprintf(stdout, "%s", "-a FILE, --acl-file=FILE             Allows or denies clients by the CIDR rules in FILE, one 'allow' or 'deny' per line.\n");
+            fprintf(stdout, "%s", "-w FILE, --rewrite-file=FILE         Rewrites or redirects requests by the rules in FILE, one 'rewrite' or 'redirect' per line.\n");
+            fprintf(stdout, "%s", "-M LIST, --modules=LIST              Loads the handler modules in LIST, shared objects separated by ':'.\n");
+            fprintf(stdout, "%s", "-F PATH, --fastcgi-socket=PATH       Passes requests under the FastCGI prefix to the backend on the UNIX socket PATH.\n");
+            fprintf(stdout, "%s", "-P PATH, --fastcgi-prefix=PATH       Routes requests for paths under PATH to the FastCGI backend. Read at startup.\n");
+            fprintf(stdout, "%s", "-N YES,  --numa=YES                  Runs one acceptor and worker group per NUMA node. Read at startup.\n");
+            fprintf(stdout, "%s", "                                     Accepts any input which begins with 'y' or 'n' (case insensitive). \n");
+            fprintf(stdout, "%s", "-H YES,  --huge-pages=YES            Backs I/O buffers and mapped files with 2 MB pages. Read at startup.\n");
+            fprintf(stdout, "%s", "                                     Accepts any input which begins with 'y' or 'n' (case insensitive). \n");
+            fprintf(stdout, "%s", "-S YES,  --srpt=YES                  Sends the response with the fewest bytes left first, in bounded slices.\n");
+            fprintf(stdout, "%s", "                                     Accepts any input which begins with 'y' or 'n' (case insensitive). \n");
+            fprintf(stdout, "%s", "-d SECS, --defer-accept=SECS         Only accepts connections once a request arrives, waiting up to SECS (0 is off).\n");
+            fprintf(stdout, "%s", "-f LEN,  --fastopen=LEN              Enables TCP Fast Open with a queue of LEN pending connections (0 is off).\n");
+            fprintf(stdout, "%s", "-z LEN,  --zerocopy-threshold=LEN    Sends cleartext HTTP/2 writes of at least LEN bytes with MSG_ZEROCOPY (0 is off).\n");
+            fprintf(stdout, "%s", "-l RATE, --rate-limit=RATE           Limits each client IP to RATE connections per second (0 is off).\n");
+            fprintf(stdout, "%s", "-b LEN,  --rate-burst=LEN            Lets each client IP open LEN connections at once before the rate limit applies.\n\n");
 
             fprintf(stdout, "%s", "Environment variables:\n");
             fprintf(stdout, "%s", "DC_HTTP_PORT                         Sets the port (max 65535).\n");
@@ -202,7 +525,26 @@ static void parse_cmd_line_options(config *cfg, int argc, char **argv) {
             fprintf(stdout, "%s", "                                     Accepts any input which begins with 'p' or 't' (case insensitive). \n");
             fprintf(stdout, "%s", "DC_HTTP_ROOT_DIR                     Sets the directory the html files are served from.\n");
             fprintf(stdout, "%s", "DC_HTTP_INDEX_PAGE                   Sets the index page.\n");
-            fprintf(stdout, "%s", "DC_HTTP_NOT_FOUND_PAGE               Sets the 404 page.\n\n");
+            fprintf(stdout, "%s", "DC_HTTP_NOT_FOUND_PAGE               Sets the 404 page.\n");
+            fprintf(stdout, "%s", "DC_HTTP_UPLOAD_DIR                   Sets the directory POST and PUT bodies are stored in.\n");
+            fprintf(stdout, "%s", "DC_HTTP_TLS_CERT                     Sets the PEM certificate chain and enables HTTPS.\n");
+            fprintf(stdout, "%s", "DC_HTTP_TLS_KEY                      Sets the PEM private key for the certificate.\n");
+            fprintf(stdout, "%s", "DC_HTTP_ACL_FILE                     Sets the file of CIDR rules clients are allowed or denied by.\n");
+            fprintf(stdout, "%s", "DC_HTTP_REWRITE_FILE                 Sets the file of rules requests are rewritten or redirected by.\n");
+            fprintf(stdout, "%s", "DC_HTTP_MODULES                      Sets the handler modules to load, shared objects separated by ':'.\n");
+            fprintf(stdout, "%s", "DC_HTTP_FASTCGI_SOCKET               Sets the UNIX socket of the FastCGI backend.\n");
+            fprintf(stdout, "%s", "DC_HTTP_FASTCGI_PREFIX               Sets the path requests are routed to the FastCGI backend under. Read at startup.\n");
+            fprintf(stdout, "%s", "DC_HTTP_NUMA                         Runs one acceptor and worker group per NUMA node. Read at startup.\n");
+            fprintf(stdout, "%s", "                                     Accepts any input which begins with 'y' or 'n' (case insensitive). \n");
+            fprintf(stdout, "%s", "DC_HTTP_HUGE_PAGES                   Backs I/O buffers and mapped files with 2 MB pages. Read at startup.\n");
+            fprintf(stdout, "%s", "                                     Accepts any input which begins with 'y' or 'n' (case insensitive). \n");
+            fprintf(stdout, "%s", "DC_HTTP_SRPT                         Sends the response with the fewest bytes left first, in bounded slices.\n");
+            fprintf(stdout, "%s", "                                     Accepts any input which begins with 'y' or 'n' (case insensitive). \n");
+            fprintf(stdout, "%s", "DC_HTTP_DEFER_ACCEPT                 Sets the seconds to wait for a request before accepting (0 is off).\n");
+            fprintf(stdout, "%s", "DC_HTTP_FASTOPEN                     Sets the TCP Fast Open queue length (0 is off).\n");
+            fprintf(stdout, "%s", "DC_HTTP_ZEROCOPY_THRESHOLD           Sets the smallest write sent with MSG_ZEROCOPY in bytes (0 is off).\n");
+            fprintf(stdout, "%s", "DC_HTTP_RATE_LIMIT                   Sets the connections per second allowed from each client IP (0 is off).\n");
+            fprintf(stdout, "%s", "DC_HTTP_RATE_BURST                   Sets the connections each client IP may open at once.\n\n");
             destroy_config(cfg);
             exit(EXIT_SUCCESS);
         }
@@ -241,6 +583,107 @@ static void parse_cmd_line_options(config *cfg, int argc, char **argv) {
                 free(cfg->not_found_page);
                 cfg->not_found_page = strdup(optarg);
                 break;
+            case 'u':
+                if (is_valid_directory(optarg)) {
+                    free(cfg->upload_dir);
+                    cfg->upload_dir = strdup(optarg);
+                }
+                break;
+            case 'c':
+                if (is_valid_file(optarg)) {
+                    free(cfg->tls_cert);
+                    cfg->tls_cert = strdup(optarg);
+                }
+                break;
+            case 'k':
+                if (is_valid_file(optarg)) {
+                    free(cfg->tls_key);
+                    cfg->tls_key = strdup(optarg);
+                }
+                break;
+            case 'a':
+                if (is_valid_file(optarg)) {
+                    free(cfg->acl_file);
+                    cfg->acl_file = strdup(optarg);
+                }
+                break;
+            case 'w':
+                if (is_valid_file(optarg)) {
+                    free(cfg->rewrite_file);
+                    cfg->rewrite_file = strdup(optarg);
+                }
+                break;
+            case 'M':
+                free(cfg->modules);
+                cfg->modules = strdup(optarg);
+                break;
+            case 'F':
+                if (is_valid_socket(optarg)) {
+                    free(cfg->fastcgi_socket);
+                    cfg->fastcgi_socket = strdup(optarg);
+                }
+                break;
+            case 'P':
+                if (is_valid_prefix(optarg)) {
+                    free(cfg->fastcgi_prefix);
+                    cfg->fastcgi_prefix = strdup(optarg);
+                }
+                break;
+            case 'N':
+                if (is_valid_switch(optarg)) {
+                    cfg->numa = tolower(optarg[0]) == 'y';
+                }
+                break;
+            case 'H':
+                if (is_valid_switch(optarg)) {
+                    cfg->huge_pages = tolower(optarg[0]) == 'y';
+                }
+                break;
+            case 'S':
+                if (is_valid_switch(optarg)) {
+                    cfg->srpt = tolower(optarg[0]) == 'y';
+                }
+                break;
+            case 'd': {
+                char *ptr;
+                int defer_accept = (int) strtoul(optarg, &ptr, 0);
+                if (is_valid_tcp_option(defer_accept) && *ptr == '\0') {
+                    cfg->defer_accept = defer_accept;
+                }
+                break;
+            }
+            case 'f': {
+                char *ptr;
+                int fastopen = (int) strtoul(optarg, &ptr, 0);
+                if (is_valid_tcp_option(fastopen) && *ptr == '\0') {
+                    cfg->fastopen = fastopen;
+                }
+                break;
+            }
+            case 'z': {
+                char *ptr;
+                int zerocopy_threshold = (int) strtoul(optarg, &ptr, 0);
+                if (is_valid_zerocopy_threshold(zerocopy_threshold) && *ptr == '\0') {
+                    cfg->zerocopy_threshold = zerocopy_threshold;
+                }
+                break;
+            }
+            case 'l': {
+                char *ptr;
+                int rate_limit = (int) strtoul(optarg, &ptr, 0);
+                if (is_valid_rate(rate_limit) && *ptr == '\0') {
+                    cfg->rate_limit = rate_limit;
+                }
+                break;
+            }
+            case 'b': {
+                char *ptr;
+                int rate_burst = (int) strtoul(optarg, &ptr, 0);
+                if (is_valid_rate(rate_burst) && *ptr == '\0') {
+                    cfg->rate_burst = rate_burst;
+                }
+                break;
+            }
             default:
                 break;
         }
@@ -266,4 +709,60 @@ static void set_cmd_line_config(config *cfg, config *cmd_cfg) {
         free(cfg->not_found_page);
         cfg->not_found_page = strdup(cmd_cfg->not_found_page);
     }
+    if(is_valid_directory(cmd_cfg->upload_dir)) {
+        free(cfg->upload_dir);
+        cfg->upload_dir = strdup(cmd_cfg->upload_dir);
+    }
+    if(is_valid_file(cmd_cfg->tls_cert)) {
+        free(cfg->tls_cert);
+        cfg->tls_cert = strdup(cmd_cfg->tls_cert);
+    }
+    if(is_valid_file(cmd_cfg->tls_key)) {
+        free(cfg->tls_key);
+        cfg->tls_key = strdup(cmd_cfg->tls_key);
+    }
+    if(is_valid_file(cmd_cfg->acl_file)) {
+        free(cfg->acl_file);
+        cfg->acl_file = strdup(cmd_cfg->acl_file);
+    }
+    if(is_valid_file(cmd_cfg->rewrite_file)) {
+        free(cfg->rewrite_file);
+        cfg->rewrite_file = strdup(cmd_cfg->rewrite_file);
+    }
+    if(cmd_cfg->modules != NULL) {
+        free(cfg->modules);
+        cfg->modules = strdup(cmd_cfg->modules);
+    }
+    if(is_valid_socket(cmd_cfg->fastcgi_socket)) {
+        free(cfg->fastcgi_socket);
+        cfg->fastcgi_socket = strdup(cmd_cfg->fastcgi_socket);
+    }
+    if(is_valid_prefix(cmd_cfg->fastcgi_prefix)) {
+        free(cfg->fastcgi_prefix);
+        cfg->fastcgi_prefix = strdup(cmd_cfg->fastcgi_prefix);
+    }
+    if(cmd_cfg->numa != -1) {
+        cfg->numa = cmd_cfg->numa;
+    }
+    if(cmd_cfg->huge_pages != -1) {
+        cfg->huge_pages = cmd_cfg->huge_pages;
+    }
+    if(cmd_cfg->srpt != -1) {
+        cfg->srpt = cmd_cfg->srpt;
+    }
+    if(is_valid_tcp_option(cmd_cfg->defer_accept)) {
+        cfg->defer_accept = cmd_cfg->defer_accept;
+    }
+    if(is_valid_tcp_option(cmd_cfg->fastopen)) {
+        cfg->fastopen = cmd_cfg->fastopen;
+    }
+    if(is_valid_zerocopy_threshold(cmd_cfg->zerocopy_threshold)) {
+        cfg->zerocopy_threshold = cmd_cfg->zerocopy_threshold;
+    }
+    if(is_valid_rate(cmd_cfg->rate_limit)) {
+        cfg->rate_limit = cmd_cfg->rate_limit;
+    }
+    if(is_valid_rate(cmd_cfg->rate_burst)) {
+        cfg->rate_burst = cmd_cfg->rate_burst;
+    }
 }
@@ -4,6 +4,9 @@
 #include <libconfig.h>
 
 #define MAX_PORT 65535
+#define MAX_TCP_OPTION 65535
+#define MAX_ZEROCOPY_THRESHOLD 1073741824
+#define MAX_RATE_LIMIT 1000000
 
 /**
  * The config struct.
@@ -12,8 +15,24 @@ typedef struct {
     char *root_dir;
     char *index_page;
     char *not_found_page;
+    char *upload_dir;
+    char *tls_cert;
+    char *tls_key;
+    char *acl_file;
+    char *rewrite_file;
+    char *modules;
+    char *fastcgi_socket;
+    char *fastcgi_prefix;
     char mode;
     int port;
+    int numa;
+    int huge_pages;
+    int srpt;
+    int defer_accept;
+    int fastopen;
+    int zerocopy_threshold;
+    int rate_limit;
+    int rate_burst;
 } config;
 
 /**
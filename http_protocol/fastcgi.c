@@ -0,0 +1,772 @@
+#define _GNU_SOURCE
+
+#include "fastcgi.h"
+#include "http_body.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Each connection carries one request at a time, so every request can use
+// the same id
+#define REQUEST_ID 1
+
+typedef struct {
+    int fd;
+    unsigned int generation;
+    int reusable;
+    int status;
+    int ended;
+    int http11;
+    int backend_failed;
+    int answered_early;
+    int stdin_cut;
+    uint8_t * early;
+    size_t early_len;
+    size_t early_pos;
+    size_t early_capacity;
+    http_response * response;
+    http_chunked_writer * writer;
+    const char * pending;
+    size_t pending_len;
+    size_t header_len;
+    char header[FASTCGI_MAX_RESPONSE_HEADER];
+    uint8_t record[FASTCGI_HEADER_LEN + FASTCGI_MAX_CONTENT + FASTCGI_MAX_PADDING];
+} fastcgi_relay;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+static int idle[FASTCGI_POOL_SIZE];
+static size_t idle_count;
+static char * idle_path;
+static unsigned int generation;
+
+/**
+ * Starts a request for request on a pooled connection and sends its
+ * parameters. The request body follows from receive_body.
+ * @param conf
+ * @param request
+ * @param response
+ * @param match
+ */
+static void serve_fastcgi(config * conf, http_request * request, http_response * response, const router_match * match);
+/**
+ * Streams the request body to the backend and ends it.
+ * @param ctx
+ * @param request
+ * @param response
+ * @param cfd
+ */
+static void receive_body(void * ctx, http_request * request, http_response * response, int cfd);
+/**
+ * Relays the backend's response to cfd as it arrives.
+ * @param ctx
+ * @param response
+ * @param cfd
+ */
+static void send_relayed(void * ctx, http_response * response, int cfd);
+/**
+ * Returns the connection of a relay to the pool if it is clean, and frees the
+ * relay.
+ * @param ctx
+ */
+static void destroy_relay(void * ctx);
+/**
+ * Returns an idle connection to the backend at path or opens a new one.
+ * @param path
+ * @param pool_generation set to the pool the connection belongs to
+ * @return the connection or -1 if the backend is not reachable
+ */
+static int acquire_connection(const char * path, unsigned int * pool_generation);
+/**
+ * Keeps fd for the next request if the pool has room and the backend did not
+ * change since fd was acquired, and closes it otherwise.
+ * @param fd
+ * @param pool_generation
+ */
+static void release_connection(int fd, unsigned int pool_generation);
+/**
+ * Connects to the UNIX socket at path.
+ * @param path
+ * @return the connection or -1 on error
+ */
+static int connect_backend(const char * path);
+/**
+ * Sends BEGIN_REQUEST and the CGI parameters of request.
+ * @param relay
+ * @param conf
+ * @param request
+ * @param match
+ * @return 0 on success, -1 on error
+ */
+static int begin_request(fastcgi_relay * relay, config * conf, http_request * request, const router_match * match);
+/**
+ * Appends one name-value pair to the PARAMS stream being built in buf.
+ * @param buf
+ * @param len
+ * @param name
+ * @param name_len
+ * @param value
+ * @param value_len
+ * @return 0 on success, -1 if buf is full
+ */
+static int add_param(uint8_t * buf, size_t * len, const char * name, size_t name_len, const char * value, size_t value_len);
+/**
+ * Adds a NUL-terminated name and value with add_param.
+ * @param buf
+ * @param len
+ * @param name
+ * @param value
+ * @return 0 on success, -1 if buf is full
+ */
+static int add_string_param(uint8_t * buf, size_t * len, const char * name, const char * value);
+/**
+ * Sends data as records of type, splitting it as needed. An empty data sends
+ * the empty record that ends a stream. Records the backend sends meanwhile
+ * are kept with stash_record, as a backend that answers while it reads the
+ * request stops reading once its own output backs up. Once the backend has
+ * ended the request, the rest of the request is dropped.
+ * @param relay
+ * @param type
+ * @param data
+ * @param len
+ * @return 0 on success, -1 on error
+ */
+static int write_records(fastcgi_relay * relay, uint8_t type, const void * data, size_t len);
+/**
+ * Reads a record from the backend and appends it to relay->early, for
+ * read_record to return once the request has been sent.
+ * @param relay
+ * @return 0 on success, -1 on error or if out of memory
+ */
+static int stash_record(fastcgi_relay * relay);
+/**
+ * Matches http_body_sink, sending a slice of the request body as STDIN.
+ * @param ctx
+ * @param data
+ * @param len
+ * @return len or -1 on error
+ */
+static ssize_t send_stdin(void * ctx, const char * data, size_t len);
+/**
+ * Returns the next record of the request, from relay->early first and then
+ * from the backend, read into relay->record.
+ * @param relay
+ * @param content set to the content of the record
+ * @param len set to the length of the content
+ * @return the record type or -1 on error
+ */
+static int read_record(fastcgi_relay * relay, uint8_t ** content, size_t * len);
+/**
+ * Reads len bytes from fd.
+ * @param fd
+ * @param buf
+ * @param len
+ * @return 0 on success, -1 on error or end of file
+ */
+static int read_full(int fd, void * buf, size_t len);
+/**
+ * Reads the CGI response header from the backend into response. Sets
+ * relay->status on failure.
+ * @param relay
+ * @param response
+ */
+static void read_response_header(fastcgi_relay * relay, http_response * response);
+/**
+ * Parses the CGI header lines in relay->header up to end.
+ * @param relay
+ * @param response
+ * @param end
+ */
+static void parse_response_header(fastcgi_relay * relay, http_response * response, size_t end);
+/**
+ * Passes the response body to sink as it arrives, up to END_REQUEST.
+ * @param relay
+ * @param sink
+ * @return 0 on success, -1 on error
+ */
+static int relay_body(fastcgi_relay * relay, http_body_sink sink);
+/**
+ * Matches http_body_sink, writing a slice of the body to the client.
+ * @param ctx
+ * @param data
+ * @param len
+ * @return len or -1 on error
+ */
+static ssize_t write_client(void * ctx, const char * data, size_t len);
+/**
+ * Matches http_body_sink, appending a slice of the body to the response.
+ * @param ctx
+ * @param data
+ * @param len
+ * @return len or -1 if out of memory
+ */
+static ssize_t collect_body(void * ctx, const char * data, size_t len);
+static void register_fork_handlers(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+int fastcgi_add_routes(router * routes, const char * prefix) {
+    if (prefix == NULL || prefix[0] != '/')
+        return -1;
+
+    size_t prefix_len = strlen(prefix);
+    while (prefix_len > 0 && prefix[prefix_len - 1] == '/') prefix_len--;
+    char * pattern = malloc(prefix_len + sizeof("/*path"));
+    if (pattern == NULL)
+        return -1;
+    memcpy(pattern, prefix, prefix_len);
+    strcpy(pattern + prefix_len, "/*path");
+
+    int result = 0;
+    result |= router_add(routes, METHOD_GET, pattern, serve_fastcgi, NULL);
+    result |= router_add(routes, METHOD_HEAD, pattern, serve_fastcgi, NULL);
+    result |= router_add(routes, METHOD_POST, pattern, serve_fastcgi, NULL);
+    result |= router_add(routes, METHOD_PUT, pattern, serve_fastcgi, NULL);
+    free(pattern);
+    return result;
+}
+
+static void serve_fastcgi(config * conf, http_request * request, http_response * response, const router_match * match) {
+    fastcgi_relay * relay = conf->fastcgi_socket != NULL ? malloc(sizeof(fastcgi_relay)) : NULL;
+    if (relay == NULL) {
+        response->response_code = HTTP_BAD_GATEWAY;
+        sm_put(response->header_fields, "Content-Length", "0");
+        return;
+    }
+    memset(relay, 0, offsetof(fastcgi_relay, header));
+    relay->response = response;
+    relay->http11 = request->http_version != NULL && strcmp(request->http_version, "HTTP/1.1") == 0;
+    relay->fd = acquire_connection(conf->fastcgi_socket, &relay->generation);
+    response->relay.ctx = relay;
+    response->relay.receive = receive_body;
+    response->relay.send = send_relayed;
+    response->relay.destroy = destroy_relay;
+    response->response_code = HTTP_OK;
+
+    if (relay->fd == -1 || begin_request(relay, conf, request, match) == -1) {
+        relay->status = HTTP_BAD_GATEWAY;
+    } else if (request->http_version != NULL && strcmp(request->http_version, "HTTP/2") == 0) {
+        // HTTP/2 streams are sent from a response built in memory, and only
+        // carry GET and HEAD so there is no body to stream
+        if (write_records(relay, FASTCGI_STDIN, NULL, 0) == -1)
+            relay->status = HTTP_BAD_GATEWAY;
+        if (relay->status == 0)
+            read_response_header(relay, response);
+        if (relay->status == 0 && relay_body(relay, collect_body) == -1)
+            relay->status = HTTP_BAD_GATEWAY;
+    }
+
+    if (relay->status != 0) {
+        free(response->body);
+        response->body = NULL;
+        response->body_len = 0;
+        response->response_code = relay->status;
+        sm_put(response->header_fields, "Content-Length", "0");
+    } else if (response->body != NULL || relay->ended) {
+        char size_buffer[21];
+        snprintf(size_buffer, sizeof(size_buffer), "%zu", response->body_len);
+        sm_put(response->header_fields, "Content-Length", size_buffer);
+    }
+}
+
+static void receive_body(void * ctx, http_request * request, http_response * response, int cfd) {
+    (void) response;
+    fastcgi_relay * relay = ctx;
+    if (relay->status != 0)
+        return;
+
+    if (request->method == METHOD_POST || request->method == METHOD_PUT) {
+        http_body_reader reader;
+        if (http_body_reader_init(&reader, request, cfd) == -1) {
+            relay->status = HTTP_LENGTH_REQUIRED;
+            return;
+        }
+        if (http_body_stream(&reader, send_stdin, relay) < 0) {
+            relay->status = relay->backend_failed ? HTTP_BAD_GATEWAY : HTTP_BAD_REQUEST;
+            return;
+        }
+    }
+    if (write_records(relay, FASTCGI_STDIN, NULL, 0) == -1)
+        relay->status = HTTP_BAD_GATEWAY;
+}
+
+static void send_relayed(void * ctx, http_response * response, int cfd) {
+    fastcgi_relay * relay = ctx;
+    if (relay->status == 0)
+        read_response_header(relay, response);
+
+    if (relay->status != 0) {
+        response->response_code = relay->status;
+        response->reason = NULL;
+        sm_put(response->header_fields, "Content-Length", "0");
+    } else if (sm_get(response->header_fields, "Content-Length") == NULL && response->method != METHOD_HEAD) {
+        // Without a length from the backend the body is chunked for HTTP/1.1
+        // clients and delimited by closing the connection for the rest
+        response->is_chunked = relay->http11;
+        if (response->is_chunked)
+            sm_put(response->header_fields, "Transfer-Encoding", "chunked");
+        sm_put(response->header_fields, "Connection", "close");
+    }
+
+    char header_buf[MAX_RESPONSE_HEADER_LEN];
+    size_t header_len = format_response_header(response, header_buf, MAX_RESPONSE_HEADER_LEN);
+    http_chunked_writer writer;
+    http_chunked_init(&writer, cfd, response->is_chunked, header_buf, header_len);
+    relay->writer = response->method != METHOD_HEAD ? &writer : NULL;
+
+    if (relay->status == 0)
+        relay_body(relay, write_client);
+    http_chunked_finish(&writer);
+}
+
+static void destroy_relay(void * ctx) {
+    fastcgi_relay * relay = ctx;
+    if (relay->fd != -1) {
+        // A backend that ended the request before reading all of it may still
+        // have parts of it coming
+        if (relay->reusable && !relay->stdin_cut)
+            release_connection(relay->fd, relay->generation);
+        else
+            close(relay->fd);
+    }
+    free(relay->early);
+    free(relay);
+}
+
+static int acquire_connection(const char * path, unsigned int * pool_generation) {
+    pthread_once(&fork_once, register_fork_handlers);
+
+    int fd = -1;
+    pthread_mutex_lock(&pool_lock);
+    if (idle_path == NULL || strcmp(idle_path, path) != 0) {
+        // The backend moved, so its old connections are of no use
+        while (idle_count > 0) close(idle[--idle_count]);
+        free(idle_path);
+        idle_path = strdup(path);
+        generation++;
+    }
+    *pool_generation = generation;
+    while (idle_count > 0) {
+        fd = idle[--idle_count];
+        // Nothing is due on an idle connection, so one that polls readable
+        // was closed by the backend
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 0) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    return fd != -1 ? fd : connect_backend(path);
+}
+
+static void release_connection(int fd, unsigned int pool_generation) {
+    pthread_mutex_lock(&pool_lock);
+    if (pool_generation == generation && idle_count < FASTCGI_POOL_SIZE) {
+        idle[idle_count++] = fd;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (fd != -1)
+        close(fd);
+}
+
+static int connect_backend(const char * path) {
+    struct sockaddr_un addr = { 0 };
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    // A stuck backend fails the request instead of holding the worker
+    struct timeval timeout = { FASTCGI_TIMEOUT_MS / 1000, (FASTCGI_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int begin_request(fastcgi_relay * relay, config * conf, http_request * request, const router_match * match) {
+    uint8_t begin[8] = { 0, FASTCGI_RESPONDER, FASTCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+    if (write_records(relay, FASTCGI_BEGIN_REQUEST, begin, sizeof(begin)) == -1)
+        return -1;
+
+    const char * methods[] = { "", "HEAD", "GET", "POST", "PUT" };
+    const char * uri = match->path;
+    size_t path_len = strcspn(uri, "?");
+    const char * query = uri[path_len] == '?' ? uri + path_len + 1 : "";
+    char * root = conf->root_dir != NULL ? conf->root_dir : "";
+
+    uint8_t * params = relay->record;
+    size_t len = 0;
+    int result = 0;
+    result |= add_string_param(params, &len, "GATEWAY_INTERFACE", "CGI/1.1");
+    result |= add_string_param(params, &len, "SERVER_SOFTWARE", "DataComm/0.1");
+    result |= add_string_param(params, &len, "SERVER_PROTOCOL", request->http_version != NULL ? request->http_version : "HTTP/1.0");
+    result |= add_string_param(params, &len, "REQUEST_METHOD", methods[request->method]);
+    result |= add_string_param(params, &len, "REQUEST_URI", uri);
+    result |= add_string_param(params, &len, "QUERY_STRING", query);
+    result |= add_param(params, &len, "SCRIPT_NAME", strlen("SCRIPT_NAME"), uri, path_len);
+    result |= add_string_param(params, &len, "DOCUMENT_ROOT", root);
+
+    char script_filename[MAX_URI_PATH_LEN];
+    int filename_len = snprintf(script_filename, sizeof(script_filename), "%s%.*s", root, (int) path_len, uri);
+    if (filename_len < 0 || (size_t) filename_len >= sizeof(script_filename))
+        return -1;
+    result |= add_string_param(params, &len, "SCRIPT_FILENAME", script_filename);
+
+    // Header fields become HTTP_ parameters, apart from the two CGI names.
+    // Proxy is dropped, as HTTP_PROXY would set the backend's outgoing proxy
+    // (httpoxy)
+    str_map * header_fields = request->header_fields;
+    size_t header_lines = header_fields != NULL ? sm_size(header_fields) : 0;
+    char ** header_keys = header_fields != NULL ? sm_get_keys(header_fields) : NULL;
+    for (size_t i = 0; i < header_lines; i++) {
+        const char * key = header_keys[i];
+        const char * value = http_get_header(header_fields, key);
+        char name[MAX_HEADER_VALUE_LEN];
+        if (strcasecmp(key, "Proxy") == 0) {
+            continue;
+        } else if (strcasecmp(key, "Content-Length") == 0) {
+            result |= add_string_param(params, &len, "CONTENT_LENGTH", value);
+        } else if (strcasecmp(key, "Content-Type") == 0) {
+            result |= add_string_param(params, &len, "CONTENT_TYPE", value);
+        } else if (strlen(key) + 5 < sizeof(name)) {
+            size_t name_len = 0;
+            memcpy(name, "HTTP_", 5);
+            for (name_len = 5; *key != '\0'; key++)
+                name[name_len++] = *key == '-' ? '_' : (char) toupper((unsigned char) *key);
+            result |= add_param(params, &len, name, name_len, value, strlen(value));
+        }
+    }
+
+    if (result != 0)
+        return -1;
+    if (write_records(relay, FASTCGI_PARAMS, params, len) == -1)
+        return -1;
+    return write_records(relay, FASTCGI_PARAMS, NULL, 0);
+}
+
+static int add_param(uint8_t * buf, size_t * len, const char * name, size_t name_len, const char * value, size_t value_len) {
+    size_t need = (name_len > 127 ? 4 : 1) + (value_len > 127 ? 4 : 1) + name_len + value_len;
+    if (*len + need > FASTCGI_PARAMS_LEN)
+        return -1;
+
+    // Lengths over 127 take four bytes with the top bit set
+    size_t lengths[2] = { name_len, value_len };
+    for (int i = 0; i < 2; i++) {
+        if (lengths[i] > 127) {
+            buf[(*len)++] = (uint8_t) (lengths[i] >> 24 | 0x80);
+            buf[(*len)++] = (uint8_t) (lengths[i] >> 16);
+            buf[(*len)++] = (uint8_t) (lengths[i] >> 8);
+        }
+        buf[(*len)++] = (uint8_t) lengths[i];
+    }
+    memcpy(buf + *len, name, name_len);
+    *len += name_len;
+    memcpy(buf + *len, value, value_len);
+    *len += value_len;
+    return 0;
+}
+
+static int add_string_param(uint8_t * buf, size_t * len, const char * name, const char * value) {
+    return add_param(buf, len, name, strlen(name), value, strlen(value));
+}
+
+static int write_records(fastcgi_relay * relay, uint8_t type, const void * data, size_t len) {
+    const char * next = data;
+    do {
+        if (relay->answered_early) {
+            relay->stdin_cut = 1;
+            return 0;
+        }
+        size_t content_len = len < FASTCGI_MAX_CONTENT ? len : FASTCGI_MAX_CONTENT;
+        uint8_t header[FASTCGI_HEADER_LEN] = {
+            FASTCGI_VERSION, type, REQUEST_ID >> 8, REQUEST_ID & 0xff,
+            (uint8_t) (content_len >> 8), (uint8_t) content_len, 0, 0
+        };
+        struct iovec iov[2] = { { header, sizeof(header) }, { (void *) next, content_len } };
+        int iovcnt = content_len > 0 ? 2 : 1;
+        struct iovec * pos = iov;
+        while (iovcnt > 0) {
+            struct pollfd pfd = { relay->fd, POLLOUT, 0 };
+            if (relay->early_len < FASTCGI_MAX_BUFFERED && !relay->answered_early)
+                pfd.events |= POLLIN;
+            int ready = poll(&pfd, 1, FASTCGI_TIMEOUT_MS);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready <= 0)
+                return -1;
+            if (pfd.revents & POLLIN) {
+                if (stash_record(relay) == -1)
+                    return -1;
+                if (relay->answered_early) {
+                    relay->stdin_cut = 1;
+                    return 0;
+                }
+                continue;
+            }
+            if (!(pfd.revents & POLLOUT))
+                return -1;
+
+            struct msghdr msg = { 0 };
+            msg.msg_iov = pos;
+            msg.msg_iovlen = iovcnt;
+            ssize_t num_written = sendmsg(relay->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (num_written < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                return -1;
+            }
+            while (iovcnt > 0 && (size_t) num_written >= pos->iov_len) {
+                num_written -= pos->iov_len;
+                pos++;
+                iovcnt--;
+            }
+            if (iovcnt > 0) {
+                pos->iov_base = (char *) pos->iov_base + num_written;
+                pos->iov_len -= num_written;
+            }
+        }
+        next += content_len;
+        len -= content_len;
+    } while (len > 0);
+    return 0;
+}
+
+static ssize_t send_stdin(void * ctx, const char * data, size_t len) {
+    fastcgi_relay * relay = ctx;
+    if (len == 0)
+        return 0;
+    if (write_records(relay, FASTCGI_STDIN, data, len) == -1) {
+        relay->backend_failed = 1;
+        return -1;
+    }
+    return len;
+}
+
+static int stash_record(fastcgi_relay * relay) {
+    uint8_t header[FASTCGI_HEADER_LEN];
+    uint8_t padding[FASTCGI_MAX_PADDING];
+    if (read_full(relay->fd, header, FASTCGI_HEADER_LEN) == -1 || header[0] != FASTCGI_VERSION)
+        return -1;
+    size_t content_len = (size_t) header[4] << 8 | header[5];
+
+    size_t need = relay->early_len + FASTCGI_HEADER_LEN + content_len;
+    if (need > relay->early_capacity) {
+        size_t capacity = relay->early_capacity * 2 > need ? relay->early_capacity * 2 : need;
+        uint8_t * early = realloc(relay->early, capacity);
+        if (early == NULL)
+            return -1;
+        relay->early = early;
+        relay->early_capacity = capacity;
+    }
+    // Padding is dropped, so the kept record has none
+    uint8_t * record = relay->early + relay->early_len;
+    memcpy(record, header, FASTCGI_HEADER_LEN);
+    record[6] = 0;
+    if (read_full(relay->fd, record + FASTCGI_HEADER_LEN, content_len) == -1
+            || read_full(relay->fd, padding, header[6]) == -1)
+        return -1;
+    relay->early_len = need;
+
+    if (header[1] == FASTCGI_END_REQUEST && (header[2] << 8 | header[3]) == REQUEST_ID)
+        relay->answered_early = 1;
+    return 0;
+}
+
+static int read_record(fastcgi_relay * relay, uint8_t ** content, size_t * len) {
+    for (;;) {
+        uint8_t * header;
+        size_t content_len;
+        if (relay->early_pos < relay->early_len) {
+            header = relay->early + relay->early_pos;
+            content_len = (size_t) header[4] << 8 | header[5];
+            relay->early_pos += FASTCGI_HEADER_LEN + content_len;
+        } else {
+            header = relay->record;
+            if (read_full(relay->fd, header, FASTCGI_HEADER_LEN) == -1 || header[0] != FASTCGI_VERSION)
+                return -1;
+            content_len = (size_t) header[4] << 8 | header[5];
+            if (read_full(relay->fd, header + FASTCGI_HEADER_LEN, content_len + header[6]) == -1)
+                return -1;
+        }
+        // Management records carry id 0 and are of no interest here
+        if ((header[2] << 8 | header[3]) != REQUEST_ID)
+            continue;
+        *content = header + FASTCGI_HEADER_LEN;
+        *len = content_len;
+        return header[1];
+    }
+}
+
+static int read_full(int fd, void * buf, size_t len) {
+    char * pos = buf;
+    while (len > 0) {
+        ssize_t num_read = read(fd, pos, len);
+        if (num_read < 0 && errno == EINTR)
+            continue;
+        if (num_read <= 0)
+            return -1;
+        pos += num_read;
+        len -= num_read;
+    }
+    return 0;
+}
+
+static void read_response_header(fastcgi_relay * relay, http_response * response) {
+    for (;;) {
+        uint8_t * content;
+        size_t len;
+        int type = read_record(relay, &content, &len);
+        if (type == FASTCGI_STDERR) {
+            fwrite(content, 1, len, stderr);
+            continue;
+        }
+        if (type != FASTCGI_STDOUT || len == 0) {
+            // The backend failed or ended without finishing the header
+            relay->status = HTTP_BAD_GATEWAY;
+            return;
+        }
+        if (relay->header_len + len > sizeof(relay->header) - 1) {
+            relay->status = HTTP_BAD_GATEWAY;
+            return;
+        }
+
+        // The blank line may straddle two records, so the search starts a
+        // few bytes back
+        size_t from = relay->header_len > 3 ? relay->header_len - 3 : 0;
+        memcpy(relay->header + relay->header_len, content, len);
+        relay->header_len += len;
+        relay->header[relay->header_len] = '\0';
+        for (size_t i = from; i < relay->header_len; i++) {
+            if (relay->header[i] != '\n')
+                continue;
+            size_t next = i + 1;
+            if (next < relay->header_len && relay->header[next] == '\r') next++;
+            if (next < relay->header_len && relay->header[next] == '\n') {
+                relay->pending = relay->header + next + 1;
+                relay->pending_len = relay->header_len - next - 1;
+                parse_response_header(relay, response, i);
+                return;
+            }
+        }
+    }
+}
+
+static void parse_response_header(fastcgi_relay * relay, http_response * response, size_t end) {
+    relay->header[end] = '\0';
+    int has_status = 0;
+    char * save;
+    for (char * line = strtok_r(relay->header, "\r\n", &save); line != NULL; line = strtok_r(NULL, "\r\n", &save)) {
+        char * colon = strchr(line, ':');
+        if (colon == NULL)
+            continue;
+        *colon = '\0';
+        char * value = colon + 1;
+        while (*value == ' ' || *value == '\t') value++;
+
+        if (strcasecmp(line, "Status") == 0) {
+            // Three digits, then the reason phrase the client is given
+            if (!isdigit((unsigned char) value[0]) || !isdigit((unsigned char) value[1])
+                    || !isdigit((unsigned char) value[2]) || (value[3] != '\0' && value[3] != ' ')) {
+                relay->status = HTTP_BAD_GATEWAY;
+                return;
+            }
+            response->response_code = atoi(value);
+            char * reason = value + 3;
+            while (*reason == ' ') reason++;
+            response->reason = *reason != '\0' ? reason : NULL;
+            has_status = 1;
+        } else if (strcasecmp(line, "Location") == 0 && !has_status) {
+            response->response_code = HTTP_FOUND;
+            sm_put(response->header_fields, line, value);
+        } else if (strcasecmp(line, "Connection") != 0 && strcasecmp(line, "Transfer-Encoding") != 0) {
+            sm_put(response->header_fields, line, value);
+        }
+    }
+    if (response->response_code < 100 || response->response_code > 999)
+        relay->status = HTTP_BAD_GATEWAY;
+}
+
+static int relay_body(fastcgi_relay * relay, http_body_sink sink) {
+    if (relay->pending_len > 0 && sink(relay, relay->pending, relay->pending_len) < 0)
+        return -1;
+    relay->pending_len = 0;
+
+    for (;;) {
+        uint8_t * content;
+        size_t len;
+        int type = read_record(relay, &content, &len);
+        if (type == FASTCGI_STDOUT) {
+            if (len > 0 && sink(relay, (const char *) content, len) < 0)
+                return -1;
+        } else if (type == FASTCGI_STDERR) {
+            fwrite(content, 1, len, stderr);
+        } else if (type == FASTCGI_END_REQUEST && len >= 8) {
+            relay->ended = 1;
+            relay->reusable = content[4] == FASTCGI_REQUEST_COMPLETE;
+            return 0;
+        } else {
+            return -1;
+        }
+    }
+}
+
+static ssize_t write_client(void * ctx, const char * data, size_t len) {
+    fastcgi_relay * relay = ctx;
+    // A HEAD response still drains the body so the connection can be reused
+    if (relay->writer == NULL)
+        return len;
+    return http_chunked_write(relay->writer, data, len);
+}
+
+static ssize_t collect_body(void * ctx, const char * data, size_t len) {
+    fastcgi_relay * relay = ctx;
+    http_response * response = relay->response;
+    char * body = realloc(response->body, response->body_len + len);
+    if (body == NULL)
+        return -1;
+    memcpy(body + response->body_len, data, len);
+    response->body = body;
+    response->body_len += len;
+    return len;
+}
+
+static void register_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void fork_prepare(void) {
+    pthread_mutex_lock(&pool_lock);
+}
+
+static void fork_parent(void) {
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static void fork_child(void) {
+    // The parent keeps using its connections, so the child must not
+    while (idle_count > 0) close(idle[--idle_count]);
+    pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,38 @@
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include "router.h"
+
+#define FASTCGI_VERSION 1
+#define FASTCGI_BEGIN_REQUEST 1
+#define FASTCGI_END_REQUEST 3
+#define FASTCGI_PARAMS 4
+#define FASTCGI_STDIN 5
+#define FASTCGI_STDOUT 6
+#define FASTCGI_STDERR 7
+#define FASTCGI_RESPONDER 1
+#define FASTCGI_KEEP_CONN 1
+#define FASTCGI_REQUEST_COMPLETE 0
+
+#define FASTCGI_HEADER_LEN 8
+#define FASTCGI_MAX_CONTENT 65535
+#define FASTCGI_MAX_PADDING 255
+#define FASTCGI_PARAMS_LEN 16384
+#define FASTCGI_MAX_RESPONSE_HEADER 8192
+#define FASTCGI_MAX_BUFFERED (8 * 1024 * 1024)
+#define FASTCGI_POOL_SIZE 32
+#define FASTCGI_TIMEOUT_MS 30000
+
+/**
+ * Routes every request for a path under prefix to the FastCGI backend
+ * listening on the UNIX socket named by the fastcgi_socket setting. Requests
+ * are spread over a pool of persistent backend connections kept by each
+ * worker process, with up to FASTCGI_POOL_SIZE of them idle between requests,
+ * so a request costs neither a connect nor a fork. Request bodies are
+ * streamed to the backend, and HTTP/1 response bodies are streamed back to
+ * the client as they arrive. HTTP/2 responses are collected first. Returns
+ * -1 if prefix is not a valid route.
+ */
+int fastcgi_add_routes(router * routes, const char * prefix);
+
+#endif
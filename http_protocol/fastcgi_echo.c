@@ -0,0 +1,221 @@
+#include "fastcgi.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * A FastCGI responder to try the server's FastCGI client against without a
+ * real backend. It listens on the UNIX socket named on the command line and
+ * answers every request with a text/plain body listing the parameters it was
+ * given, a blank line and the request body, sent back as it arrives. A
+ * request header X-Echo-Status is sent back as the Status of the response.
+ * Each connection is served by its own thread and kept open when the server
+ * asks for FASTCGI_KEEP_CONN. Every accept is logged to stderr so connection
+ * reuse can be watched.
+ */
+
+#define STATUS_PARAM "HTTP_X_ECHO_STATUS"
+
+typedef struct {
+    int fd;
+    int keep_conn;
+    uint16_t request_id;
+    size_t params_len;
+    uint8_t params[FASTCGI_PARAMS_LEN];
+    uint8_t record[FASTCGI_HEADER_LEN + FASTCGI_MAX_CONTENT + FASTCGI_MAX_PADDING];
+} connection;
+
+static void * serve_connection(void * arg);
+static int serve_request(connection * conn);
+static int read_full(int fd, void * buf, size_t len);
+static int write_record(connection * conn, uint8_t type, const void * data, size_t len);
+static int write_params(connection * conn);
+static size_t read_length(const uint8_t ** pos);
+
+int main(int argc, char * argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <socket path>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un addr = { 0 };
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s - socket path too long\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[1]);
+
+    signal(SIGPIPE, SIG_IGN);
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(argv[1]);
+    if (sfd == -1 || bind(sfd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(sfd, 64) == -1) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long accepted = 0;
+    for (;;) {
+        int fd = accept(sfd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "connection %lu\n", ++accepted);
+
+        connection * conn = malloc(sizeof(connection));
+        pthread_t thread;
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        if (pthread_create(&thread, NULL, serve_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+static void * serve_connection(void * arg) {
+    connection * conn = arg;
+    do {
+        conn->keep_conn = 0;
+        conn->params_len = 0;
+    } while (serve_request(conn) == 0 && conn->keep_conn);
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+// Returns 0 once a request was answered and -1 if the connection is done
+static int serve_request(connection * conn) {
+    int params_done = 0;
+    int responding = 0;
+    for (;;) {
+        uint8_t * header = conn->record;
+        if (read_full(conn->fd, header, FASTCGI_HEADER_LEN) == -1 || header[0] != FASTCGI_VERSION)
+            return -1;
+        size_t len = (size_t) header[4] << 8 | header[5];
+        if (read_full(conn->fd, header + FASTCGI_HEADER_LEN, len + header[6]) == -1)
+            return -1;
+        uint8_t * content = header + FASTCGI_HEADER_LEN;
+
+        switch (header[1]) {
+            case FASTCGI_BEGIN_REQUEST:
+                conn->request_id = (uint16_t) (header[2] << 8 | header[3]);
+                conn->keep_conn = len >= 3 && (content[2] & FASTCGI_KEEP_CONN);
+                break;
+            case FASTCGI_PARAMS:
+                if (len == 0) {
+                    params_done = 1;
+                } else if (conn->params_len + len <= sizeof(conn->params)) {
+                    memcpy(conn->params + conn->params_len, content, len);
+                    conn->params_len += len;
+                }
+                break;
+            case FASTCGI_STDIN:
+                if (!params_done)
+                    return -1;
+                if (!responding) {
+                    if (write_params(conn) == -1)
+                        return -1;
+                    responding = 1;
+                }
+                if (len == 0) {
+                    uint8_t end[8] = { 0, 0, 0, 0, FASTCGI_REQUEST_COMPLETE, 0, 0, 0 };
+                    if (write_record(conn, FASTCGI_STDOUT, NULL, 0) == -1
+                            || write_record(conn, FASTCGI_END_REQUEST, end, sizeof(end)) == -1)
+                        return -1;
+                    return 0;
+                }
+                memmove(conn->record, content, len);
+                if (write_record(conn, FASTCGI_STDOUT, conn->record, len) == -1)
+                    return -1;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+static int read_full(int fd, void * buf, size_t len) {
+    char * pos = buf;
+    while (len > 0) {
+        ssize_t num_read = read(fd, pos, len);
+        if (num_read < 0 && errno == EINTR)
+            continue;
+        if (num_read <= 0)
+            return -1;
+        pos += num_read;
+        len -= num_read;
+    }
+    return 0;
+}
+
+static int write_record(connection * conn, uint8_t type, const void * data, size_t len) {
+    uint8_t header[FASTCGI_HEADER_LEN] = {
+        FASTCGI_VERSION, type, (uint8_t) (conn->request_id >> 8), (uint8_t) conn->request_id,
+        (uint8_t) (len >> 8), (uint8_t) len, 0, 0
+    };
+    if (write(conn->fd, header, sizeof(header)) != (ssize_t) sizeof(header))
+        return -1;
+    return len == 0 || write(conn->fd, data, len) == (ssize_t) len ? 0 : -1;
+}
+
+// Sends the CGI header and one line per parameter, each as its own record
+static int write_params(connection * conn) {
+    char header[FASTCGI_PARAMS_LEN + 64] = "Content-Type: text/plain\r\n";
+    const uint8_t * pos = conn->params;
+    const uint8_t * end = conn->params + conn->params_len;
+    while (pos < end) {
+        size_t name_len = read_length(&pos);
+        size_t value_len = read_length(&pos);
+        if (pos + name_len + value_len > end)
+            return -1;
+        if (name_len == strlen(STATUS_PARAM) && memcmp(pos, STATUS_PARAM, name_len) == 0)
+            sprintf(header + strlen(header), "Status: %.*s\r\n", (int) value_len, (const char *) pos + name_len);
+        pos += name_len + value_len;
+    }
+    strcat(header, "\r\n");
+    if (write_record(conn, FASTCGI_STDOUT, header, strlen(header)) == -1)
+        return -1;
+
+    pos = conn->params;
+    char line[FASTCGI_PARAMS_LEN];
+    while (pos < end) {
+        size_t name_len = read_length(&pos);
+        size_t value_len = read_length(&pos);
+        if (pos + name_len + value_len > end || name_len + value_len + 2 > sizeof(line))
+            return -1;
+        memcpy(line, pos, name_len);
+        line[name_len] = '=';
+        memcpy(line + name_len + 1, pos + name_len, value_len);
+        line[name_len + value_len + 1] = '\n';
+        if (write_record(conn, FASTCGI_STDOUT, line, name_len + value_len + 2) == -1)
+            return -1;
+        pos += name_len + value_len;
+    }
+    return write_record(conn, FASTCGI_STDOUT, "\n", 1);
+}
+
+static size_t read_length(const uint8_t ** pos) {
+    const uint8_t * p = *pos;
+    if (!(p[0] & 0x80)) {
+        *pos += 1;
+        return p[0];
+    }
+    *pos += 4;
+    return (size_t) (p[0] & 0x7f) << 24 | (size_t) p[1] << 16 | (size_t) p[2] << 8 | p[3];
+}
@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include "file_cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)
+#define WATCH_EVENT_BUFFER 4096
+
+// A path that failed to open with ENOENT or ENOTDIR
+typedef struct negative_entry {
+    char * path;
+    long long cached_at;
+    struct negative_entry * hash_next;
+    struct negative_entry * prev;
+    struct negative_entry * next;
+} negative_entry;
+
+typedef struct {
+    int wd;
+    char * path;
+} watched_dir;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static file_cache_entry * buckets[FILE_CACHE_BUCKETS];
+static file_cache_entry * lru_head;
+static file_cache_entry * lru_tail;
+static size_t entry_count;
+
+// Misses are kept oldest first, which is also the order they expire in
+static negative_entry * negative_buckets[FILE_CACHE_BUCKETS];
+static negative_entry * negative_oldest;
+static negative_entry * negative_newest;
+static size_t negative_count;
+static unsigned long negative_generation;
+
+static pthread_once_t watch_once = PTHREAD_ONCE_INIT;
+static int inotify_fd = -1;
+static char * watch_root;
+static int watch_complete;
+static watched_dir * watched_dirs;
+static size_t watched_count;
+static size_t watched_capacity;
+
+static file_cache_entry * open_entry(const char * path);
+static file_cache_entry * find_entry(const char * path, size_t bucket);
+static void insert_entry(file_cache_entry * entry, size_t bucket);
+static void remove_entry(file_cache_entry * entry);
+static void lru_unlink(file_cache_entry * entry);
+static void lru_push_front(file_cache_entry * entry);
+static void unref_entry(file_cache_entry * entry);
+static negative_entry * find_negative(const char * path, size_t bucket);
+static void insert_negative(const char * path, size_t bucket);
+static void remove_negative(negative_entry * entry);
+static void flush_negatives(void);
+static int is_watched(const char * path);
+static int start_watcher(void);
+static void * watch_events(void * arg);
+static void watch_tree(const char * dir);
+static int watch_tree_cb(const char * path, const struct stat * st, int type, struct FTW * ftw);
+static const char * watched_path(int wd);
+static void unwatch_all(void);
+static void register_fork_handlers(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+static size_t hash_path(const char * path);
+static long long now_seconds(void);
+
+file_cache_entry * file_cache_open(const char * path) {
+    size_t bucket = hash_path(path);
+
+    pthread_mutex_lock(&lock);
+    file_cache_entry * entry = find_entry(path, bucket);
+    if (entry != NULL && now_seconds() - entry->opened_at < FILE_CACHE_TTL) {
+        entry->refs++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+        pthread_mutex_unlock(&lock);
+        return entry;
+    }
+    // Expired entries are reopened rather than revalidated, which also picks
+    // up files that were replaced by rename
+    if (entry != NULL) remove_entry(entry);
+
+    negative_entry * miss = find_negative(path, bucket);
+    if (miss != NULL) {
+        if (now_seconds() - miss->cached_at < FILE_CACHE_NEGATIVE_TTL) {
+            pthread_mutex_unlock(&lock);
+            errno = ENOENT;
+            return NULL;
+        }
+        remove_negative(miss);
+    }
+    unsigned long generation = negative_generation;
+    pthread_mutex_unlock(&lock);
+
+    entry = open_entry(path);
+    if (entry == NULL) {
+        int saved_errno = errno;
+        if (saved_errno == ENOENT || saved_errno == ENOTDIR) {
+            pthread_mutex_lock(&lock);
+            // A create event that arrived while open ran may be for this
+            // very path, so the miss is only kept if none did
+            if (generation == negative_generation && is_watched(path) && find_negative(path, bucket) == NULL) {
+                insert_negative(path, bucket);
+            }
+            pthread_mutex_unlock(&lock);
+        }
+        errno = saved_errno;
+        return NULL;
+    }
+    if (!entry->cached) return entry;
+
+    pthread_mutex_lock(&lock);
+    file_cache_entry * raced = find_entry(path, bucket);
+    if (raced != NULL) {
+        // Another thread opened the same file meanwhile, keep theirs
+        raced->refs++;
+        pthread_mutex_unlock(&lock);
+        entry->cached = 0;
+        file_cache_release(entry);
+        return raced;
+    }
+    insert_entry(entry, bucket);
+    while (entry_count > FILE_CACHE_MAX_ENTRIES) remove_entry(lru_tail);
+    pthread_mutex_unlock(&lock);
+    return entry;
+}
+
+void file_cache_release(file_cache_entry * entry) {
+    if (entry == NULL) return;
+    if (!entry->cached) {
+        unref_entry(entry);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    unref_entry(entry);
+    pthread_mutex_unlock(&lock);
+}
+
+void file_cache_invalidate(const char * path) {
+    pthread_mutex_lock(&lock);
+    file_cache_entry * entry = find_entry(path, hash_path(path));
+    if (entry != NULL) remove_entry(entry);
+    negative_entry * miss = find_negative(path, hash_path(path));
+    if (miss != NULL) remove_negative(miss);
+    pthread_mutex_unlock(&lock);
+}
+
+void file_cache_watch(const char * root) {
+    pthread_once(&watch_once, register_fork_handlers);
+
+    pthread_mutex_lock(&lock);
+    if (watch_root != NULL && strcmp(watch_root, root) == 0) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    unwatch_all();
+    flush_negatives();
+    free(watch_root);
+    watch_root = strdup(root);
+    watch_complete = inotify_fd != -1 || start_watcher() == 0;
+    if (watch_complete) watch_tree(root);
+    pthread_mutex_unlock(&lock);
+}
+
+static file_cache_entry * open_entry(const char * path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    file_cache_entry * entry = calloc(1, sizeof(file_cache_entry));
+    if (fstat(fd, &entry->st) == -1) {
+        close(fd);
+        free(entry);
+        return NULL;
+    }
+    entry->path = strdup(path);
+    entry->fd = fd;
+    entry->opened_at = now_seconds();
+    entry->refs = 1;
+    // Reading a pipe or device consumes it, so those can't be shared
+    entry->cached = S_ISREG(entry->st.st_mode);
+    return entry;
+}
+
+static file_cache_entry * find_entry(const char * path, size_t bucket) {
+    for (file_cache_entry * entry = buckets[bucket]; entry != NULL; entry = entry->hash_next) {
+        if (strcmp(entry->path, path) == 0) return entry;
+    }
+    return NULL;
+}
+
+// The cache holds its own reference while the entry is in the table
+static void insert_entry(file_cache_entry * entry, size_t bucket) {
+    entry->refs++;
+    entry->hash_next = buckets[bucket];
+    buckets[bucket] = entry;
+    lru_push_front(entry);
+    entry_count++;
+}
+
+static void remove_entry(file_cache_entry * entry) {
+    file_cache_entry ** link = &buckets[hash_path(entry->path)];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    lru_unlink(entry);
+    entry_count--;
+    unref_entry(entry);
+}
+
+static void lru_unlink(file_cache_entry * entry) {
+    if (entry->lru_prev != NULL) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next != NULL) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(file_cache_entry * entry) {
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (lru_tail == NULL) lru_tail = entry;
+}
+
+static void unref_entry(file_cache_entry * entry) {
+    if (--entry->refs > 0) return;
+    close(entry->fd);
+    free(entry->path);
+    free(entry);
+}
+
+static negative_entry * find_negative(const char * path, size_t bucket) {
+    for (negative_entry * entry = negative_buckets[bucket]; entry != NULL; entry = entry->hash_next) {
+        if (strcmp(entry->path, path) == 0) return entry;
+    }
+    return NULL;
+}
+
+static void insert_negative(const char * path, size_t bucket) {
+    if (negative_count >= FILE_CACHE_NEGATIVE_ENTRIES) remove_negative(negative_oldest);
+
+    negative_entry * entry = calloc(1, sizeof(negative_entry));
+    entry->path = strdup(path);
+    entry->cached_at = now_seconds();
+    entry->hash_next = negative_buckets[bucket];
+    negative_buckets[bucket] = entry;
+    entry->prev = negative_newest;
+    if (negative_newest != NULL) negative_newest->next = entry;
+    else negative_oldest = entry;
+    negative_newest = entry;
+    negative_count++;
+}
+
+static void remove_negative(negative_entry * entry) {
+    negative_entry ** link = &negative_buckets[hash_path(entry->path)];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    if (entry->prev != NULL) entry->prev->next = entry->next;
+    else negative_oldest = entry->next;
+    if (entry->next != NULL) entry->next->prev = entry->prev;
+    else negative_newest = entry->prev;
+    negative_count--;
+    free(entry->path);
+    free(entry);
+}
+
+static void flush_negatives(void) {
+    while (negative_oldest != NULL) remove_negative(negative_oldest);
+    negative_generation++;
+}
+
+// Misses outside the watched tree would never be invalidated
+static int is_watched(const char * path) {
+    if (!watch_complete || watch_root == NULL) return 0;
+    size_t root_len = strlen(watch_root);
+    if (strncmp(path, watch_root, root_len) != 0) return 0;
+    // A sibling such as /srv/www2 shares the prefix of /srv/www but is not
+    // under it
+    if (root_len > 0 && watch_root[root_len - 1] != '/' && path[root_len] != '/' && path[root_len] != '\0') return 0;
+    return strstr(path + root_len, "..") == NULL;
+}
+
+static int start_watcher(void) {
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1) return -1;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, watch_events, (void *) (long) inotify_fd) != 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    pthread_attr_destroy(&attr);
+    return inotify_fd == -1 ? -1 : 0;
+}
+
+static void * watch_events(void * arg) {
+    int fd = (int) (long) arg;
+    char buf[WATCH_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len == -1 && errno == EINTR) continue;
+        if (len <= 0) return NULL;
+
+        pthread_mutex_lock(&lock);
+        for (char * p = buf; p < buf + len; ) {
+            struct inotify_event * event = (struct inotify_event *) p;
+            const char * parent = watched_path(event->wd);
+            // New directories start out empty, but files may be created in
+            // them before the watch is in place, hence watching the subtree
+            if ((event->mask & IN_ISDIR) && event->len > 0 && parent != NULL) {
+                char * dir = malloc(strlen(parent) + strlen(event->name) + 2);
+                sprintf(dir, "%s/%s", parent, event->name);
+                watch_tree(dir);
+                free(dir);
+            }
+            // Lost events may have included new directories that are not
+            // watched yet, so misses stop being cached from here on
+            if (event->mask & IN_Q_OVERFLOW) watch_complete = 0;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        flush_negatives();
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+static void watch_tree(const char * dir) {
+    if (nftw(dir, watch_tree_cb, 16, FTW_PHYS) == -1) watch_complete = 0;
+}
+
+// Called with lock held, from watch_tree
+static int watch_tree_cb(const char * path, const struct stat * st, int type, struct FTW * ftw) {
+    (void) st;
+    (void) ftw;
+    if (type != FTW_D) return 0;
+
+    int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+    if (wd == -1) {
+        watch_complete = 0;
+        return 0;
+    }
+    if (watched_count == watched_capacity) {
+        watched_capacity = watched_capacity == 0 ? 64 : watched_capacity * 2;
+        watched_dirs = realloc(watched_dirs, watched_capacity * sizeof(watched_dir));
+    }
+    watched_dirs[watched_count].wd = wd;
+    watched_dirs[watched_count].path = strdup(path);
+    watched_count++;
+    return 0;
+}
+
+static const char * watched_path(int wd) {
+    for (size_t i = watched_count; i > 0; i--) {
+        if (watched_dirs[i - 1].wd == wd) return watched_dirs[i - 1].path;
+    }
+    return NULL;
+}
+
+static void unwatch_all(void) {
+    for (size_t i = 0; i < watched_count; i++) {
+        inotify_rm_watch(inotify_fd, watched_dirs[i].wd);
+        free(watched_dirs[i].path);
+    }
+    watched_count = 0;
+}
+
+static void register_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void fork_prepare(void) {
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_parent(void) {
+    pthread_mutex_unlock(&lock);
+}
+
+// The watcher thread doesn't survive fork, so the child starts over on its
+// first file_cache_watch
+static void fork_child(void) {
+    if (inotify_fd != -1) close(inotify_fd);
+    inotify_fd = -1;
+    for (size_t i = 0; i < watched_count; i++) free(watched_dirs[i].path);
+    watched_count = 0;
+    free(watch_root);
+    watch_root = NULL;
+    watch_complete = 0;
+    flush_negatives();
+    pthread_mutex_unlock(&lock);
+}
+
+static size_t hash_path(const char * path) {
+    size_t hash = 5381;
+    for (const char * c = path; *c != '\0'; c++) hash = hash * 33 + (unsigned char) *c;
+    return hash % FILE_CACHE_BUCKETS;
+}
+
+static long long now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
@@ -0,0 +1,63 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+
+#define FILE_CACHE_MAX_ENTRIES 256
+#define FILE_CACHE_BUCKETS 1024
+#define FILE_CACHE_TTL 10
+#define FILE_CACHE_NEGATIVE_ENTRIES 4096
+#define FILE_CACHE_NEGATIVE_TTL 5
+
+/**
+ * An open file and its fstat result. Entries for regular files are shared
+ * between every thread of the process, so fd must only be read with pread,
+ * sendfile with an explicit offset or mmap, never with read or lseek.
+ */
+typedef struct file_cache_entry {
+    char * path;
+    int fd;
+    struct stat st;
+    long long opened_at;
+    int refs;
+    int cached;
+    struct file_cache_entry * hash_next;
+    struct file_cache_entry * lru_prev;
+    struct file_cache_entry * lru_next;
+} file_cache_entry;
+
+/**
+ * Opens path read-only, reusing the fd and fstat result of an earlier open
+ * if it is younger than FILE_CACHE_TTL seconds. At most
+ * FILE_CACHE_MAX_ENTRIES regular files are kept open, least recently used
+ * first out. Pipes and devices are opened every time and never cached.
+ * Returns NULL if path cannot be opened. Paths under the watched root that
+ * do not exist are remembered for FILE_CACHE_NEGATIVE_TTL seconds, so asking
+ * for them again returns NULL without a system call. The entry must be
+ * handed back with file_cache_release.
+ */
+file_cache_entry * file_cache_open(const char * path);
+
+/**
+ * Releases an entry returned by file_cache_open. The fd is closed once the
+ * entry has also left the cache.
+ */
+void file_cache_release(file_cache_entry * entry);
+
+/**
+ * Drops path from the cache so the next open sees the file as it is now,
+ * e.g. after it was replaced by an upload.
+ */
+void file_cache_invalidate(const char * path);
+
+/**
+ * Watches every directory below root with inotify and enables the negative
+ * cache for it. Any file or directory created under root forgets all
+ * remembered misses. Calling it again with the same root is cheap; a new
+ * root replaces the old watches. Each process, including forked workers,
+ * sets up its own watcher on its first call. If root can't be watched
+ * completely, misses are not cached.
+ */
+void file_cache_watch(const char * root);
+
+#endif
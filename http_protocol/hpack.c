@@ -0,0 +1,420 @@
+#include "hpack.h"
+#include "hpack_huffman.h"
+#include "buffer_pool.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define STATIC_ENTRY(name, value) {name, sizeof(name) - 1, value, sizeof(value) - 1}
+
+typedef struct {
+    const char * name;
+    size_t name_len;
+    const char * value;
+    size_t value_len;
+} static_entry;
+
+static const static_entry static_table[HPACK_STATIC_ENTRIES] = {
+    STATIC_ENTRY(":authority", ""),
+    STATIC_ENTRY(":method", "GET"),
+    STATIC_ENTRY(":method", "POST"),
+    STATIC_ENTRY(":path", "/"),
+    STATIC_ENTRY(":path", "/index.html"),
+    STATIC_ENTRY(":scheme", "http"),
+    STATIC_ENTRY(":scheme", "https"),
+    STATIC_ENTRY(":status", "200"),
+    STATIC_ENTRY(":status", "204"),
+    STATIC_ENTRY(":status", "206"),
+    STATIC_ENTRY(":status", "304"),
+    STATIC_ENTRY(":status", "400"),
+    STATIC_ENTRY(":status", "404"),
+    STATIC_ENTRY(":status", "500"),
+    STATIC_ENTRY("accept-charset", ""),
+    STATIC_ENTRY("accept-encoding", "gzip, deflate"),
+    STATIC_ENTRY("accept-language", ""),
+    STATIC_ENTRY("accept-ranges", ""),
+    STATIC_ENTRY("accept", ""),
+    STATIC_ENTRY("access-control-allow-origin", ""),
+    STATIC_ENTRY("age", ""),
+    STATIC_ENTRY("allow", ""),
+    STATIC_ENTRY("authorization", ""),
+    STATIC_ENTRY("cache-control", ""),
+    STATIC_ENTRY("content-disposition", ""),
+    STATIC_ENTRY("content-encoding", ""),
+    STATIC_ENTRY("content-language", ""),
+    STATIC_ENTRY("content-length", ""),
+    STATIC_ENTRY("content-location", ""),
+    STATIC_ENTRY("content-range", ""),
+    STATIC_ENTRY("content-type", ""),
+    STATIC_ENTRY("cookie", ""),
+    STATIC_ENTRY("date", ""),
+    STATIC_ENTRY("etag", ""),
+    STATIC_ENTRY("expect", ""),
+    STATIC_ENTRY("expires", ""),
+    STATIC_ENTRY("from", ""),
+    STATIC_ENTRY("host", ""),
+    STATIC_ENTRY("if-match", ""),
+    STATIC_ENTRY("if-modified-since", ""),
+    STATIC_ENTRY("if-none-match", ""),
+    STATIC_ENTRY("if-range", ""),
+    STATIC_ENTRY("if-unmodified-since", ""),
+    STATIC_ENTRY("last-modified", ""),
+    STATIC_ENTRY("link", ""),
+    STATIC_ENTRY("location", ""),
+    STATIC_ENTRY("max-forwards", ""),
+    STATIC_ENTRY("proxy-authenticate", ""),
+    STATIC_ENTRY("proxy-authorization", ""),
+    STATIC_ENTRY("range", ""),
+    STATIC_ENTRY("referer", ""),
+    STATIC_ENTRY("refresh", ""),
+    STATIC_ENTRY("retry-after", ""),
+    STATIC_ENTRY("server", ""),
+    STATIC_ENTRY("set-cookie", ""),
+    STATIC_ENTRY("strict-transport-security", ""),
+    STATIC_ENTRY("transfer-encoding", ""),
+    STATIC_ENTRY("user-agent", ""),
+    STATIC_ENTRY("vary", ""),
+    STATIC_ENTRY("via", ""),
+    STATIC_ENTRY("www-authenticate", ""),
+};
+
+static int decode_block(hpack_decoder * decoder, const uint8_t * pos, const uint8_t * end, hpack_header_cb cb, void * ctx, char * name_buf, char * value_buf);
+static int decode_integer(const uint8_t ** pos, const uint8_t * end, int prefix_bits, size_t * value);
+static int decode_string(const uint8_t ** pos, const uint8_t * end, char * buf, size_t * len);
+static int huffman_decode(const uint8_t * in, size_t in_len, char * out, size_t * out_len);
+static int lookup_field(hpack_decoder * decoder, size_t index, hpack_field * field);
+static int table_insert(hpack_decoder * decoder, const hpack_field * field);
+static void table_evict(hpack_decoder * decoder, size_t max_size);
+static size_t encode_integer(uint8_t * out, size_t out_len, uint8_t first, int prefix_bits, size_t value);
+static size_t encode_string(uint8_t * out, size_t out_len, const char * str, size_t len, int lower);
+static size_t huffman_encoded_len(const char * str, size_t len, int lower);
+static size_t static_name_index(const char * name, size_t name_len);
+
+void hpack_decoder_init(hpack_decoder * decoder) {
+    // The dynamic table is allocated on the first insert, as many clients
+    // never use it
+    memset(decoder, 0, sizeof(hpack_decoder));
+    decoder->max_size = HPACK_DEFAULT_TABLE_SIZE;
+    decoder->settings_max_size = HPACK_DEFAULT_TABLE_SIZE;
+}
+
+void hpack_decoder_destroy(hpack_decoder * decoder) {
+    table_evict(decoder, 0);
+    free(decoder->entries);
+    decoder->entries = NULL;
+}
+
+int hpack_decode(hpack_decoder * decoder, const uint8_t * block, size_t len, hpack_header_cb cb, void * ctx) {
+    char * name_buf = buffer_pool_get(HPACK_MAX_STRING_LEN);
+    char * value_buf = buffer_pool_get(HPACK_MAX_STRING_LEN);
+    int result = -1;
+    if (name_buf != NULL && value_buf != NULL) {
+        result = decode_block(decoder, block, block + len, cb, ctx, name_buf, value_buf);
+    }
+    buffer_pool_put(name_buf, HPACK_MAX_STRING_LEN);
+    buffer_pool_put(value_buf, HPACK_MAX_STRING_LEN);
+    return result;
+}
+
+static int decode_block(hpack_decoder * decoder, const uint8_t * pos, const uint8_t * end, hpack_header_cb cb, void * ctx, char * name_buf, char * value_buf) {
+    while (pos < end) {
+        uint8_t first = *pos;
+        hpack_field field;
+        size_t index;
+
+        if (first & 0x80) {
+            // Indexed header field
+            if (decode_integer(&pos, end, 7, &index) == -1) return -1;
+            if (lookup_field(decoder, index, &field) == -1) return -1;
+            if (cb(ctx, &field) == -1) return -1;
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20) {
+            // Dynamic table size update
+            size_t max_size;
+            if (decode_integer(&pos, end, 5, &max_size) == -1) return -1;
+            if (max_size > decoder->settings_max_size) return -1;
+            decoder->max_size = max_size;
+            table_evict(decoder, max_size);
+            continue;
+        }
+
+        int indexing = (first & 0xc0) == 0x40;
+        if (decode_integer(&pos, end, indexing ? 6 : 4, &index) == -1) return -1;
+
+        if (index == 0) {
+            size_t name_len;
+            if (decode_string(&pos, end, name_buf, &name_len) == -1) return -1;
+            field.name = name_buf;
+            field.name_len = name_len;
+        } else if (lookup_field(decoder, index, &field) == -1) {
+            return -1;
+        }
+
+        size_t value_len;
+        if (decode_string(&pos, end, value_buf, &value_len) == -1) return -1;
+        field.value = value_buf;
+        field.value_len = value_len;
+
+        if (cb(ctx, &field) == -1) return -1;
+        if (indexing && table_insert(decoder, &field) == -1) return -1;
+    }
+    return 0;
+}
+
+size_t hpack_encode_status(uint8_t * out, size_t out_len, int status) {
+    size_t index;
+    switch (status) {
+        case 200: index = 8; break;
+        case 204: index = 9; break;
+        case 206: index = 10; break;
+        case 304: index = 11; break;
+        case 400: index = 12; break;
+        case 404: index = 13; break;
+        case 500: index = 14; break;
+        default: index = 0; break;
+    }
+    if (index != 0) return encode_integer(out, out_len, 0x80, 7, index);
+
+    char value[4];
+    snprintf(value, sizeof(value), "%d", status);
+    return hpack_encode_field(out, out_len, ":status", value);
+}
+
+size_t hpack_encode_field(uint8_t * out, size_t out_len, const char * name, const char * value) {
+    size_t name_len = strlen(name);
+    size_t name_index = static_name_index(name, name_len);
+
+    // Literal header field never indexed, 4-bit name index prefix
+    size_t len = encode_integer(out, out_len, 0x10, 4, name_index);
+    if (len == 0) return 0;
+
+    if (name_index == 0) {
+        size_t n = encode_string(out + len, out_len - len, name, name_len, 1);
+        if (n == 0) return 0;
+        len += n;
+    }
+
+    size_t n = encode_string(out + len, out_len - len, value, strlen(value), 0);
+    if (n == 0) return 0;
+    return len + n;
+}
+
+static size_t static_name_index(const char * name, size_t name_len) {
+    for (size_t i = 0; i < HPACK_STATIC_ENTRIES; i++) {
+        if (static_table[i].name_len == name_len && strncasecmp(static_table[i].name, name, name_len) == 0) return i + 1;
+    }
+    return 0;
+}
+
+// Walks the generated state machine a nibble at a time
+static int huffman_decode(const uint8_t * in, size_t in_len, char * out, size_t * out_len) {
+    uint8_t state = 0;
+    uint8_t flags = HUFFMAN_FLAG_ACCEPT;
+    size_t len = 0;
+
+    for (size_t i = 0; i < in_len; i++) {
+        uint8_t nibbles[2] = { in[i] >> 4, in[i] & 0xf };
+        for (int j = 0; j < 2; j++) {
+            flags = huffman_decode_table[state][nibbles[j]].flags;
+            if (flags & HUFFMAN_FLAG_FAIL) return -1;
+            if (flags & HUFFMAN_FLAG_SYMBOL) {
+                if (len == HPACK_MAX_STRING_LEN) return -1;
+                out[len++] = (char) huffman_decode_table[state][nibbles[j]].symbol;
+            }
+            state = huffman_decode_table[state][nibbles[j]].state;
+        }
+    }
+
+    // Padding must be a prefix of EOS, i.e. all ones and shorter than a byte
+    if (!(flags & HUFFMAN_FLAG_ACCEPT)) return -1;
+    *out_len = len;
+    return 0;
+}
+
+static int decode_integer(const uint8_t ** pos, const uint8_t * end, int prefix_bits, size_t * value) {
+    const uint8_t * p = *pos;
+    if (p >= end) return -1;
+
+    size_t max_prefix = (1u << prefix_bits) - 1;
+    size_t result = *p++ & max_prefix;
+
+    if (result == max_prefix) {
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (p >= end || shift > 28) return -1;
+            b = *p++;
+            result += (size_t) (b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+    }
+
+    *pos = p;
+    *value = result;
+    return 0;
+}
+
+static int decode_string(const uint8_t ** pos, const uint8_t * end, char * buf, size_t * len) {
+    if (*pos >= end) return -1;
+    int huffman = **pos & 0x80;
+
+    size_t str_len;
+    if (decode_integer(pos, end, 7, &str_len) == -1) return -1;
+    if (str_len > (size_t) (end - *pos)) return -1;
+
+    if (huffman) {
+        if (huffman_decode(*pos, str_len, buf, len) == -1) return -1;
+    } else {
+        if (str_len > HPACK_MAX_STRING_LEN) return -1;
+        memcpy(buf, *pos, str_len);
+        *len = str_len;
+    }
+
+    *pos += str_len;
+    return 0;
+}
+
+static int lookup_field(hpack_decoder * decoder, size_t index, hpack_field * field) {
+    if (index == 0) return -1;
+
+    if (index <= HPACK_STATIC_ENTRIES) {
+        field->name = static_table[index - 1].name;
+        field->name_len = static_table[index - 1].name_len;
+        field->value = static_table[index - 1].value;
+        field->value_len = static_table[index - 1].value_len;
+        return 0;
+    }
+
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= decoder->count) return -1;
+
+    hpack_entry * entry = &decoder->entries[(decoder->head + index) % decoder->capacity];
+    field->name = entry->name;
+    field->name_len = entry->name_len;
+    field->value = entry->value;
+    field->value_len = entry->value_len;
+    return 0;
+}
+
+static int table_insert(hpack_decoder * decoder, const hpack_field * field) {
+    size_t entry_size = field->name_len + field->value_len + HPACK_ENTRY_OVERHEAD;
+    if (entry_size > decoder->max_size) {
+        table_evict(decoder, 0);
+        return 0;
+    }
+
+    // The field may point into an entry that is about to be evicted, so copy
+    // first
+    char * storage = malloc(field->name_len + field->value_len + 2);
+    if (storage == NULL) return -1;
+    memcpy(storage, field->name, field->name_len);
+    storage[field->name_len] = '\0';
+    memcpy(storage + field->name_len + 1, field->value, field->value_len);
+    storage[field->name_len + 1 + field->value_len] = '\0';
+    table_evict(decoder, decoder->max_size - entry_size);
+
+    if (decoder->count == decoder->capacity) {
+        size_t capacity = decoder->capacity == 0 ? HPACK_INITIAL_ENTRIES : decoder->capacity * 2;
+        hpack_entry * entries = calloc(capacity, sizeof(hpack_entry));
+        if (entries == NULL) {
+            free(storage);
+            return -1;
+        }
+        for (size_t i = 0; i < decoder->count; i++) {
+            entries[i] = decoder->entries[(decoder->head + i) % decoder->capacity];
+        }
+        free(decoder->entries);
+        decoder->entries = entries;
+        decoder->capacity = capacity;
+        decoder->head = 0;
+    }
+
+    decoder->head = (decoder->head + decoder->capacity - 1) % decoder->capacity;
+    hpack_entry * entry = &decoder->entries[decoder->head];
+    entry->name = storage;
+    entry->name_len = field->name_len;
+    entry->value = storage + field->name_len + 1;
+    entry->value_len = field->value_len;
+    decoder->count++;
+    decoder->size += entry_size;
+    return 0;
+}
+
+static void table_evict(hpack_decoder * decoder, size_t max_size) {
+    while (decoder->count > 0 && decoder->size > max_size) {
+        hpack_entry * oldest = &decoder->entries[(decoder->head + decoder->count - 1) % decoder->capacity];
+        decoder->size -= oldest->name_len + oldest->value_len + HPACK_ENTRY_OVERHEAD;
+        free(oldest->name);
+        memset(oldest, 0, sizeof(hpack_entry));
+        decoder->count--;
+    }
+}
+
+static size_t encode_integer(uint8_t * out, size_t out_len, uint8_t first, int prefix_bits, size_t value) {
+    size_t max_prefix = (1u << prefix_bits) - 1;
+    if (out_len == 0) return 0;
+
+    if (value < max_prefix) {
+        out[0] = first | value;
+        return 1;
+    }
+
+    out[0] = first | max_prefix;
+    value -= max_prefix;
+    size_t len = 1;
+    while (value >= 0x80) {
+        if (len == out_len) return 0;
+        out[len++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (len == out_len) return 0;
+    out[len++] = value;
+    return len;
+}
+
+// Uses Huffman coding only when it is shorter than the raw string
+static size_t encode_string(uint8_t * out, size_t out_len, const char * str, size_t len, int lower) {
+    size_t huffman_len = huffman_encoded_len(str, len, lower);
+    int huffman = huffman_len < len;
+
+    size_t pos = encode_integer(out, out_len, huffman ? 0x80 : 0x00, 7, huffman ? huffman_len : len);
+    if (pos == 0 || out_len - pos < (huffman ? huffman_len : len)) return 0;
+
+    if (!huffman) {
+        for (size_t i = 0; i < len; i++) {
+            out[pos++] = lower ? tolower((unsigned char) str[i]) : str[i];
+        }
+        return pos;
+    }
+
+    // Codes are at most 30 bits, so fewer than 38 bits are ever pending
+    uint64_t bits = 0;
+    int bit_count = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = lower ? tolower((unsigned char) str[i]) : (unsigned char) str[i];
+        bits = (bits << huffman_encode_table[c].len) | huffman_encode_table[c].code;
+        bit_count += huffman_encode_table[c].len;
+        while (bit_count >= 8) {
+            bit_count -= 8;
+            out[pos++] = bits >> bit_count;
+        }
+    }
+
+    // Pad the last byte with the most significant bits of EOS
+    if (bit_count > 0) out[pos++] = (bits << (8 - bit_count)) | (0xff >> bit_count);
+    return pos;
+}
+
+static size_t huffman_encoded_len(const char * str, size_t len, int lower) {
+    size_t bit_count = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = lower ? tolower((unsigned char) str[i]) : (unsigned char) str[i];
+        bit_count += huffman_encode_table[c].len;
+    }
+    return (bit_count + 7) / 8;
+}
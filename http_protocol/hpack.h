@@ -0,0 +1,89 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_DEFAULT_TABLE_SIZE 4096
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_MAX_STRING_LEN 8192
+#define HPACK_INITIAL_ENTRIES 8
+
+/**
+ * A header field as decoded from a header block. The strings are only valid
+ * for the duration of the hpack_header_cb they are passed to.
+ */
+typedef struct {
+    const char * name;
+    size_t name_len;
+    const char * value;
+    size_t value_len;
+} hpack_field;
+
+/**
+ * Receives each decoded header field in order. Returns 0 to continue or -1 to
+ * abort decoding.
+ */
+typedef int (*hpack_header_cb)(void * ctx, const hpack_field * field);
+
+/**
+ * An entry of the decoder's dynamic table. name and value share one
+ * allocation.
+ */
+typedef struct {
+    char * name;
+    size_t name_len;
+    char * value;
+    size_t value_len;
+} hpack_entry;
+
+/**
+ * Decoding state for one HTTP/2 connection. The dynamic table is a ring of
+ * entries, newest first, bounded by max_size as defined in RFC 7541. String
+ * literals are decoded into buffers from the buffer pool that are only held
+ * while a header block is being decoded.
+ */
+typedef struct {
+    hpack_entry * entries;
+    size_t capacity;
+    size_t count;
+    size_t head;
+    size_t size;
+    size_t max_size;
+    size_t settings_max_size;
+} hpack_decoder;
+
+/**
+ * Initializes decoder with the default 4096 byte dynamic table.
+ */
+void hpack_decoder_init(hpack_decoder * decoder);
+
+/**
+ * Frees the dynamic table held by decoder.
+ */
+void hpack_decoder_destroy(hpack_decoder * decoder);
+
+/**
+ * Decodes the header block of len bytes, calling cb for every field.
+ * Returns 0 on success or -1 on a compression error, after which the
+ * connection must be closed.
+ */
+int hpack_decode(hpack_decoder * decoder, const uint8_t * block, size_t len, hpack_header_cb cb, void * ctx);
+
+/**
+ * Encodes :status. Common codes are a single indexed byte from the static
+ * table. Returns the number of bytes written or 0 if out_len is too small.
+ */
+size_t hpack_encode_status(uint8_t * out, size_t out_len, int status);
+
+/**
+ * Encodes a header field as a literal that is never added to the peer's
+ * dynamic table, referencing the static table for the name when possible.
+ * name is lower-cased as required by HTTP/2, and strings are Huffman coded
+ * when that makes them shorter. Returns the number of bytes
+ * written or 0 if out_len is too small.
+ */
+size_t hpack_encode_field(uint8_t * out, size_t out_len, const char * name, const char * value);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Generates the Huffman tables used by hpack.c at build time. The encode
+ * table is RFC 7541 Appendix B as-is. The decode table is a state machine
+ * over the code tree that consumes four bits per step: each of the 256
+ * internal nodes has a transition for every nibble giving the node it lands
+ * on and the symbol completed on the way, if any. No code is shorter than
+ * five bits, so a nibble completes at most one symbol.
+ */
+
+#define HUFFMAN_SYMBOLS 257
+#define HUFFMAN_EOS 256
+#define HUFFMAN_STATES 256
+#define MAX_NODES (HUFFMAN_SYMBOLS * 2)
+
+#define FLAG_ACCEPT 0x1
+#define FLAG_SYMBOL 0x2
+#define FLAG_FAIL 0x4
+
+typedef struct {
+    int children[2];
+    int symbol;
+    int state;
+    int depth;
+    int all_ones;
+} node;
+
+// RFC 7541 Appendix B, indexed by symbol. Symbol 256 is EOS.
+static const uint32_t huffman_codes[HUFFMAN_SYMBOLS] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5,
+    0xfffffe6, 0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9,
+    0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee,
+    0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9,
+    0xffffffa, 0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa,
+    0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa, 0x3fb,
+    0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b,
+    0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb,
+    0x7ffc, 0x20, 0xffb, 0x3fc, 0x1ffa, 0x21,
+    0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+    0x6f, 0x70, 0x71, 0x72, 0xfc, 0x73,
+    0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5,
+    0x25, 0x26, 0x27, 0x6, 0x74, 0x75,
+    0x28, 0x29, 0x2a, 0x7, 0x2b, 0x76,
+    0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd,
+    0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+    0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda,
+    0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1,
+    0x7fffe2, 0x7fffe3, 0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5,
+    0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef, 0x3fffda, 0x1fffdd,
+    0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+    0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2,
+    0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2,
+    0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2,
+    0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde,
+    0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2, 0x1fffe3,
+    0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3,
+    0x7ffffe4, 0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6,
+    0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb,
+    0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8,
+    0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed,
+    0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee, 0x3fffffff,
+};
+
+static const uint8_t huffman_code_lens[HUFFMAN_SYMBOLS] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+static node nodes[MAX_NODES];
+static int node_count = 1;
+static int state_nodes[HUFFMAN_STATES];
+static int state_count = 1;
+
+static void build_tree(void);
+static int accepts(int n);
+static void print_encode_table(FILE * out);
+static void print_decode_table(FILE * out);
+
+int main(int argc, char * argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output header>\n", argv[0]);
+        return 1;
+    }
+
+    FILE * out = fopen(argv[1], "w");
+    if (out == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    build_tree();
+    fprintf(out, "/* Generated by hpack_gen.c. Do not edit. */\n\n");
+    fprintf(out, "#define HUFFMAN_FLAG_ACCEPT 0x%x\n", FLAG_ACCEPT);
+    fprintf(out, "#define HUFFMAN_FLAG_SYMBOL 0x%x\n", FLAG_SYMBOL);
+    fprintf(out, "#define HUFFMAN_FLAG_FAIL 0x%x\n\n", FLAG_FAIL);
+    print_encode_table(out);
+    print_decode_table(out);
+    return fclose(out) == 0 ? 0 : 1;
+}
+
+// Internal nodes are numbered as decoder states in the order they are created
+static void build_tree(void) {
+    nodes[0].symbol = -1;
+    nodes[0].all_ones = 1;
+    state_nodes[0] = 0;
+
+    for (int sym = 0; sym < HUFFMAN_SYMBOLS; sym++) {
+        int n = 0;
+        for (int bit = huffman_code_lens[sym] - 1; bit >= 0; bit--) {
+            int b = (huffman_codes[sym] >> bit) & 1;
+            if (nodes[n].children[b] == 0) {
+                int child = node_count++;
+                nodes[child].symbol = bit == 0 ? sym : -1;
+                nodes[child].depth = nodes[n].depth + 1;
+                nodes[child].all_ones = nodes[n].all_ones && b;
+                if (bit != 0) {
+                    nodes[child].state = state_count;
+                    state_nodes[state_count++] = child;
+                }
+                nodes[n].children[b] = child;
+            }
+            n = nodes[n].children[b];
+        }
+    }
+}
+
+// A string may end on the root or inside up to seven bits of EOS padding
+static int accepts(int n) {
+    return n == 0 || (nodes[n].all_ones && nodes[n].depth <= 7);
+}
+
+static void print_encode_table(FILE * out) {
+    fprintf(out, "static const struct {\n    uint32_t code;\n    uint8_t len;\n} huffman_encode_table[%d] = {\n", HUFFMAN_SYMBOLS);
+    for (int sym = 0; sym < HUFFMAN_SYMBOLS; sym++) {
+        fprintf(out, "    {0x%x, %d},\n", huffman_codes[sym], huffman_code_lens[sym]);
+    }
+    fprintf(out, "};\n\n");
+}
+
+static void print_decode_table(FILE * out) {
+    fprintf(out, "static const struct {\n    uint8_t state;\n    uint8_t flags;\n    uint8_t symbol;\n} huffman_decode_table[%d][16] = {\n", HUFFMAN_STATES);
+    for (int state = 0; state < state_count; state++) {
+        fprintf(out, "    {\n");
+        for (int nibble = 0; nibble < 16; nibble++) {
+            int n = state_nodes[state];
+            int flags = 0;
+            int symbol = 0;
+
+            for (int bit = 3; bit >= 0 && !(flags & FLAG_FAIL); bit--) {
+                n = nodes[n].children[(nibble >> bit) & 1];
+                if (nodes[n].symbol == HUFFMAN_EOS) {
+                    flags = FLAG_FAIL;
+                } else if (nodes[n].symbol >= 0) {
+                    flags |= FLAG_SYMBOL;
+                    symbol = nodes[n].symbol;
+                    n = 0;
+                }
+            }
+            if (!(flags & FLAG_FAIL) && accepts(n)) flags |= FLAG_ACCEPT;
+
+            fprintf(out, "        {%d, 0x%x, %d},\n", (flags & FLAG_FAIL) ? 0 : nodes[n].state, flags, symbol);
+        }
+        fprintf(out, "    },\n");
+    }
+    fprintf(out, "};\n");
+}
@@ -1,10 +1,22 @@
+#define _GNU_SOURCE
 #include "http.h"
+#include "http_body.h"
+#include "http2.h"
+#include "io_pool.h"
+#include "modules.h"
+#include "rewrite.h"
+#include "router.h"
+#include "tls.h"
 
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -12,32 +24,89 @@
 #include <dc/stdlib.h>
 
 #define CRLF "\r\n"
-#define BODY_BUFFER 256
+#define CHUNK_BUFFER 4096
 
 static void parse_request_header(char * raw_header, http_request * request);
 static int parse_request_method(char * method);
 static char * substring(const char * string, size_t start, size_t end);
-static int parse_uri_to_filepath(config * conf, char * request_uri, char ** request_path);
+static int parse_uri_to_filepath(config * conf, char * request_uri, char ** request_path, file_cache_entry ** file);
+static int parse_uri_to_upload_path(config * conf, char * request_uri, char ** request_path);
+static void serve_file(config * conf, http_request * request, http_response * response, const router_match * match);
+static void serve_upload(config * conf, http_request * request, http_response * response, const router_match * match);
+static void parse_body_framing(http_request * request);
 static char * get_status_phrase(int status_code);
 static char * get_utc_time();
+static ssize_t writev_all(int fd, struct iovec * iov, int iovcnt);
+static int has_body(http_response * response);
+static int should_offload(http_response * response);
+static void offload_response(http_response * response, int cfd, int sliced);
+static void send_offloaded(void * arg);
+static int send_slice(http_response * response, int cfd, off_t * sent);
+static void finish_client(http_response * response, int cfd);
+
+typedef struct {
+    http_response * response;
+    int cfd;
+    int sliced;
+    off_t sent;
+} offloaded_response;
 
 void http_handle_client(config * conf, int cfd) {
+    if (tls_accept(cfd) == -1) {
+        close(cfd);
+        return;
+    }
+
+    if (tls_alpn_h2(cfd)) {
+        http2_serve(conf, cfd, NULL, 0, NULL);
+        finish_client(NULL, cfd);
+        return;
+    }
+
     char request_buf[MAX_REQUEST_LEN];
     memset(request_buf, 0, MAX_REQUEST_LEN); // You will regret removing this line
     
-    ssize_t num_read = read(cfd, request_buf, MAX_REQUEST_LEN);
+    ssize_t num_read = tls_read(cfd, request_buf, MAX_REQUEST_LEN - 1);
+    if (num_read < 0) num_read = 0;
+
+    if (http2_is_preface(request_buf, num_read)) {
+        http2_serve(conf, cfd, request_buf, num_read, NULL);
+        finish_client(NULL, cfd);
+        return;
+    }
 
     http_request * request = parse_request(request_buf, num_read);
-    http_response * response = build_response(conf, request);
-    send_response(response, cfd);
+    if (http2_is_upgrade(request)) {
+        http2_serve(conf, cfd, NULL, 0, request);
+        http_request_destroy(request);
+        finish_client(NULL, cfd);
+        return;
+    }
 
+    http_response * response = build_response(conf, request);
+    receive_request_body(conf, request, response, cfd);
     http_request_destroy(request);
-    http_response_destroy(response);
+
+    // A cached body that fits in one slice is already the shortest job, so
+    // it is sent right away
+    if (conf->srpt && has_body(response) && response->file != NULL && !response->is_chunked
+            && (response->file->st.st_size > HTTP_SLICE_SIZE || should_offload(response))) {
+        offload_response(response, cfd, 1);
+    } else if (should_offload(response)) {
+        offload_response(response, cfd, 0);
+    } else {
+        send_response(response, cfd);
+        finish_client(response, cfd);
+    }
 }
 
 http_request * parse_request(char * request_text, size_t request_len) {
+    size_t terminator_len = 4;
     char * end_of_header = strstr(request_text, "\r\n\r\n");
-    if (end_of_header == NULL) end_of_header = strstr(request_text, "\n\n");
+    if (end_of_header == NULL) {
+        terminator_len = 2;
+        end_of_header = strstr(request_text, "\n\n");
+    }
     if (end_of_header == NULL) return NULL;
 
     char * end_of_request_line = strstr(request_text, "\r\n");
@@ -45,13 +114,20 @@ http_request * parse_request(char * request_text, size_t request_len) {
     if (end_of_request_line == NULL) return NULL;
     
     
-    char * request_body = strdup(end_of_header);
-    int request_body_len = strlen(end_of_header);
-
-    char * request_header = substring(request_text, 0, request_len - request_body_len);
+    // Body bytes that arrived with the header may contain NULs, so they are
+    // copied by length. Anything beyond them is streamed by http_body.
+    size_t header_len = end_of_header - request_text;
+    size_t request_body_len = request_len - header_len - terminator_len;
+    char * request_body = malloc(request_body_len + 1);
+    memcpy(request_body, end_of_header + terminator_len, request_body_len);
+    request_body[request_body_len] = '\0';
+
+    char * request_header = substring(request_text, 0, header_len);
     http_request * request = malloc(sizeof(http_request));
     parse_request_header(request_header, request);
     request->request_body = request_body;
+    request->request_body_len = request_body_len;
+    parse_body_framing(request);
     free(request_header);
 
     return request;
@@ -62,7 +138,7 @@ http_response * build_response(config * conf, http_request * request) {
     sm_put(header_fields, "Server", "DataComm/0.1");
     sm_put(header_fields, "Date", get_utc_time());
 
-    http_response * response = malloc(sizeof(http_response));
+    http_response * response = calloc(1, sizeof(http_response));
     response->header_fields = header_fields;
 
     if (request == NULL) {
@@ -71,23 +147,87 @@ http_response * build_response(config * conf, http_request * request) {
     }
 
     response->method = request->method;
-    int path_status = parse_uri_to_filepath(conf, request->request_uri, &response->request_path);
+
+    // Rewrite rules are matched before routing, so a redirect never reaches
+    // a handler
+    char * request_uri = request->request_uri;
+    rewrite_result rewrite;
+    char * host = request->header_fields != NULL ? http_get_header(request->header_fields, "Host") : NULL;
+    rewrite_apply(conf->rewrite_file, host, request_uri, &rewrite);
+    if (rewrite.action == REWRITE_REDIRECT) {
+        response->response_code = rewrite.status;
+        sm_put(header_fields, "Location", rewrite.target);
+        sm_put(header_fields, "Content-Length", "0");
+        return response;
+    } else if (rewrite.action == REWRITE_INTERNAL) {
+        request_uri = rewrite.target;
+    }
+
+    // Module routes come first, and the modules stay loaded until their
+    // handler has returned
+    http_handler handler;
+    router_match match;
+    module_set * modules = modules_acquire(conf->modules);
+    int route_status = HTTP_NOT_FOUND;
+    unsigned allowed = 0;
+    if (modules != NULL) {
+        route_status = router_find(modules_routes(modules), request->method, request_uri, &handler, &match);
+        allowed = match.allowed;
+    }
+    if (route_status != HTTP_OK) {
+        route_status = router_find(router_default(), request->method, request_uri, &handler, &match);
+        allowed |= match.allowed;
+    }
+
+    if (route_status != HTTP_OK) {
+        // Either set of routes may hold the methods the path is routed for
+        if (allowed != 0) {
+            char allow[ROUTER_ALLOW_LEN];
+            router_format_allow(allowed, allow);
+            sm_put(header_fields, "Allow", allow);
+            route_status = HTTP_METHOD_NOT_ALLOWED;
+        }
+        response->response_code = route_status;
+        sm_put(header_fields, "Content-Length", "0");
+    } else {
+        handler(conf, request, response, &match);
+    }
+    modules_release(modules);
+    return response;
+}
+
+int http_routes_init(void) {
+    int result = 0;
+    router * routes = router_default();
+    result |= router_add(routes, METHOD_GET, "/*path", serve_file, NULL);
+    result |= router_add(routes, METHOD_HEAD, "/*path", serve_file, NULL);
+    result |= router_add(routes, METHOD_POST, "/*path", serve_upload, NULL);
+    result |= router_add(routes, METHOD_PUT, "/*path", serve_upload, NULL);
+    return result;
+}
+
+static void serve_file(config * conf, http_request * request, http_response * response, const router_match * match) {
+    str_map * header_fields = response->header_fields;
+    int path_status = parse_uri_to_filepath(conf, (char *) match->path, &response->request_path, &response->file);
 
     if (path_status == -1) {
         response->response_code = HTTP_SERVER_ERROR;
-        return response;
+        return;
     } else if (path_status == 0) {
         response->response_code = HTTP_NOT_FOUND;
     } else {
         response->response_code = HTTP_OK;
     }
 
-    struct stat st;
-    int stat_status = stat(response->request_path, &st);
+    struct stat st = response->file->st;
 
-    if (stat_status) {
-        response->response_code = HTTP_SERVER_ERROR;
-        return response;
+    if (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)) {
+        // The length of a pipe or device is only known once it has been read
+        if (request->http_version != NULL && strcmp(request->http_version, "HTTP/1.1") == 0) {
+            response->is_chunked = 1;
+            sm_put(header_fields, "Transfer-Encoding", "chunked");
+        }
+        sm_put(header_fields, "Connection", "close");
     } else {
         long size = st.st_size;
         char size_buffer[15];
@@ -95,44 +235,194 @@ http_response * build_response(config * conf, http_request * request) {
 
         sm_put(header_fields, "Content-Length", size_buffer);
     }
+}
 
-    return response;
+static void serve_upload(config * conf, http_request * request, http_response * response, const router_match * match) {
+    (void) request;
+    response->response_code = parse_uri_to_upload_path(conf, (char *) match->path, &response->request_path);
+    if (response->response_code == HTTP_METHOD_NOT_ALLOWED)
+        sm_put(response->header_fields, "Allow", "HEAD, GET");
+    sm_put(response->header_fields, "Content-Length", "0");
 }
 
-void send_response(http_response * response, int cfd) {
-    const char * version = "HTTP/1.0 ";
-    write(cfd, version, strlen(version));
+void receive_request_body(config * conf, http_request * request, http_response * response, int cfd) {
+    (void) conf;
+    if (request == NULL) return;
+    if (response->relay.receive != NULL) {
+        response->relay.receive(response->relay.ctx, request, response, cfd);
+        return;
+    }
+    if (request->method != METHOD_POST && request->method != METHOD_PUT) return;
+
+    http_body_reader reader;
+    if (http_body_reader_init(&reader, request, cfd) == -1) {
+        response->response_code = HTTP_LENGTH_REQUIRED;
+        return;
+    }
+
+    if (response->response_code != HTTP_CREATED || response->request_path == NULL) {
+        http_body_discard(&reader);
+        return;
+    }
+
+    int upload_fd = open(response->request_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (upload_fd == -1) {
+        response->response_code = HTTP_SERVER_ERROR;
+        http_body_discard(&reader);
+        return;
+    }
+
+    if (http_body_splice(&reader, upload_fd) < 0) {
+        response->response_code = HTTP_BAD_REQUEST;
+        close(upload_fd);
+        unlink(response->request_path);
+        return;
+    }
+    close(upload_fd);
+    file_cache_invalidate(response->request_path);
+}
+
+size_t format_response_header(http_response * response, char * buf, size_t buf_len) {
+    const char * version = response->is_chunked ? "HTTP/1.1" : "HTTP/1.0";
     const char * status_phrase = get_status_phrase(response->response_code);
-    write(cfd, status_phrase, strlen(status_phrase));
-    write(cfd, CRLF, 2);
+    // Handlers may answer with any code, so codes without a known phrase go
+    // out with the handler's own reason or a generic one
+    size_t len;
+    if (response->reason != NULL) {
+        len = snprintf(buf, buf_len, "%s %d %s" CRLF, version, response->response_code, response->reason);
+    } else if (status_phrase != NULL) {
+        len = snprintf(buf, buf_len, "%s %s" CRLF, version, status_phrase);
+    } else {
+        len = snprintf(buf, buf_len, "%s %d Unknown" CRLF, version, response->response_code);
+    }
 
     str_map * header_fields = response->header_fields;
     size_t header_lines = sm_size(header_fields);
     char ** header_keys = sm_get_keys(header_fields);
-    for (size_t i = 0; i < header_lines; i++) {
-        char buf[MAX_HEADER_VALUE_LEN];
-        sprintf(buf, "%s: %s", header_keys[i], sm_get(header_fields, header_keys[i]));
-        int len = strlen(buf);
-        write(cfd, buf, len);
-        write(cfd, CRLF, 2);
+    for (size_t i = 0; i < header_lines && len < buf_len; i++) {
+        len += snprintf(buf + len, buf_len - len, "%s: %s" CRLF, header_keys[i], sm_get(header_fields, header_keys[i]));
+    }
+
+    if (len < buf_len) len += snprintf(buf + len, buf_len - len, CRLF);
+    return len < buf_len ? len : buf_len - 1;
+}
+
+void send_response(http_response * response, int cfd) {
+    if (response->relay.send != NULL) {
+        response->relay.send(response->relay.ctx, response, cfd);
+        return;
+    }
+
+    char header_buf[MAX_RESPONSE_HEADER_LEN];
+    size_t header_len = format_response_header(response, header_buf, MAX_RESPONSE_HEADER_LEN);
+
+    if (!has_body(response)) {
+        tls_write(cfd, header_buf, header_len);
+        return;
+    }
+
+    // A body built in memory goes out with the header in one writev
+    if (response->body != NULL) {
+        struct iovec iov[2] = {
+            { header_buf, header_len },
+            { response->body, response->body_len }
+        };
+        writev_all(cfd, iov, 2);
+        return;
+    }
+
+    int content_fd = response->file->fd;
+
+    // A FIFO or device has no length to sendfile, so it is read until the
+    // end, chunked for HTTP/1.1 and delimited by closing for HTTP/1.0. The
+    // header rides along with the first write
+    if (response->is_chunked || !S_ISREG(response->file->st.st_mode)) {
+        http_chunked_writer writer;
+        http_chunked_init(&writer, cfd, response->is_chunked, header_buf, header_len);
+
+        char buf[CHUNK_BUFFER];
+        ssize_t num_read = read(content_fd, buf, CHUNK_BUFFER);
+        while (num_read > 0) {
+            if (http_chunked_write(&writer, buf, num_read) < 0) break;
+            num_read = read(content_fd, buf, CHUNK_BUFFER);
+        }
+        http_chunked_finish(&writer);
+        return;
+    }
+
+    tls_write(cfd, header_buf, header_len);
+
+    // sendfile stays zero-copy under TLS as long as the kernel encrypts
+    tls_sendfile(cfd, content_fd, 0, response->file->st.st_size);
+}
+
+void http_chunked_init(http_chunked_writer * writer, int cfd, int is_chunked, const char * prefix, size_t prefix_len) {
+    writer->cfd = cfd;
+    writer->is_chunked = is_chunked;
+    writer->prefix = prefix;
+    writer->prefix_len = prefix_len;
+}
+
+ssize_t http_chunked_writev(http_chunked_writer * writer, const struct iovec * iov, int iovcnt) {
+    if (iovcnt > HTTP_CHUNK_MAX_IOV) return -1;
+
+    struct iovec frame[HTTP_CHUNK_MAX_IOV + 3];
+    char chunk_header[HTTP_CHUNK_HEADER_LEN];
+    int frame_len = 0;
+    size_t payload_len = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        payload_len += iov[i].iov_len;
+    }
+    if (payload_len == 0) return 0;
+
+    if (writer->prefix_len > 0) {
+        frame[frame_len].iov_base = (void *) writer->prefix;
+        frame[frame_len++].iov_len = writer->prefix_len;
+    }
+
+    if (writer->is_chunked) {
+        int chunk_header_len = snprintf(chunk_header, HTTP_CHUNK_HEADER_LEN, "%zx" CRLF, payload_len);
+        frame[frame_len].iov_base = chunk_header;
+        frame[frame_len++].iov_len = chunk_header_len;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        frame[frame_len++] = iov[i];
+    }
+
+    if (writer->is_chunked) {
+        frame[frame_len].iov_base = CRLF;
+        frame[frame_len++].iov_len = 2;
     }
 
-    write(cfd, CRLF, 2);
+    if (writev_all(writer->cfd, frame, frame_len) < 0) return -1;
+    writer->prefix_len = 0;
+    return payload_len;
+}
+
+ssize_t http_chunked_write(http_chunked_writer * writer, const char * data, size_t len) {
+    struct iovec iov = { .iov_base = (void *) data, .iov_len = len };
+    return http_chunked_writev(writer, &iov, 1);
+}
 
-    if (response->method == METHOD_HEAD) return;
-    if (response->response_code == HTTP_SERVER_ERROR) return;
+int http_chunked_finish(http_chunked_writer * writer) {
+    struct iovec frame[2];
+    int frame_len = 0;
 
-    const char * content_filepath = response->request_path;
-    int content_fd = open(content_filepath, O_RDONLY);
+    if (writer->prefix_len > 0) {
+        frame[frame_len].iov_base = (void *) writer->prefix;
+        frame[frame_len++].iov_len = writer->prefix_len;
+    }
 
-    ssize_t num_read;
-    char buf[BODY_BUFFER];
-    num_read = read(content_fd, buf, BODY_BUFFER);
-    while (num_read > 0) {
-        write(cfd, buf, num_read);
-        num_read = read(content_fd, buf, BODY_BUFFER);
+    if (writer->is_chunked) {
+        frame[frame_len].iov_base = "0" CRLF CRLF;
+        frame[frame_len++].iov_len = 5;
     }
-    close(content_fd);
+
+    writer->prefix_len = 0;
+    if (frame_len == 0) return 0;
+    return writev_all(writer->cfd, frame, frame_len) < 0 ? -1 : 0;
 }
 
 void http_request_destroy(http_request * request) {
@@ -150,10 +440,38 @@ void http_response_destroy(http_response * response) {
     if (response->request_path != NULL)
         free(response->request_path);
 
+    file_cache_release(response->file);
+    free(response->body);
+    if (response->relay.destroy != NULL)
+        response->relay.destroy(response->relay.ctx);
     sm_destroy(response->header_fields);
     free(response);
 }
 
+static ssize_t writev_all(int fd, struct iovec * iov, int iovcnt) {
+    ssize_t total = 0;
+    while (iovcnt > 0) {
+        ssize_t num_written = tls_writev(fd, iov, iovcnt);
+        if (num_written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += num_written;
+
+        // Skip past whatever a short write already sent
+        while (iovcnt > 0 && (size_t) num_written >= iov->iov_len) {
+            num_written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + num_written;
+            iov->iov_len -= num_written;
+        }
+    }
+    return total;
+}
+
 static char * substring(const char * string, size_t start, size_t end) {
     size_t out_len = end - start;
     char * out = calloc(out_len + 1, sizeof(char));
@@ -173,6 +491,14 @@ static int parse_request_method(char * method) {
         return METHOD_HEAD;
     }
 
+    if (strcmp(method, "POST") == 0) {
+        return METHOD_POST;
+    }
+
+    if (strcmp(method, "PUT") == 0) {
+        return METHOD_PUT;
+    }
+
     return METHOD_UNSUPPORTED;
 }
 
@@ -181,6 +507,30 @@ static char * get_status_phrase(int status_code) {
         return "200 OK";
     }
     
+    if (status_code == HTTP_CREATED) {
+        return "201 Created";
+    }
+
+    if (status_code == HTTP_MOVED_PERMANENTLY) {
+        return "301 Moved Permanently";
+    }
+
+    if (status_code == HTTP_FOUND) {
+        return "302 Found";
+    }
+
+    if (status_code == HTTP_TEMPORARY_REDIRECT) {
+        return "307 Temporary Redirect";
+    }
+
+    if (status_code == HTTP_PERMANENT_REDIRECT) {
+        return "308 Permanent Redirect";
+    }
+
+    if (status_code == HTTP_FORBIDDEN) {
+        return "403 Forbidden";
+    }
+
     if (status_code == HTTP_NOT_FOUND) {
         return "404 Not Found";
     }
@@ -189,7 +539,31 @@ static char * get_status_phrase(int status_code) {
         return "400 Bad Request";
     }
 
-    return "500 Internal Server Error";
+    if (status_code == HTTP_METHOD_NOT_ALLOWED) {
+        return "405 Method Not Allowed";
+    }
+
+    if (status_code == HTTP_LENGTH_REQUIRED) {
+        return "411 Length Required";
+    }
+
+    if (status_code == HTTP_TOO_MANY_REQUESTS) {
+        return "429 Too Many Requests";
+    }
+
+    if (status_code == HTTP_BAD_GATEWAY) {
+        return "502 Bad Gateway";
+    }
+
+    if (status_code == HTTP_SERVER_ERROR) {
+        return "500 Internal Server Error";
+    }
+
+    if (status_code == HTTP_SERVICE_UNAVAILABLE) {
+        return "503 Service Unavailable";
+    }
+
+    return NULL;
 }
 
 static char * get_utc_time() {
@@ -204,6 +578,46 @@ static char * get_utc_time() {
     return time_text;
 }
 
+char * http_get_header(str_map * header_fields, const char * name) {
+    size_t header_lines = sm_size(header_fields);
+    char ** header_keys = sm_get_keys(header_fields);
+    for (size_t i = 0; i < header_lines; i++) {
+        if (strcasecmp(header_keys[i], name) != 0) continue;
+
+        char * value = sm_get(header_fields, header_keys[i]);
+        while (*value == ' ' || *value == '\t') value++;
+        return value;
+    }
+    return NULL;
+}
+
+// Sets content_length to -1 when the request carries no usable length
+static void parse_body_framing(http_request * request) {
+    request->content_length = -1;
+    request->is_chunked = 0;
+
+    // chunked is always the last coding listed in Transfer-Encoding
+    char * transfer_encoding = http_get_header(request->header_fields, "Transfer-Encoding");
+    if (transfer_encoding != NULL) {
+        size_t coding_len = strlen(transfer_encoding);
+        while (coding_len > 0 && (transfer_encoding[coding_len - 1] == ' ' || transfer_encoding[coding_len - 1] == '\t')) coding_len--;
+        if (coding_len >= 7 && strncasecmp(transfer_encoding + coding_len - 7, "chunked", 7) == 0) {
+            request->is_chunked = 1;
+            return;
+        }
+    }
+
+    char * content_length = http_get_header(request->header_fields, "Content-Length");
+    if (content_length == NULL) return;
+
+    char * end;
+    long long length = strtoll(content_length, &end, 10);
+    if (end == content_length || length < 0) return;
+    while (*end == ' ' || *end == '\t') end++;
+    if (*end != '\0') return;
+    request->content_length = length;
+}
+
 // Parsing according to example at: https://linux.die.net/man/3/strtok_r
 static void parse_request_header(char * raw_header, http_request * request) {
     char * saveptr1, * saveptr2, * saveptr3;
@@ -231,7 +645,9 @@ static void parse_request_header(char * raw_header, http_request * request) {
 // Returns 1 if able to open request_uri
 // Returns 0 if can't open request_uri but can open not found page
 // Returns -1 if can't open either (Server Error)
-static int parse_uri_to_filepath(config * conf, char * request_uri, char ** request_path) {
+// The opened file is returned in file
+static int parse_uri_to_filepath(config * conf, char * request_uri, char ** request_path, file_cache_entry ** file) {
+    *file = NULL;
     if (request_uri == NULL) {
         *request_path = NULL;
         return -1;
@@ -246,11 +662,15 @@ static int parse_uri_to_filepath(config * conf, char * request_uri, char ** requ
         request_uri = index_page;
     }
 
+    // Scanners asking for paths that don't exist are then answered from
+    // the cache, and so is the cached not found page
+    file_cache_watch(serving_directory);
+
     char filepath_buf[MAX_URI_PATH_LEN];
     memset(filepath_buf, 0, MAX_URI_PATH_LEN);
     sprintf(filepath_buf, "%s%s", serving_directory, request_uri);
 
-    if( access( filepath_buf, F_OK ) != -1 ) {
+    if( (*file = file_cache_open(filepath_buf)) != NULL ) {
         size_t filepath_len = strlen(filepath_buf);
         *request_path = calloc(filepath_len + 1, sizeof(char));
         strcpy(*request_path, filepath_buf);
@@ -260,7 +680,7 @@ static int parse_uri_to_filepath(config * conf, char * request_uri, char ** requ
     memset(filepath_buf, 0, MAX_URI_PATH_LEN);
     sprintf(filepath_buf, "%s%s", serving_directory, not_found_page);
 
-    if( access( filepath_buf, F_OK ) != -1 ) {
+    if( (*file = file_cache_open(filepath_buf)) != NULL ) {
         size_t filepath_len = strlen(filepath_buf);
         *request_path = calloc(filepath_len + 1, sizeof(char));
         strcpy(*request_path, filepath_buf);
@@ -270,3 +690,118 @@ static int parse_uri_to_filepath(config * conf, char * request_uri, char ** requ
     *request_path = NULL;
     return -1;
 }
+
+
+// Returns HTTP_CREATED with the destination in request_path if uploads are
+// enabled and request_uri stays inside upload_dir
+static int parse_uri_to_upload_path(config * conf, char * request_uri, char ** request_path) {
+    *request_path = NULL;
+
+    if (conf->upload_dir == NULL) return HTTP_METHOD_NOT_ALLOWED;
+    if (request_uri == NULL || request_uri[0] != '/') return HTTP_BAD_REQUEST;
+    if (strstr(request_uri, "..") != NULL) return HTTP_BAD_REQUEST;
+    if (strlen(conf->upload_dir) + strlen(request_uri) >= MAX_URI_PATH_LEN) return HTTP_BAD_REQUEST;
+
+    char filepath_buf[MAX_URI_PATH_LEN];
+    sprintf(filepath_buf, "%s%s", conf->upload_dir, request_uri);
+    *request_path = strdup(filepath_buf);
+    return HTTP_CREATED;
+}
+
+static int has_body(http_response * response) {
+    if (response->method == METHOD_HEAD) return 0;
+    if (response->body != NULL) return 1;
+    return response->file != NULL
+            && (response->response_code == HTTP_OK || response->response_code == HTTP_NOT_FOUND);
+}
+
+// Whether sending the body could block on the disk for long. A read with
+// RWF_NOWAIT fails with EAGAIN instead of waiting for a page to be read in
+static int should_offload(http_response * response) {
+    if (response->file == NULL || response->is_chunked || !has_body(response)) return 0;
+
+    off_t size = response->file->st.st_size;
+    if (size >= HTTP_OFFLOAD_SIZE) return 1;
+    if (size == 0) return 0;
+
+    char probe;
+    struct iovec iov = { .iov_base = &probe, .iov_len = 1 };
+    if (preadv2(response->file->fd, &iov, 1, 0, RWF_NOWAIT) == -1 && errno == EAGAIN) return 1;
+    if (preadv2(response->file->fd, &iov, 1, size - 1, RWF_NOWAIT) == -1 && errno == EAGAIN) return 1;
+    return 0;
+}
+
+// Falls back to sending on the calling worker when the I/O pool is full
+static void offload_response(http_response * response, int cfd, int sliced) {
+    offloaded_response * offloaded = malloc(sizeof(offloaded_response));
+    offloaded->response = response;
+    offloaded->cfd = cfd;
+    offloaded->sliced = sliced;
+    offloaded->sent = 0;
+    size_t rank = sliced ? (size_t) response->file->st.st_size : 0;
+    if (io_pool_submit_ranked(send_offloaded, offloaded, rank) == 0) return;
+
+    free(offloaded);
+    send_response(response, cfd);
+    finish_client(response, cfd);
+}
+
+static void send_offloaded(void * arg) {
+    offloaded_response * offloaded = arg;
+    if (!offloaded->sliced) {
+        send_response(offloaded->response, offloaded->cfd);
+    } else {
+        // After each slice the response goes back in line behind anything
+        // with fewer bytes left
+        off_t size = offloaded->response->file->st.st_size;
+        while (send_slice(offloaded->response, offloaded->cfd, &offloaded->sent) == 0) {
+            if (io_pool_submit_ranked(send_offloaded, offloaded, size - offloaded->sent) == 0) return;
+        }
+    }
+    finish_client(offloaded->response, offloaded->cfd);
+    free(offloaded);
+}
+
+// Sends the header with the first slice. Returns 0 while bytes are left,
+// 1 once the body is complete or -1 if the client went away
+static int send_slice(http_response * response, int cfd, off_t * sent) {
+    off_t size = response->file->st.st_size;
+    if (*sent == 0) {
+        char header_buf[MAX_RESPONSE_HEADER_LEN];
+        size_t header_len = format_response_header(response, header_buf, MAX_RESPONSE_HEADER_LEN);
+        if (tls_write(cfd, header_buf, header_len) != (ssize_t) header_len) return -1;
+    }
+    if (*sent >= size) return 1;
+
+    size_t len = size - *sent < HTTP_SLICE_SIZE ? (size_t) (size - *sent) : HTTP_SLICE_SIZE;
+    ssize_t num_sent = tls_sendfile(cfd, response->file->fd, *sent, len);
+    if (num_sent <= 0) return -1;
+    *sent += num_sent;
+    return *sent >= size ? 1 : 0;
+}
+
+void http_reject_client(int cfd, int status_code) {
+    if (tls_is_enabled()) {
+        close(cfd);
+        return;
+    }
+
+    // Drain what has arrived so closing does not reset the connection
+    // before the client reads the response
+    char discard[MAX_REQUEST_LEN];
+    while (recv(cfd, discard, sizeof(discard), MSG_DONTWAIT) > 0);
+
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+        "HTTP/1.0 %s\r\nRetry-After: %d\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+        get_status_phrase(status_code), HTTP_RETRY_AFTER);
+    send(cfd, header, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(cfd, SHUT_WR);
+    close(cfd);
+}
+
+static void finish_client(http_response * response, int cfd) {
+    http_response_destroy(response);
+    tls_close(cfd);
+    close(cfd);
+}
@@ -2,37 +2,99 @@
 #define HTTP_H
 
 #include "config.h"
+#include "file_cache.h"
 
 #include "../libs/str_map.h"
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define METHOD_UNSUPPORTED 0
 #define METHOD_HEAD 1
 #define METHOD_GET 2
+#define METHOD_POST 3
+#define METHOD_PUT 4
 
 #define HTTP_OK 200
+#define HTTP_CREATED 201
+#define HTTP_MOVED_PERMANENTLY 301
+#define HTTP_FOUND 302
+#define HTTP_TEMPORARY_REDIRECT 307
+#define HTTP_PERMANENT_REDIRECT 308
 #define HTTP_BAD_REQUEST 400
+#define HTTP_FORBIDDEN 403
 #define HTTP_NOT_FOUND 404
+#define HTTP_METHOD_NOT_ALLOWED 405
+#define HTTP_LENGTH_REQUIRED 411
+#define HTTP_TOO_MANY_REQUESTS 429
 #define HTTP_SERVER_ERROR 500
+#define HTTP_BAD_GATEWAY 502
+#define HTTP_SERVICE_UNAVAILABLE 503
+#define HTTP_RETRY_AFTER 1
 
 #define MAX_REQUEST_LEN 2048
 #define MAX_HEADER_VALUE_LEN 1024
 #define MAX_URI_PATH_LEN 1024
+#define MAX_RESPONSE_HEADER_LEN 4096
+#define HTTP_CHUNK_HEADER_LEN 20
+#define HTTP_CHUNK_MAX_IOV 16
+#define HTTP_OFFLOAD_SIZE (1024 * 1024)
+#define HTTP_SLICE_SIZE (64 * 1024)
 
-typedef struct  {
+typedef struct http_response http_response;
+typedef struct http_request http_request;
+
+/**
+ * Hands a response over to code that relays it from elsewhere, such as a
+ * FastCGI backend, instead of sending a file or body. receive is given the
+ * request body, and is called for every request so it can also mark the end
+ * of an empty one. send then writes the status line, header and body to cfd.
+ * destroy frees ctx along with the response.
+ */
+typedef struct {
+    void * ctx;
+    void (*receive)(void * ctx, http_request * request, http_response * response, int cfd);
+    void (*send)(void * ctx, http_response * response, int cfd);
+    void (*destroy)(void * ctx);
+} http_relay;
+
+struct http_response {
     int method;
     int response_code;
     char * request_path;
+    file_cache_entry * file;
+    char * body;
+    size_t body_len;
     str_map * header_fields;
-} http_response;
+    int is_chunked;
+    const char * reason;
+    http_relay relay;
+};
 
-typedef struct  {
+struct http_request {
     int method;
     char * request_uri;
     char * http_version;
     str_map * header_fields;
     char * request_body;
-} http_request;
+    size_t request_body_len;
+    long long content_length;
+    int is_chunked;
+};
+
+/**
+ * Frames body writes for a response whose length is not known up front. With
+ * is_chunked set every write becomes one chunk whose size line and trailing
+ * CRLF share a single writev with the payload; otherwise the body is written
+ * as is and delimited by closing the connection. Any prefix, such as the
+ * response header, is sent in the same writev as the first write.
+ */
+typedef struct {
+    int cfd;
+    int is_chunked;
+    const char * prefix;
+    size_t prefix_len;
+} http_chunked_writer;
 
 /**
  * Parses an http request of size request_len and returns request content
@@ -41,15 +103,67 @@ typedef struct  {
 http_request * parse_request(char * request_text, size_t request_len);
 
 /**
- * Builds an http_response based on the passed in http_request.
+ * Returns the value of the header field name, matched case-insensitively and
+ * with leading whitespace skipped, or NULL if the field is not present.
+ */
+char * http_get_header(str_map * header_fields, const char * name);
+
+/**
+ * Builds an http_response based on the passed in http_request, by applying
+ * the rewrite rules and then calling the handler the request routes to.
  */
 http_response * build_response(config * conf, http_request * request);
 
+/**
+ * Routes every GET and HEAD request to static file serving and every POST and
+ * PUT request to uploads in router_default(). Routes added there take
+ * precedence wherever they are more specific. Must be called before clients
+ * are served. Returns -1 if the routes could not be registered.
+ */
+int http_routes_init(void);
+
+/**
+ * Streams the body of a POST or PUT request from cfd into the upload directory
+ * and updates the response code to match the outcome. The body is never held
+ * in memory in full.
+ */
+void receive_request_body(config * conf, http_request * request, http_response * response, int cfd);
+
+/**
+ * Writes the status line and header fields of response, followed by the blank
+ * line that ends the header, into buf. Returns the number of bytes written.
+ */
+size_t format_response_header(http_response * response, char * buf, size_t buf_len);
+
 /**
  * Sends an http_response to the socket file descriptor specified by cfd
  */
 void send_response(http_response * response, int cfd);
 
+/**
+ * Prepares writer to stream a body to cfd. prefix must stay valid until the
+ * first write or http_chunked_finish.
+ */
+void http_chunked_init(http_chunked_writer * writer, int cfd, int is_chunked, const char * prefix, size_t prefix_len);
+
+/**
+ * Sends the iovcnt buffers in iov as a single chunk. At most
+ * HTTP_CHUNK_MAX_IOV buffers can be framed at once. Returns the number of
+ * payload bytes sent or -1 on error.
+ */
+ssize_t http_chunked_writev(http_chunked_writer * writer, const struct iovec * iov, int iovcnt);
+
+/**
+ * Sends len bytes of data as a single chunk.
+ */
+ssize_t http_chunked_write(http_chunked_writer * writer, const char * data, size_t len);
+
+/**
+ * Ends the body with the zero-length last chunk. Returns 0 on success or -1
+ * on error.
+ */
+int http_chunked_finish(http_chunked_writer * writer);
+
 /**
  * Destroys an http_request and performs any other necessary clean up.
  */
@@ -63,8 +177,21 @@ void http_response_destroy(http_response * response);
 /**
  * High-level interface to handle an http request from a client on socket. This function
  * makes use of parse_request, build_response, and send_response to handle a request
- * from a socket specified by cfd.
+ * from a socket specified by cfd. Bodies of at least HTTP_OFFLOAD_SIZE bytes, or
+ * whose first or last page is not in the page cache, are sent from the I/O pool
+ * so the calling worker is free for the next client. With the srpt setting every
+ * body larger than HTTP_SLICE_SIZE or not cached is sent from the I/O pool instead,
+ * a slice at a time, always continuing the response with the fewest bytes left. cfd is closed once the
+ * response has been sent, possibly after this returns.
  */
 void http_handle_client(config * conf, int cfd);
 
+/**
+ * Turns away a client without parsing its request, by answering status_code
+ * with a Retry-After of HTTP_RETRY_AFTER seconds and closing cfd. Never
+ * blocks. Over TLS the connection is closed without a response, since a
+ * handshake would cost as much as the request it saves.
+ */
+void http_reject_client(int cfd, int status_code);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,939 @@
+#include "http2.h"
+#include "hpack.h"
+#include "tls.h"
+#include "buffer_pool.h"
+#include "huge_pages.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define FRAME_HEADER_LEN 9
+
+#define FRAME_DATA 0x0
+#define FRAME_HEADERS 0x1
+#define FRAME_PRIORITY 0x2
+#define FRAME_RST_STREAM 0x3
+#define FRAME_SETTINGS 0x4
+#define FRAME_PUSH_PROMISE 0x5
+#define FRAME_PING 0x6
+#define FRAME_GOAWAY 0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION 0x9
+
+#define FLAG_END_STREAM 0x1
+#define FLAG_ACK 0x1
+#define FLAG_END_HEADERS 0x4
+#define FLAG_PADDED 0x8
+#define FLAG_PRIORITY 0x20
+
+#define SETTINGS_HEADER_TABLE_SIZE 0x1
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE 0x4
+#define SETTINGS_MAX_FRAME_SIZE 0x5
+
+#define ERROR_NO_ERROR 0x0
+#define ERROR_PROTOCOL 0x1
+#define ERROR_INTERNAL 0x2
+#define ERROR_FLOW_CONTROL 0x3
+#define ERROR_FRAME_SIZE 0x6
+#define ERROR_REFUSED_STREAM 0x7
+#define ERROR_COMPRESSION 0x9
+
+#define MAX_WINDOW 0x7fffffff
+#define INPUT_BUFFER (HTTP2_MAX_FRAME_SIZE + FRAME_HEADER_LEN)
+#define WRITER_SPACE 4096
+#define HEADER_BLOCK_MAX 65536
+#define METHOD_LEN 16
+#define ZEROCOPY_CONTROL_LEN 128
+
+typedef struct h2_stream {
+    uint32_t id;
+    int64_t window;
+    int method;
+    int done;
+    http_response * response;
+    uint8_t * header_block;
+    size_t header_block_len;
+    int headers_sent;
+    char * body;
+    size_t body_len;
+    size_t body_sent;
+    uint32_t release_after;
+    struct h2_stream * next;
+} h2_stream;
+
+/**
+ * Collects frames into a single writev. Frame headers and small control
+ * payloads are copied into space; HEADERS blocks and DATA payloads are
+ * referenced where they live, so file contents are never copied. Taken from
+ * the buffer pool when a frame is queued and handed back when the
+ * connection goes idle, or once the kernel is done with it if it was sent
+ * with MSG_ZEROCOPY.
+ */
+typedef struct h2_writer {
+    struct iovec iov[HTTP2_WRITER_IOV];
+    int iovcnt;
+    uint8_t space[WRITER_SPACE];
+    size_t space_used;
+    uint32_t release_after;
+    struct h2_writer * next;
+} h2_writer;
+
+/**
+ * State of one HTTP/2 connection. The input, writer and header block buffers
+ * are only attached while bytes are in flight, so a connection waiting for
+ * its next request holds little more than this struct and the HPACK table.
+ */
+typedef struct {
+    int cfd;
+    config * conf;
+    hpack_decoder decoder;
+    h2_writer * writer;
+    int64_t send_window;
+    uint32_t peer_initial_window;
+    uint32_t peer_max_frame;
+    uint32_t last_stream_id;
+    size_t stream_count;
+    h2_stream * streams;
+    uint8_t * in;
+    size_t in_len;
+    uint8_t * header_block;
+    size_t header_block_len;
+    uint32_t header_stream;
+    int closing;
+    int failed;
+    int zerocopy;
+    uint32_t zerocopy_sent;
+    uint32_t zerocopy_done;
+    h2_stream * retired_streams;
+    h2_writer * retired_writers;
+} h2_conn;
+
+typedef struct {
+    char method[METHOD_LEN];
+    char path[MAX_URI_PATH_LEN];
+    char authority[MAX_HEADER_VALUE_LEN];
+} h2_request_line;
+
+static int read_preface(h2_conn * conn);
+static int read_frames(h2_conn * conn);
+static int parse_frames(h2_conn * conn);
+static int handle_frame(h2_conn * conn, uint8_t type, uint8_t flags, uint32_t stream_id, uint8_t * payload, size_t len);
+static int handle_headers(h2_conn * conn, uint8_t flags, uint32_t stream_id, uint8_t * payload, size_t len);
+static int handle_settings(h2_conn * conn, const uint8_t * payload, size_t len);
+static int handle_window_update(h2_conn * conn, uint32_t stream_id, const uint8_t * payload, size_t len);
+static int start_stream(h2_conn * conn, uint32_t stream_id, const uint8_t * block, size_t len);
+static int collect_request_line(void * ctx, const hpack_field * field);
+static void open_stream(h2_conn * conn, uint32_t stream_id, const char * method, const char * path, const char * authority);
+static void map_body(h2_stream * stream);
+static void encode_response_headers(h2_conn * conn, h2_stream * stream);
+static h2_stream * find_stream(h2_conn * conn, uint32_t stream_id);
+static int has_sendable(h2_conn * conn);
+static void schedule_output(h2_conn * conn);
+static void reap_streams(h2_conn * conn);
+static void destroy_stream(h2_stream * stream);
+static void queue_frame(h2_conn * conn, uint8_t type, uint8_t flags, uint32_t stream_id, const void * payload, size_t len, int copy);
+static void queue_window_update(h2_conn * conn, uint32_t stream_id, uint32_t increment);
+static void queue_rst_stream(h2_conn * conn, uint32_t stream_id, uint32_t error);
+static void queue_goaway(h2_conn * conn, uint32_t error);
+static void flush_writer(h2_conn * conn);
+static ssize_t send_zerocopy(h2_conn * conn, const struct iovec * iov, int iovcnt);
+static void reap_zerocopy(h2_conn * conn);
+static void wait_zerocopy(h2_conn * conn);
+static void release_retired(h2_conn * conn);
+static int zerocopy_complete(h2_conn * conn, uint32_t id);
+static int connection_error(h2_conn * conn, uint32_t error);
+static int attach_input(h2_conn * conn);
+static void release_idle_buffers(h2_conn * conn);
+static size_t decode_base64url(const char * in, uint8_t * out, size_t out_len);
+static uint32_t read_u32(const uint8_t * p);
+static void write_u32(uint8_t * p, uint32_t value);
+
+int http2_is_preface(const char * data, size_t len) {
+    return len >= HTTP2_PREFACE_LEN && memcmp(data, HTTP2_PREFACE, HTTP2_PREFACE_LEN) == 0;
+}
+
+int http2_is_upgrade(http_request * request) {
+    if (request == NULL || tls_is_enabled()) return 0;
+    if (request->method != METHOD_GET && request->method != METHOD_HEAD) return 0;
+    if (request->http_version == NULL || strcmp(request->http_version, "HTTP/1.1") != 0) return 0;
+
+    char * upgrade = http_get_header(request->header_fields, "Upgrade");
+    if (upgrade == NULL || strncasecmp(upgrade, "h2c", 3) != 0) return 0;
+    return http_get_header(request->header_fields, "HTTP2-Settings") != NULL;
+}
+
+void http2_serve(config * conf, int cfd, const char * initial, size_t initial_len, http_request * upgrade) {
+    h2_conn * conn = calloc(1, sizeof(h2_conn));
+    conn->cfd = cfd;
+    conn->conf = conf;
+    conn->send_window = HTTP2_DEFAULT_WINDOW;
+    conn->peer_initial_window = HTTP2_DEFAULT_WINDOW;
+    conn->peer_max_frame = HTTP2_MAX_FRAME_SIZE;
+    hpack_decoder_init(&conn->decoder);
+
+    // kTLS and OpenSSL don't take MSG_ZEROCOPY, so only h2c can use it
+    int one = 1;
+    conn->zerocopy = !tls_is_enabled() && conf->zerocopy_threshold > 0 &&
+                     setsockopt(cfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+
+    if (initial_len > INPUT_BUFFER) initial_len = INPUT_BUFFER;
+    if (initial_len > 0 && attach_input(conn) == 0) {
+        memcpy(conn->in, initial, initial_len);
+        conn->in_len = initial_len;
+    }
+
+    if (upgrade != NULL) {
+        const char * switching = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        tls_write(cfd, switching, strlen(switching));
+
+        uint8_t settings[HTTP2_MAX_FRAME_SIZE];
+        size_t settings_len = decode_base64url(http_get_header(upgrade->header_fields, "HTTP2-Settings"), settings, sizeof(settings));
+        handle_settings(conn, settings, settings_len - settings_len % 6);
+
+        conn->last_stream_id = 1;
+        open_stream(conn, 1, upgrade->method == METHOD_HEAD ? "HEAD" : "GET", upgrade->request_uri,
+                http_get_header(upgrade->header_fields, "Host"));
+
+        // The body of the upgrade request was already consumed as HTTP/1.1
+        conn->in_len = 0;
+    }
+
+    uint8_t settings[12];
+    settings[0] = 0;
+    settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+    write_u32(settings + 2, HTTP2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = SETTINGS_MAX_FRAME_SIZE;
+    write_u32(settings + 8, HTTP2_MAX_FRAME_SIZE);
+    queue_frame(conn, FRAME_SETTINGS, 0, 0, settings, sizeof(settings), 1);
+    flush_writer(conn);
+
+    // Frames may have arrived in the same read as the preface
+    if (read_preface(conn) == 0 && parse_frames(conn) == 0) {
+        for (;;) {
+            if (conn->failed) break;
+
+            int pending = has_sendable(conn);
+            if (!pending && conn->closing && conn->streams == NULL) break;
+
+            int readable = tls_pending(cfd) > 0;
+            if (!pending && !readable) release_idle_buffers(conn);
+            if (!readable) {
+                struct pollfd pfd = { .fd = cfd, .events = POLLIN };
+                readable = poll(&pfd, 1, pending ? 0 : HTTP2_IDLE_TIMEOUT) > 0;
+                // Zerocopy completions wait on the error queue and show up
+                // as POLLERR without any request bytes
+                if (readable && (pfd.revents & POLLERR) && conn->zerocopy_done != conn->zerocopy_sent) {
+                    uint32_t done = conn->zerocopy_done;
+                    reap_zerocopy(conn);
+                    if (done != conn->zerocopy_done && !(pfd.revents & (POLLIN | POLLHUP))) continue;
+                }
+            }
+            if (!pending && !readable) {
+                queue_goaway(conn, ERROR_NO_ERROR);
+                flush_writer(conn);
+                break;
+            }
+
+            if (readable && read_frames(conn) == -1) break;
+
+            schedule_output(conn);
+            flush_writer(conn);
+            reap_streams(conn);
+        }
+    }
+
+    for (h2_stream * stream = conn->streams; stream != NULL; stream = stream->next) {
+        stream->done = 1;
+    }
+    reap_streams(conn);
+    wait_zerocopy(conn);
+    hpack_decoder_destroy(&conn->decoder);
+    buffer_pool_put(conn->in, INPUT_BUFFER);
+    buffer_pool_put(conn->writer, sizeof(h2_writer));
+    buffer_pool_put(conn->header_block, HEADER_BLOCK_MAX);
+    free(conn);
+}
+
+static int read_preface(h2_conn * conn) {
+    if (attach_input(conn) == -1) return -1;
+    while (conn->in_len < HTTP2_PREFACE_LEN) {
+        ssize_t num_read = tls_read(conn->cfd, conn->in + conn->in_len, INPUT_BUFFER - conn->in_len);
+        if (num_read <= 0) return -1;
+        conn->in_len += num_read;
+    }
+
+    if (!http2_is_preface((char *) conn->in, conn->in_len)) return -1;
+
+    conn->in_len -= HTTP2_PREFACE_LEN;
+    memmove(conn->in, conn->in + HTTP2_PREFACE_LEN, conn->in_len);
+    return 0;
+}
+
+static int read_frames(h2_conn * conn) {
+    if (attach_input(conn) == -1) return -1;
+    ssize_t num_read = tls_read(conn->cfd, conn->in + conn->in_len, INPUT_BUFFER - conn->in_len);
+    if (num_read <= 0) return -1;
+    conn->in_len += num_read;
+    return parse_frames(conn);
+}
+
+static int parse_frames(h2_conn * conn) {
+    size_t pos = 0;
+    while (conn->in_len - pos >= FRAME_HEADER_LEN) {
+        uint8_t * frame = conn->in + pos;
+        size_t len = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+        if (len > HTTP2_MAX_FRAME_SIZE) return connection_error(conn, ERROR_FRAME_SIZE);
+        if (conn->in_len - pos < FRAME_HEADER_LEN + len) break;
+
+        uint32_t stream_id = read_u32(frame + 5) & MAX_WINDOW;
+        if (handle_frame(conn, frame[3], frame[4], stream_id, frame + FRAME_HEADER_LEN, len) == -1) return -1;
+        pos += FRAME_HEADER_LEN + len;
+    }
+
+    conn->in_len -= pos;
+    memmove(conn->in, conn->in + pos, conn->in_len);
+    return 0;
+}
+
+static int handle_frame(h2_conn * conn, uint8_t type, uint8_t flags, uint32_t stream_id, uint8_t * payload, size_t len) {
+    // Nothing may interleave with a header block that is still open
+    if (conn->header_stream != 0 && (type != FRAME_CONTINUATION || stream_id != conn->header_stream)) {
+        return connection_error(conn, ERROR_PROTOCOL);
+    }
+
+    switch (type) {
+        case FRAME_DATA:
+            if (stream_id == 0) return connection_error(conn, ERROR_PROTOCOL);
+            // Request bodies are not accepted over HTTP/2; give the credit back
+            if (len > 0) queue_window_update(conn, 0, len);
+            return 0;
+        case FRAME_HEADERS:
+            return handle_headers(conn, flags, stream_id, payload, len);
+        case FRAME_CONTINUATION:
+            if (conn->header_stream == 0) return connection_error(conn, ERROR_PROTOCOL);
+            if (conn->header_block_len + len > HEADER_BLOCK_MAX) return connection_error(conn, ERROR_COMPRESSION);
+            memcpy(conn->header_block + conn->header_block_len, payload, len);
+            conn->header_block_len += len;
+            if (flags & FLAG_END_HEADERS) {
+                int result = start_stream(conn, conn->header_stream, conn->header_block, conn->header_block_len);
+                buffer_pool_put(conn->header_block, HEADER_BLOCK_MAX);
+                conn->header_block = NULL;
+                return result;
+            }
+            return 0;
+        case FRAME_RST_STREAM: {
+            h2_stream * stream = find_stream(conn, stream_id);
+            if (stream != NULL) stream->done = 1;
+            return 0;
+        }
+        case FRAME_SETTINGS:
+            if (stream_id != 0) return connection_error(conn, ERROR_PROTOCOL);
+            if (flags & FLAG_ACK) return 0;
+            if (len % 6 != 0) return connection_error(conn, ERROR_FRAME_SIZE);
+            if (handle_settings(conn, payload, len) == -1) return -1;
+            queue_frame(conn, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0, 1);
+            return 0;
+        case FRAME_PUSH_PROMISE:
+            return connection_error(conn, ERROR_PROTOCOL);
+        case FRAME_PING:
+            if (len != 8) return connection_error(conn, ERROR_FRAME_SIZE);
+            if (!(flags & FLAG_ACK)) queue_frame(conn, FRAME_PING, FLAG_ACK, 0, payload, len, 1);
+            return 0;
+        case FRAME_GOAWAY:
+            conn->closing = 1;
+            return 0;
+        case FRAME_WINDOW_UPDATE:
+            return handle_window_update(conn, stream_id, payload, len);
+        default:
+            // PRIORITY and unknown frame types are ignored
+            return 0;
+    }
+}
+
+static int handle_headers(h2_conn * conn, uint8_t flags, uint32_t stream_id, uint8_t * payload, size_t len) {
+    if (stream_id == 0 || stream_id % 2 == 0 || stream_id <= conn->last_stream_id) {
+        return connection_error(conn, ERROR_PROTOCOL);
+    }
+
+    size_t pad_len = 0;
+    if (flags & FLAG_PADDED) {
+        if (len < 1) return connection_error(conn, ERROR_PROTOCOL);
+        pad_len = payload[0];
+        payload++;
+        len--;
+    }
+    if (flags & FLAG_PRIORITY) {
+        if (len < 5) return connection_error(conn, ERROR_PROTOCOL);
+        payload += 5;
+        len -= 5;
+    }
+    if (pad_len > len) return connection_error(conn, ERROR_PROTOCOL);
+    len -= pad_len;
+
+    conn->last_stream_id = stream_id;
+
+    // A complete block is decoded where it lies in the input buffer; only
+    // blocks continued in CONTINUATION frames need to be collected
+    if (flags & FLAG_END_HEADERS) return start_stream(conn, stream_id, payload, len);
+
+    conn->header_block = buffer_pool_get(HEADER_BLOCK_MAX);
+    if (conn->header_block == NULL) return connection_error(conn, ERROR_INTERNAL);
+    memcpy(conn->header_block, payload, len);
+    conn->header_block_len = len;
+    conn->header_stream = stream_id;
+    return 0;
+}
+
+static int handle_settings(h2_conn * conn, const uint8_t * payload, size_t len) {
+    for (size_t i = 0; i + 6 <= len; i += 6) {
+        uint16_t id = (payload[i] << 8) | payload[i + 1];
+        uint32_t value = read_u32(payload + i + 2);
+
+        if (id == SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (value > MAX_WINDOW) return connection_error(conn, ERROR_FLOW_CONTROL);
+            int64_t delta = (int64_t) value - conn->peer_initial_window;
+            for (h2_stream * stream = conn->streams; stream != NULL; stream = stream->next) {
+                stream->window += delta;
+            }
+            conn->peer_initial_window = value;
+        } else if (id == SETTINGS_MAX_FRAME_SIZE) {
+            if (value < HTTP2_MAX_FRAME_SIZE || value > 0xffffff) return connection_error(conn, ERROR_PROTOCOL);
+            conn->peer_max_frame = value;
+        }
+        // Responses never use the peer's dynamic table, so its size is moot
+    }
+    return 0;
+}
+
+static int handle_window_update(h2_conn * conn, uint32_t stream_id, const uint8_t * payload, size_t len) {
+    if (len != 4) return connection_error(conn, ERROR_FRAME_SIZE);
+    uint32_t increment = read_u32(payload) & MAX_WINDOW;
+
+    if (stream_id == 0) {
+        if (increment == 0) return connection_error(conn, ERROR_PROTOCOL);
+        conn->send_window += increment;
+        if (conn->send_window > MAX_WINDOW) return connection_error(conn, ERROR_FLOW_CONTROL);
+        return 0;
+    }
+
+    h2_stream * stream = find_stream(conn, stream_id);
+    if (stream == NULL) return 0;
+
+    stream->window += increment;
+    if (increment == 0 || stream->window > MAX_WINDOW) {
+        queue_rst_stream(conn, stream_id, increment == 0 ? ERROR_PROTOCOL : ERROR_FLOW_CONTROL);
+        stream->done = 1;
+    }
+    return 0;
+}
+
+static int start_stream(h2_conn * conn, uint32_t stream_id, const uint8_t * block, size_t len) {
+    conn->header_stream = 0;
+
+    h2_request_line line = { "", "", "" };
+    if (hpack_decode(&conn->decoder, block, len, collect_request_line, &line) == -1) {
+        return connection_error(conn, ERROR_COMPRESSION);
+    }
+
+    if (conn->closing) return 0;
+
+    if (line.method[0] == '\0' || line.path[0] != '/') {
+        queue_rst_stream(conn, stream_id, ERROR_PROTOCOL);
+        return 0;
+    }
+
+    if (conn->stream_count >= HTTP2_MAX_STREAMS) {
+        queue_rst_stream(conn, stream_id, ERROR_REFUSED_STREAM);
+        return 0;
+    }
+
+    open_stream(conn, stream_id, line.method, line.path, line.authority[0] != '\0' ? line.authority : NULL);
+    return 0;
+}
+
+static int collect_request_line(void * ctx, const hpack_field * field) {
+    h2_request_line * line = ctx;
+
+    if (field->name_len == 7 && memcmp(field->name, ":method", 7) == 0) {
+        if (field->value_len >= METHOD_LEN) return -1;
+        memcpy(line->method, field->value, field->value_len);
+        line->method[field->value_len] = '\0';
+    } else if (field->name_len == 5 && memcmp(field->name, ":path", 5) == 0) {
+        // The query string does not take part in file resolution
+        size_t path_len = 0;
+        while (path_len < field->value_len && field->value[path_len] != '?') path_len++;
+        if (path_len >= MAX_URI_PATH_LEN) path_len = MAX_URI_PATH_LEN - 1;
+        memcpy(line->path, field->value, path_len);
+        line->path[path_len] = '\0';
+    } else if (field->name_len == 10 && memcmp(field->name, ":authority", 10) == 0) {
+        if (field->value_len >= MAX_HEADER_VALUE_LEN) return -1;
+        memcpy(line->authority, field->value, field->value_len);
+        line->authority[field->value_len] = '\0';
+    }
+    return 0;
+}
+
+static void open_stream(h2_conn * conn, uint32_t stream_id, const char * method, const char * path, const char * authority) {
+    h2_stream * stream = calloc(1, sizeof(h2_stream));
+    stream->id = stream_id;
+    stream->window = conn->peer_initial_window;
+
+    http_request request = { 0 };
+    request.method = strcmp(method, "HEAD") == 0 ? METHOD_HEAD : METHOD_GET;
+    request.request_uri = (char *) path;
+    request.http_version = "HTTP/2";
+    request.content_length = -1;
+    // :authority stands in for Host when matching rewrite rules
+    if (authority != NULL) {
+        request.header_fields = sm_create(1);
+        sm_put(request.header_fields, "Host", (char *) authority);
+    }
+
+    if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
+        stream->response = build_response(conn->conf, &request);
+    } else {
+        // Uploads are only supported over HTTP/1.x for now
+        stream->response = build_response(conn->conf, NULL);
+        stream->response->response_code = HTTP_METHOD_NOT_ALLOWED;
+        sm_put(stream->response->header_fields, "Allow", "HEAD, GET");
+    }
+    stream->method = request.method;
+    sm_destroy(request.header_fields);
+
+    map_body(stream);
+    encode_response_headers(conn, stream);
+
+    h2_stream ** tail = &conn->streams;
+    while (*tail != NULL) tail = &(*tail)->next;
+    *tail = stream;
+    conn->stream_count++;
+}
+
+static void map_body(h2_stream * stream) {
+    http_response * response = stream->response;
+    if (stream->method == METHOD_HEAD) return;
+    // A body built in memory is sent from where it is and freed with the response
+    if (response->body != NULL) {
+        stream->body = response->body;
+        stream->body_len = response->body_len;
+        return;
+    }
+    if (response->file == NULL) return;
+    if (response->response_code != HTTP_OK && response->response_code != HTTP_NOT_FOUND) return;
+
+    const struct stat * st = &response->file->st;
+    if (!S_ISREG(st->st_mode)) {
+        response->response_code = HTTP_SERVER_ERROR;
+        return;
+    }
+
+    if (st->st_size > 0) {
+        void * body = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, response->file->fd, 0);
+        if (body == MAP_FAILED) {
+            response->response_code = HTTP_SERVER_ERROR;
+        } else {
+            huge_pages_advise(body, st->st_size);
+            stream->body = body;
+            stream->body_len = st->st_size;
+        }
+    }
+}
+
+static void encode_response_headers(h2_conn * conn, h2_stream * stream) {
+    http_response * response = stream->response;
+    // The block goes out in a single HEADERS frame, so it may take up a
+    // whole frame of the peer's size
+    size_t block_len = conn->peer_max_frame < HEADER_BLOCK_MAX ? conn->peer_max_frame : HEADER_BLOCK_MAX;
+    uint8_t * out = malloc(block_len);
+    if (out == NULL) {
+        conn->failed = 1;
+        return;
+    }
+    stream->header_block = out;
+    size_t len = hpack_encode_status(out, block_len, response->response_code);
+
+    // A body that could not be mapped gets a bare 500
+    if (response->response_code == HTTP_SERVER_ERROR) {
+        stream->header_block_len = len;
+        return;
+    }
+
+    str_map * header_fields = response->header_fields;
+    size_t header_lines = sm_size(header_fields);
+    char ** header_keys = sm_get_keys(header_fields);
+    for (size_t i = 0; i < header_lines; i++) {
+        // Connection-specific fields are not allowed in HTTP/2
+        if (strcasecmp(header_keys[i], "Connection") == 0) continue;
+        if (strcasecmp(header_keys[i], "Transfer-Encoding") == 0) continue;
+        size_t field_len = hpack_encode_field(out + len, block_len - len, header_keys[i], sm_get(header_fields, header_keys[i]));
+        if (field_len == 0) {
+            // A response missing a field, such as the Location of a
+            // redirect, would be wrong, so it becomes a bare 500 instead
+            if (stream->body != NULL && stream->body != response->body) munmap(stream->body, stream->body_len);
+            stream->body = NULL;
+            stream->body_len = 0;
+            response->response_code = HTTP_SERVER_ERROR;
+            stream->header_block_len = hpack_encode_status(out, block_len, HTTP_SERVER_ERROR);
+            return;
+        }
+        len += field_len;
+    }
+    stream->header_block_len = len;
+}
+
+static h2_stream * find_stream(h2_conn * conn, uint32_t stream_id) {
+    for (h2_stream * stream = conn->streams; stream != NULL; stream = stream->next) {
+        if (stream->id == stream_id && !stream->done) return stream;
+    }
+    return NULL;
+}
+
+static int has_sendable(h2_conn * conn) {
+    for (h2_stream * stream = conn->streams; stream != NULL; stream = stream->next) {
+        if (stream->done) continue;
+        if (!stream->headers_sent) return 1;
+        if (stream->body_sent < stream->body_len && stream->window > 0 && conn->send_window > 0) return 1;
+    }
+    return 0;
+}
+
+// Emits one frame per stream per pass so that concurrent responses are
+// interleaved, until every window is exhausted or the budget is spent
+static void schedule_output(h2_conn * conn) {
+    size_t budget = HTTP2_WRITE_BUDGET;
+    int progress = 1;
+
+    while (progress && budget > 0 && !conn->failed) {
+        progress = 0;
+        for (h2_stream * stream = conn->streams; stream != NULL; stream = stream->next) {
+            if (stream->done) continue;
+
+            if (!stream->headers_sent) {
+                int end_stream = stream->body_len == 0;
+                queue_frame(conn, FRAME_HEADERS, FLAG_END_HEADERS | (end_stream ? FLAG_END_STREAM : 0),
+                            stream->id, stream->header_block, stream->header_block_len, 0);
+                stream->headers_sent = 1;
+                stream->done = end_stream;
+                progress = 1;
+                continue;
+            }
+
+            size_t chunk = stream->body_len - stream->body_sent;
+            if (chunk > conn->peer_max_frame) chunk = conn->peer_max_frame;
+            if ((int64_t) chunk > stream->window) chunk = stream->window > 0 ? stream->window : 0;
+            if ((int64_t) chunk > conn->send_window) chunk = conn->send_window > 0 ? conn->send_window : 0;
+            if (chunk > budget) chunk = budget;
+            if (chunk == 0) continue;
+
+            int end_stream = stream->body_sent + chunk == stream->body_len;
+            queue_frame(conn, FRAME_DATA, end_stream ? FLAG_END_STREAM : 0, stream->id, stream->body + stream->body_sent, chunk, 0);
+            stream->body_sent += chunk;
+            stream->window -= chunk;
+            conn->send_window -= chunk;
+            stream->done = end_stream;
+            budget -= chunk;
+            progress = 1;
+        }
+    }
+}
+
+// Only called after a flush, since queued frames may still point into a
+// stream's header block or mapped body until then. Zerocopy sends made so
+// far may reference it too, so it is retired until they complete
+static void reap_streams(h2_conn * conn) {
+    h2_stream ** link = &conn->streams;
+    while (*link != NULL) {
+        h2_stream * stream = *link;
+        if (stream->done) {
+            *link = stream->next;
+            conn->stream_count--;
+            stream->release_after = conn->zerocopy_sent;
+            stream->next = conn->retired_streams;
+            conn->retired_streams = stream;
+        } else {
+            link = &stream->next;
+        }
+    }
+    release_retired(conn);
+}
+
+static void destroy_stream(h2_stream * stream) {
+    if (stream->body != NULL && stream->body != stream->response->body) munmap(stream->body, stream->body_len);
+    http_response_destroy(stream->response);
+    free(stream->header_block);
+    free(stream);
+}
+
+static void queue_frame(h2_conn * conn, uint8_t type, uint8_t flags, uint32_t stream_id, const void * payload, size_t len, int copy) {
+    size_t space_needed = FRAME_HEADER_LEN + (copy ? len : 0);
+    if (conn->writer != NULL && (conn->writer->iovcnt + 2 > HTTP2_WRITER_IOV
+            || conn->writer->space_used + space_needed > WRITER_SPACE)) {
+        flush_writer(conn);
+    }
+
+    // A flush that used MSG_ZEROCOPY retires the writer, so a new one is
+    // taken after it as well
+    if (conn->writer == NULL) {
+        conn->writer = buffer_pool_get(sizeof(h2_writer));
+        if (conn->writer == NULL) {
+            conn->failed = 1;
+            return;
+        }
+        conn->writer->iovcnt = 0;
+        conn->writer->space_used = 0;
+    }
+    h2_writer * writer = conn->writer;
+
+    uint8_t * header = writer->space + writer->space_used;
+    header[0] = (len >> 16) & 0xff;
+    header[1] = (len >> 8) & 0xff;
+    header[2] = len & 0xff;
+    header[3] = type;
+    header[4] = flags;
+    write_u32(header + 5, stream_id);
+
+    if (copy && len > 0) {
+        memcpy(header + FRAME_HEADER_LEN, payload, len);
+        writer->iov[writer->iovcnt].iov_base = header;
+        writer->iov[writer->iovcnt++].iov_len = FRAME_HEADER_LEN + len;
+    } else {
+        writer->iov[writer->iovcnt].iov_base = header;
+        writer->iov[writer->iovcnt++].iov_len = FRAME_HEADER_LEN;
+        if (len > 0) {
+            writer->iov[writer->iovcnt].iov_base = (void *) payload;
+            writer->iov[writer->iovcnt++].iov_len = len;
+        }
+    }
+    writer->space_used += space_needed;
+}
+
+static void queue_window_update(h2_conn * conn, uint32_t stream_id, uint32_t increment) {
+    uint8_t payload[4];
+    write_u32(payload, increment);
+    queue_frame(conn, FRAME_WINDOW_UPDATE, 0, stream_id, payload, sizeof(payload), 1);
+}
+
+static void queue_rst_stream(h2_conn * conn, uint32_t stream_id, uint32_t error) {
+    uint8_t payload[4];
+    write_u32(payload, error);
+    queue_frame(conn, FRAME_RST_STREAM, 0, stream_id, payload, sizeof(payload), 1);
+}
+
+static void queue_goaway(h2_conn * conn, uint32_t error) {
+    uint8_t payload[8];
+    write_u32(payload, conn->last_stream_id);
+    write_u32(payload + 4, error);
+    queue_frame(conn, FRAME_GOAWAY, 0, 0, payload, sizeof(payload), 1);
+    conn->closing = 1;
+}
+
+static void flush_writer(h2_conn * conn) {
+    h2_writer * writer = conn->writer;
+    if (writer == NULL) return;
+    struct iovec * iov = writer->iov;
+    int iovcnt = writer->iovcnt;
+
+    // Pinning pages and reaping the completion costs more than copying
+    // small writes, so only large batches skip the copy
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    int zerocopy = conn->zerocopy && total >= (size_t) conn->conf->zerocopy_threshold;
+    int used_zerocopy = 0;
+
+    while (iovcnt > 0 && !conn->failed) {
+        ssize_t num_written = zerocopy ? send_zerocopy(conn, iov, iovcnt) : tls_writev(conn->cfd, iov, iovcnt);
+        if (num_written < 0 && errno == EINTR) continue;
+        if (num_written < 0 && zerocopy && errno == ENOBUFS) {
+            // Too many completions are outstanding; copy the rest instead
+            zerocopy = 0;
+            continue;
+        }
+        if (num_written >= 0 && zerocopy) used_zerocopy = 1;
+        if (num_written <= 0) {
+            conn->failed = 1;
+            break;
+        }
+
+        while (iovcnt > 0 && (size_t) num_written >= iov->iov_len) {
+            num_written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + num_written;
+            iov->iov_len -= num_written;
+        }
+    }
+
+    writer->iovcnt = 0;
+    writer->space_used = 0;
+
+    // The frame headers in space must stay put until the kernel has sent them
+    if (used_zerocopy) {
+        writer->release_after = conn->zerocopy_sent;
+        writer->next = conn->retired_writers;
+        conn->retired_writers = writer;
+        conn->writer = NULL;
+    }
+}
+
+static ssize_t send_zerocopy(h2_conn * conn, const struct iovec * iov, int iovcnt) {
+    struct msghdr msg = { 0 };
+    msg.msg_iov = (struct iovec *) iov;
+    msg.msg_iovlen = iovcnt;
+    ssize_t num_written = sendmsg(conn->cfd, &msg, MSG_ZEROCOPY);
+    // Every successful call is one notification, numbered from 0
+    if (num_written >= 0) conn->zerocopy_sent++;
+    return num_written;
+}
+
+// Reads every completion waiting on the error queue without blocking
+static void reap_zerocopy(h2_conn * conn) {
+    for (;;) {
+        char control[ZEROCOPY_CONTROL_LEN];
+        struct msghdr msg = { 0 };
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(conn->cfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) break;
+
+        for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) continue;
+
+            struct sock_extended_err * err = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            // ee_info to ee_data is the range of sends that completed
+            if (!zerocopy_complete(conn, err->ee_data + 1)) conn->zerocopy_done = err->ee_data + 1;
+            // The kernel had to copy anyway, e.g. over loopback, so stop
+            // paying for the notifications
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) conn->zerocopy = 0;
+        }
+    }
+    release_retired(conn);
+}
+
+// Waits up to HTTP2_IDLE_TIMEOUT for outstanding zerocopy sends before the
+// connection's buffers are released
+static void wait_zerocopy(h2_conn * conn) {
+    while (conn->zerocopy_done != conn->zerocopy_sent) {
+        struct pollfd pfd = { .fd = conn->cfd, .events = 0 };
+        if (poll(&pfd, 1, HTTP2_IDLE_TIMEOUT) <= 0) break;
+        uint32_t done = conn->zerocopy_done;
+        reap_zerocopy(conn);
+        if (done == conn->zerocopy_done) break;
+    }
+
+    if (conn->zerocopy_done != conn->zerocopy_sent) {
+        // The peer stopped acknowledging; reset the connection on close so
+        // the kernel never sends from buffers that are about to be reused
+        struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(conn->cfd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        conn->zerocopy_done = conn->zerocopy_sent;
+    }
+    release_retired(conn);
+}
+
+static void release_retired(h2_conn * conn) {
+    h2_stream ** stream_link = &conn->retired_streams;
+    while (*stream_link != NULL) {
+        h2_stream * stream = *stream_link;
+        if (zerocopy_complete(conn, stream->release_after)) {
+            *stream_link = stream->next;
+            destroy_stream(stream);
+        } else {
+            stream_link = &stream->next;
+        }
+    }
+
+    h2_writer ** writer_link = &conn->retired_writers;
+    while (*writer_link != NULL) {
+        h2_writer * writer = *writer_link;
+        if (zerocopy_complete(conn, writer->release_after)) {
+            *writer_link = writer->next;
+            buffer_pool_put(writer, sizeof(h2_writer));
+        } else {
+            writer_link = &writer->next;
+        }
+    }
+}
+
+// Whether every zerocopy send numbered below id has completed
+static int zerocopy_complete(h2_conn * conn, uint32_t id) {
+    return (int32_t) (conn->zerocopy_done - id) >= 0;
+}
+
+static int connection_error(h2_conn * conn, uint32_t error) {
+    queue_goaway(conn, error);
+    flush_writer(conn);
+    conn->failed = 1;
+    return -1;
+}
+
+static int attach_input(h2_conn * conn) {
+    if (conn->in != NULL) return 0;
+    conn->in = buffer_pool_get(INPUT_BUFFER);
+    conn->in_len = 0;
+    return conn->in == NULL ? -1 : 0;
+}
+
+// Called before waiting for the client when nothing is left to send
+static void release_idle_buffers(h2_conn * conn) {
+    if (conn->in != NULL && conn->in_len == 0) {
+        buffer_pool_put(conn->in, INPUT_BUFFER);
+        conn->in = NULL;
+    }
+    if (conn->writer != NULL && conn->writer->iovcnt == 0) {
+        buffer_pool_put(conn->writer, sizeof(h2_writer));
+        conn->writer = NULL;
+    }
+}
+
+static size_t decode_base64url(const char * in, uint8_t * out, size_t out_len) {
+    uint32_t bits = 0;
+    int bit_count = 0;
+    size_t len = 0;
+
+    for (; *in != '\0' && len < out_len; in++) {
+        int value;
+        char c = *in;
+        if (c >= 'A' && c <= 'Z') value = c - 'A';
+        else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') value = c - '0' + 52;
+        else if (c == '-' || c == '+') value = 62;
+        else if (c == '_' || c == '/') value = 63;
+        else break;
+
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            out[len++] = (bits >> bit_count) & 0xff;
+        }
+    }
+    return len;
+}
+
+static uint32_t read_u32(const uint8_t * p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static void write_u32(uint8_t * p, uint32_t value) {
+    p[0] = (value >> 24) & 0xff;
+    p[1] = (value >> 16) & 0xff;
+    p[2] = (value >> 8) & 0xff;
+    p[3] = value & 0xff;
+}
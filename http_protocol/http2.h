@@ -0,0 +1,39 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "config.h"
+#include "http.h"
+
+#include <stddef.h>
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+#define HTTP2_MAX_FRAME_SIZE 16384
+#define HTTP2_MAX_STREAMS 100
+#define HTTP2_DEFAULT_WINDOW 65535
+#define HTTP2_IDLE_TIMEOUT 5000
+#define HTTP2_WRITER_IOV 64
+#define HTTP2_WRITE_BUDGET 262144
+
+/**
+ * Returns whether data starts with the HTTP/2 connection preface, meaning
+ * the client is speaking h2c with prior knowledge.
+ */
+int http2_is_preface(const char * data, size_t len);
+
+/**
+ * Returns whether request asks to upgrade a cleartext HTTP/1.1 connection to
+ * h2c with an Upgrade header and HTTP2-Settings.
+ */
+int http2_is_upgrade(http_request * request);
+
+/**
+ * Serves an HTTP/2 connection on cfd until the client goes away or stays idle
+ * for HTTP2_IDLE_TIMEOUT milliseconds. initial holds any bytes of the
+ * connection already read by the caller. If upgrade is not NULL it is the
+ * HTTP/1.1 request that asked for h2c: 101 Switching Protocols is sent and
+ * the request is answered as stream 1.
+ */
+void http2_serve(config * conf, int cfd, const char * initial, size_t initial_len, http_request * upgrade);
+
+#endif
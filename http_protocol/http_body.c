@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include "http_body.h"
+#include "tls.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BODY_SIZE 0
+#define BODY_SIZE_EXT 1
+#define BODY_DATA 2
+#define BODY_DATA_END 3
+#define BODY_TRAILER 4
+#define BODY_DONE 5
+#define BODY_ERROR 6
+
+static ssize_t fill_pending(http_body_reader * reader);
+static size_t decode(http_body_reader * reader, size_t max_data, const char ** data, size_t * data_len);
+static void finish_data(http_body_reader * reader, size_t len);
+static int hex_value(char c);
+static ssize_t write_all(int fd, const char * data, size_t len);
+static ssize_t splice_all(int in_fd, int pipe_fds[2], int out_fd, size_t len);
+static ssize_t discard_sink(void * ctx, const char * data, size_t len);
+
+int http_body_reader_init(http_body_reader * reader, http_request * request, int cfd) {
+    memset(reader, 0, sizeof(http_body_reader));
+    reader->cfd = cfd;
+    reader->pending = request->request_body;
+    reader->pending_len = request->request_body_len;
+
+    if (request->is_chunked) {
+        reader->chunked = 1;
+        reader->state = BODY_SIZE;
+        return 0;
+    }
+
+    if (request->content_length < 0) {
+        reader->state = BODY_ERROR;
+        return -1;
+    }
+
+    reader->remaining = request->content_length;
+    reader->state = reader->remaining == 0 ? BODY_DONE : BODY_DATA;
+    return 0;
+}
+
+ssize_t http_body_read(http_body_reader * reader, char * buf, size_t len) {
+    while (reader->state != BODY_DONE) {
+        if (reader->state == BODY_ERROR) return -1;
+
+        if (reader->pending_len > 0) {
+            const char * data;
+            size_t data_len;
+            decode(reader, len, &data, &data_len);
+            if (data_len > 0) {
+                memcpy(buf, data, data_len);
+                return data_len;
+            }
+            continue;
+        }
+
+        // Payload bytes go straight into the caller's buffer
+        if (reader->state == BODY_DATA) {
+            size_t want = len < reader->remaining ? len : reader->remaining;
+            ssize_t num_read = tls_read(reader->cfd, buf, want);
+            if (num_read <= 0) {
+                reader->state = BODY_ERROR;
+                return -1;
+            }
+            finish_data(reader, num_read);
+            return num_read;
+        }
+
+        if (fill_pending(reader) <= 0) return -1;
+    }
+    return 0;
+}
+
+ssize_t http_body_stream(http_body_reader * reader, http_body_sink sink, void * ctx) {
+    ssize_t total = 0;
+    while (reader->state != BODY_DONE) {
+        if (reader->state == BODY_ERROR) return -1;
+
+        if (reader->pending_len == 0 && fill_pending(reader) <= 0) return -1;
+
+        const char * data;
+        size_t data_len;
+        decode(reader, SIZE_MAX, &data, &data_len);
+        if (data_len > 0) {
+            if (sink(ctx, data, data_len) < 0) return -1;
+            total += data_len;
+        }
+    }
+    return total;
+}
+
+ssize_t http_body_splice(http_body_reader * reader, int out_fd) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) return -1;
+
+    ssize_t total = 0;
+    while (reader->state != BODY_DONE && reader->state != BODY_ERROR) {
+        if (reader->pending_len > 0) {
+            const char * data;
+            size_t data_len;
+            decode(reader, SIZE_MAX, &data, &data_len);
+            if (data_len > 0 && write_all(out_fd, data, data_len) < 0) {
+                reader->state = BODY_ERROR;
+            }
+            total += data_len;
+            continue;
+        }
+
+        // Splicing needs the kernel to hand over plaintext
+        if (reader->state == BODY_DATA && tls_kernel_recv(reader->cfd)) {
+            ssize_t moved = splice_all(reader->cfd, pipe_fds, out_fd, reader->remaining);
+            if (moved <= 0) {
+                reader->state = BODY_ERROR;
+                break;
+            }
+            finish_data(reader, moved);
+            total += moved;
+            continue;
+        }
+
+        if (fill_pending(reader) <= 0) break;
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return reader->state == BODY_DONE ? total : -1;
+}
+
+int http_body_discard(http_body_reader * reader) {
+    return http_body_stream(reader, discard_sink, NULL) < 0 ? -1 : 0;
+}
+
+static ssize_t discard_sink(void * ctx, const char * data, size_t len) {
+    (void) ctx;
+    (void) data;
+    return len;
+}
+
+static ssize_t fill_pending(http_body_reader * reader) {
+    size_t want = HTTP_BODY_BUFFER;
+    if (!reader->chunked && reader->remaining < want) want = reader->remaining;
+
+    ssize_t num_read = tls_read(reader->cfd, reader->buf, want);
+    if (num_read <= 0) {
+        reader->state = BODY_ERROR;
+        return -1;
+    }
+    reader->pending = reader->buf;
+    reader->pending_len = num_read;
+    return num_read;
+}
+
+// Consumes pending bytes until a span of at most max_data payload bytes is
+// found or the pending bytes run out. Returns the number of bytes consumed.
+static size_t decode(http_body_reader * reader, size_t max_data, const char ** data, size_t * data_len) {
+    const char * in = reader->pending;
+    size_t in_len = reader->pending_len;
+    size_t pos = 0;
+
+    *data = NULL;
+    *data_len = 0;
+
+    while (pos < in_len && *data_len == 0) {
+        char c = in[pos];
+        switch (reader->state) {
+            case BODY_SIZE: {
+                int digit = hex_value(c);
+                if (digit >= 0) {
+                    if (reader->remaining > (SIZE_MAX >> 4)) {
+                        reader->state = BODY_ERROR;
+                        break;
+                    }
+                    reader->remaining = (reader->remaining << 4) | digit;
+                } else if (c == ';') {
+                    reader->state = BODY_SIZE_EXT;
+                } else if (c == '\n') {
+                    reader->state = reader->remaining == 0 ? BODY_TRAILER : BODY_DATA;
+                } else if (c != '\r' && c != ' ' && c != '\t') {
+                    reader->state = BODY_ERROR;
+                }
+                pos++;
+                break;
+            }
+            case BODY_SIZE_EXT:
+                if (c == '\n') reader->state = reader->remaining == 0 ? BODY_TRAILER : BODY_DATA;
+                pos++;
+                break;
+            case BODY_DATA: {
+                size_t span = in_len - pos;
+                if (span > reader->remaining) span = reader->remaining;
+                if (span > max_data) span = max_data;
+                *data = in + pos;
+                *data_len = span;
+                pos += span;
+                finish_data(reader, span);
+                break;
+            }
+            case BODY_DATA_END:
+                if (c == '\n') {
+                    reader->state = BODY_SIZE;
+                } else if (c != '\r') {
+                    reader->state = BODY_ERROR;
+                }
+                pos++;
+                break;
+            case BODY_TRAILER:
+                // remaining counts the length of the current trailer line
+                if (c == '\n') {
+                    if (reader->remaining == 0) reader->state = BODY_DONE;
+                    reader->remaining = 0;
+                } else if (c != '\r') {
+                    reader->remaining++;
+                }
+                pos++;
+                break;
+            default:
+                pos = in_len;
+                break;
+        }
+    }
+
+    reader->pending += pos;
+    reader->pending_len -= pos;
+    return pos;
+}
+
+static void finish_data(http_body_reader * reader, size_t len) {
+    reader->remaining -= len;
+    reader->total += len;
+    if (reader->remaining == 0) {
+        reader->state = reader->chunked ? BODY_DATA_END : BODY_DONE;
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static ssize_t write_all(int fd, const char * data, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t num_written = write(fd, data + written, len - written);
+        if (num_written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        written += num_written;
+    }
+    return written;
+}
+
+// Moves up to len bytes from in_fd to out_fd through the pipe without
+// copying them into user space.
+static ssize_t splice_all(int in_fd, int pipe_fds[2], int out_fd, size_t len) {
+    size_t want = len < HTTP_SPLICE_LEN ? len : HTTP_SPLICE_LEN;
+    ssize_t in_pipe = splice(in_fd, NULL, pipe_fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in_pipe <= 0) return -1;
+
+    ssize_t drained = 0;
+    while (drained < in_pipe) {
+        ssize_t moved = splice(pipe_fds[0], NULL, out_fd, NULL, in_pipe - drained, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved <= 0) return -1;
+        drained += moved;
+    }
+    return drained;
+}
@@ -0,0 +1,67 @@
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include "http.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define HTTP_BODY_BUFFER 4096
+#define HTTP_SPLICE_LEN 65536
+
+/**
+ * Receives a slice of a decoded request body. Returns the number of bytes
+ * consumed or -1 to abort the transfer.
+ */
+typedef ssize_t (*http_body_sink)(void * ctx, const char * data, size_t len);
+
+/**
+ * Incremental reader for a request body framed by Content-Length or by
+ * chunked transfer-encoding. Only HTTP_BODY_BUFFER bytes are ever held in
+ * memory regardless of the size of the body.
+ */
+typedef struct {
+    int cfd;
+    int chunked;
+    int state;
+    size_t remaining;
+    size_t total;
+    const char * pending;
+    size_t pending_len;
+    char buf[HTTP_BODY_BUFFER];
+} http_body_reader;
+
+/**
+ * Prepares reader to decode the body of request from the socket cfd. Any body
+ * bytes already read along with the header are consumed first.
+ * Returns 0 on success or -1 if the request has no usable body framing.
+ */
+int http_body_reader_init(http_body_reader * reader, http_request * request, int cfd);
+
+/**
+ * Reads up to len decoded body bytes into buf. Returns the number of bytes
+ * read, 0 once the body is complete, or -1 on a malformed body or socket error.
+ */
+ssize_t http_body_read(http_body_reader * reader, char * buf, size_t len);
+
+/**
+ * Passes the remaining body to sink one slice at a time. Returns the number
+ * of bytes streamed or -1 on error.
+ */
+ssize_t http_body_stream(http_body_reader * reader, http_body_sink sink, void * ctx);
+
+/**
+ * Moves the remaining body into out_fd. Payload bytes are spliced from the
+ * socket through a pipe so they never pass through user space; only chunk
+ * framing is read into the reader's buffer. Returns the number of bytes
+ * written or -1 on error.
+ */
+ssize_t http_body_splice(http_body_reader * reader, int out_fd);
+
+/**
+ * Reads and discards the remaining body so the response is not lost to a
+ * connection reset. Returns 0 on success or -1 on error.
+ */
+int http_body_discard(http_body_reader * reader);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef HTTP_MODULE_H
+#define HTTP_MODULE_H
+
+/*
+ * The interface between the server and handler modules. A module is a shared
+ * object that defines
+ *
+ *     const http_module http_module_exports = { HTTP_MODULE_ABI, ... };
+ *
+ * and is built against this header alone, for example with
+ * cc -shared -fPIC -o hello.so hello.c. Modules are listed in the modules
+ * setting and run inside the workers, so a handler must be thread-safe and
+ * must not block for long.
+ */
+
+#include <stddef.h>
+
+#define HTTP_MODULE_ABI 1
+#define HTTP_MODULE_SYMBOL "http_module_exports"
+
+#define HTTP_MODULE_HEAD 1
+#define HTTP_MODULE_GET 2
+#define HTTP_MODULE_POST 3
+#define HTTP_MODULE_PUT 4
+
+/**
+ * Bytes owned by the server. A view is not NUL-terminated and is only valid
+ * until the handler returns.
+ */
+typedef struct {
+    const char * data;
+    size_t len;
+} http_module_view;
+
+/**
+ * A parameter segment of the route, such as id in "/users/:id", and what it
+ * matched.
+ */
+typedef struct {
+    http_module_view name;
+    http_module_view value;
+} http_module_param;
+
+/**
+ * The request a handler is called for. Every view points into the request as
+ * it was read from the client. body holds the part of the body that arrived
+ * with the header, which is all of it when body_complete is set.
+ */
+typedef struct {
+    int method;
+    http_module_view path;
+    http_module_view query;
+    const http_module_param * params;
+    size_t param_count;
+    http_module_view body;
+    int body_complete;
+    const void * internal;
+} http_module_request;
+
+/**
+ * The response a handler fills in, opaque to modules.
+ */
+typedef struct http_module_response http_module_response;
+
+/**
+ * What the server offers handlers. get_header matches name
+ * case-insensitively and returns a view with NULL data if the request has no
+ * such field; over HTTP/2 only Host is available. set_status defaults to 200,
+ * and a code that is not three digits answers with 500. The server sets
+ * Content-Length itself. set_header and write return -1 if out of memory.
+ */
+typedef struct {
+    int abi;
+    http_module_view (*get_header)(const http_module_request * request, const char * name);
+    void (*set_status)(http_module_response * response, int status);
+    int (*set_header)(http_module_response * response, const char * name, const char * value);
+    int (*write)(http_module_response * response, const void * data, size_t len);
+} http_module_api;
+
+/**
+ * Handles a request. Returning -1 discards whatever was written and answers
+ * with 500.
+ */
+typedef int (*http_module_handler)(const http_module_api * api, const http_module_request * request, http_module_response * response, void * arg);
+
+/**
+ * A route of the module, with a pattern as described for router_add.
+ */
+typedef struct {
+    int method;
+    const char * pattern;
+    http_module_handler handler;
+    void * arg;
+} http_module_route;
+
+/**
+ * What a module exports. load, if set, is called when the module is loaded in
+ * a process and a nonzero return refuses the load. unload, if set, is called
+ * once no handler of the module is running, before it is unloaded.
+ */
+typedef struct {
+    int abi;
+    const char * name;
+    const http_module_route * routes;
+    size_t route_count;
+    int (*load)(void);
+    void (*unload)(void);
+} http_module;
+
+#endif
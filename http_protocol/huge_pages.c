@@ -0,0 +1,50 @@
+#define _GNU_SOURCE
+#include "huge_pages.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+static int use_huge_pages;
+
+static void * map_aligned(size_t size);
+
+void huge_pages_init(int enabled) {
+    use_huge_pages = enabled;
+}
+
+void * huge_pages_map(size_t size, size_t * mapped_len) {
+    if (!use_huge_pages) {
+        void * addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) return NULL;
+        *mapped_len = size;
+        return addr;
+    }
+
+    size = (size + HUGE_PAGE_SIZE - 1) & ~((size_t) HUGE_PAGE_SIZE - 1);
+    void * addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr == MAP_FAILED) {
+        addr = map_aligned(size);
+        if (addr == NULL) return NULL;
+        madvise(addr, size, MADV_HUGEPAGE);
+    }
+    *mapped_len = size;
+    return addr;
+}
+
+void huge_pages_advise(void * addr, size_t len) {
+    if (use_huge_pages) madvise(addr, len, MADV_HUGEPAGE);
+}
+
+// Transparent huge pages can only back 2 MB aligned ranges, so a larger
+// region is mapped and the unaligned ends are given back
+static void * map_aligned(size_t size) {
+    size_t len = size + HUGE_PAGE_SIZE;
+    char * region = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+
+    char * aligned = (char *) (((uintptr_t) region + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+    if (aligned > region) munmap(region, aligned - region);
+    size_t tail = region + len - (aligned + size);
+    if (tail > 0) munmap(aligned + size, tail);
+    return aligned;
+}
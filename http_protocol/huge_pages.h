@@ -0,0 +1,31 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <stddef.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Turns huge page backing on or off for the rest of the process and the
+ * workers it forks. Must be called before any memory is mapped through
+ * huge_pages_map.
+ */
+void huge_pages_init(int enabled);
+
+/**
+ * Maps size bytes of private anonymous memory and stores the usable length
+ * in mapped_len. With huge pages enabled size is rounded up to whole 2 MB
+ * pages taken from the hugetlb pool with MAP_HUGETLB; when the pool is empty
+ * the memory is aligned to 2 MB and madvised so transparent huge pages can
+ * back it instead. Returns NULL if nothing could be mapped.
+ */
+void * huge_pages_map(size_t size, size_t * mapped_len);
+
+/**
+ * Asks for transparent huge pages on an existing mapping, such as a file
+ * mapped to serve its contents, when huge pages are enabled. Filesystems
+ * that can't back files with huge pages ignore it.
+ */
+void huge_pages_advise(void * addr, size_t len);
+
+#endif
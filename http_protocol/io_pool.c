@@ -0,0 +1,127 @@
+#include "io_pool.h"
+
+#include <pthread.h>
+
+typedef struct {
+    io_pool_task task;
+    void * arg;
+    size_t rank;
+    unsigned long seq;
+} io_job;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t available = PTHREAD_COND_INITIALIZER;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+// A binary min-heap ordered by rank, then by submission
+static io_job heap[IO_POOL_MAX_QUEUED];
+static int queued;
+static unsigned long next_seq;
+static int threads_started;
+
+static int job_before(const io_job * a, const io_job * b);
+static void heap_push(io_job job);
+static io_job heap_pop(void);
+static int start_threads(void);
+static void * io_loop(void * arg);
+static void register_fork_handlers(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+int io_pool_submit(io_pool_task task, void * arg) {
+    return io_pool_submit_ranked(task, arg, 0);
+}
+
+int io_pool_submit_ranked(io_pool_task task, void * arg, size_t rank) {
+    pthread_once(&fork_once, register_fork_handlers);
+
+    pthread_mutex_lock(&lock);
+    if (queued >= IO_POOL_MAX_QUEUED || (!threads_started && start_threads() == -1)) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    io_job job = { task, arg, rank, next_seq++ };
+    heap_push(job);
+
+    pthread_cond_signal(&available);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+static int job_before(const io_job * a, const io_job * b) {
+    if (a->rank != b->rank) return a->rank < b->rank;
+    return (long) (a->seq - b->seq) < 0;
+}
+
+static void heap_push(io_job job) {
+    int i = queued++;
+    while (i > 0 && job_before(&job, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = job;
+}
+
+static io_job heap_pop(void) {
+    io_job top = heap[0];
+    io_job last = heap[--queued];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= queued) break;
+        if (child + 1 < queued && job_before(&heap[child + 1], &heap[child])) child++;
+        if (!job_before(&heap[child], &last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+// Called with lock held
+static int start_threads(void) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < IO_POOL_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, io_loop, NULL) == 0) threads_started++;
+    }
+    pthread_attr_destroy(&attr);
+    return threads_started > 0 ? 0 : -1;
+}
+
+static void * io_loop(void * arg) {
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (queued == 0) pthread_cond_wait(&available, &lock);
+        io_job job = heap_pop();
+        pthread_mutex_unlock(&lock);
+
+        job.task(job.arg);
+    }
+    return NULL;
+}
+
+static void register_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void fork_prepare(void) {
+    pthread_mutex_lock(&lock);
+}
+
+static void fork_parent(void) {
+    pthread_mutex_unlock(&lock);
+}
+
+// The I/O threads don't survive fork and queued jobs belong to the parent,
+// so the child starts with an empty pool
+static void fork_child(void) {
+    queued = 0;
+    threads_started = 0;
+    pthread_cond_init(&available, NULL);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,32 @@
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <stddef.h>
+
+#define IO_POOL_THREADS 4
+#define IO_POOL_MAX_QUEUED 1024
+
+/**
+ * Work handed to the I/O pool. It owns arg and must free it.
+ */
+typedef void (*io_pool_task)(void * arg);
+
+/**
+ * Queues task to run on one of IO_POOL_THREADS threads that do nothing but
+ * blocking file I/O, so a slow disk read never holds up a request worker.
+ * The threads are started on the first submit in each process, including
+ * forked workers. Returns 0 if the task was queued or -1 if
+ * IO_POOL_MAX_QUEUED tasks are already waiting or no thread could be
+ * started, in which case the caller still owns arg.
+ */
+int io_pool_submit(io_pool_task task, void * arg);
+
+/**
+ * Queues task like io_pool_submit, but ahead of every task with a larger
+ * rank. Tasks of equal rank run in the order they were submitted, and
+ * io_pool_submit uses rank 0. Passing the bytes a transfer has left as rank
+ * approximates shortest-remaining-processing-time scheduling.
+ */
+int io_pool_submit_ranked(io_pool_task task, void * arg, size_t rank);
+
+#endif
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+
+#include "ip_acl.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define SLOTS (1 << IP_ACL_STRIDE)
+
+typedef struct {
+    uint8_t addr[16];
+    uint8_t len;
+    uint8_t action;
+    uint32_t order;
+} acl_rule;
+
+typedef struct {
+    acl_rule * rules;
+    size_t count;
+    size_t capacity;
+} rule_list;
+
+// Uncompressed node used while building: every slot has its action and
+// the index of its child, 0 meaning none since the root is never a child
+typedef struct {
+    uint8_t leaf[SLOTS];
+    uint32_t child[SLOTS];
+} build_node;
+
+typedef struct {
+    build_node * nodes;
+    size_t count;
+    size_t capacity;
+} builder;
+
+static struct {
+    char * path;
+    ip_acl * acl;
+    struct timespec mtime;
+    off_t size;
+    ino_t ino;
+    time_t checked;
+} current;
+
+/**
+ * Parses one line of an access list file into rule. Blank and comment lines
+ * return 0 with family set to AF_UNSPEC.
+ * @param line
+ * @param rule
+ * @param family
+ * @return 0 on success, -1 if the line is malformed
+ */
+static int parse_rule(char * line, acl_rule * rule, int * family);
+/**
+ * Appends rule to list, growing it as needed.
+ * @param list
+ * @param rule
+ * @return 0 on success, -1 if out of memory
+ */
+static int add_rule(rule_list * list, const acl_rule * rule);
+/**
+ * Orders rules by prefix length, then by their line in the file.
+ * @param a
+ * @param b
+ * @return comparison result
+ */
+static int compare_rules(const void * a, const void * b);
+/**
+ * Builds the trie of the rules of one family, whose addresses are addr_len
+ * bytes long.
+ * @param trie
+ * @param list
+ * @param addr_len
+ * @return 0 on success, -1 if out of memory
+ */
+static int build_trie(ip_acl_trie * trie, rule_list * list, size_t addr_len);
+/**
+ * Adds a node whose slots all carry action to the builder.
+ * @param b
+ * @param action
+ * @return index of the node or 0 if out of memory
+ */
+static uint32_t new_node(builder * b, uint8_t action);
+/**
+ * Expands rule into the slots it covers.
+ * @param b
+ * @param rule
+ * @param addr_len
+ * @return 0 on success, -1 if out of memory
+ */
+static int insert_rule(builder * b, const acl_rule * rule, size_t addr_len);
+/**
+ * Compresses the built nodes into trie, laying the children of each node
+ * out consecutively in breadth first order.
+ * @param trie
+ * @param b
+ * @return 0 on success, -1 if out of memory
+ */
+static int compress(ip_acl_trie * trie, const builder * b);
+/**
+ * Looks up the action for addr in trie.
+ * @param trie
+ * @param addr
+ * @param addr_len
+ * @return IP_ACL_NONE, IP_ACL_ALLOW or IP_ACL_DENY
+ */
+static int trie_lookup(const ip_acl_trie * trie, const uint8_t * addr, size_t addr_len);
+/**
+ * Returns the IP_ACL_STRIDE bits of addr starting at bit off, reading bits
+ * past the end of addr as zero.
+ * @param addr
+ * @param addr_len
+ * @param off
+ * @return slot index
+ */
+static unsigned chunk(const uint8_t * addr, size_t addr_len, unsigned off);
+/**
+ * Recompiles the cached rules if path changed or the file was modified.
+ * @param path
+ */
+static void refresh(const char * path);
+
+ip_acl * ip_acl_compile(const char * path) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL)
+        return NULL;
+
+    rule_list v4 = {0};
+    rule_list v6 = {0};
+    char line[IP_ACL_MAX_LINE];
+    uint32_t line_no = 0;
+    int failed = 0;
+    while (!failed && fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        acl_rule rule;
+        int family;
+        if (parse_rule(line, &rule, &family) == -1) {
+            fprintf(stderr, "%s:%u - invalid access rule\n", path, line_no);
+            continue;
+        }
+        rule.order = line_no;
+        if (family == AF_INET)
+            failed = add_rule(&v4, &rule) == -1;
+        else if (family == AF_INET6)
+            failed = add_rule(&v6, &rule) == -1;
+    }
+    fclose(file);
+
+    ip_acl * acl = calloc(1, sizeof(ip_acl));
+    if (!failed && acl != NULL) {
+        acl->rules = v4.count + v6.count;
+        failed = build_trie(&acl->v4, &v4, 4) == -1 || build_trie(&acl->v6, &v6, 16) == -1;
+    }
+    free(v4.rules);
+    free(v6.rules);
+    if (failed || acl == NULL) {
+        ip_acl_destroy(acl);
+        return NULL;
+    }
+    return acl;
+}
+
+void ip_acl_destroy(ip_acl * acl) {
+    if (acl == NULL)
+        return;
+    free(acl->v4.nodes);
+    free(acl->v4.leaves);
+    free(acl->v6.nodes);
+    free(acl->v6.leaves);
+    free(acl);
+}
+
+int ip_acl_allows(const ip_acl * acl, const struct sockaddr * addr) {
+    int action = IP_ACL_NONE;
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in * in = (const struct sockaddr_in *) addr;
+        action = trie_lookup(&acl->v4, (const uint8_t *) &in->sin_addr, 4);
+    } else if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 * in6 = (const struct sockaddr_in6 *) addr;
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+            action = trie_lookup(&acl->v4, in6->sin6_addr.s6_addr + 12, 4);
+        else
+            action = trie_lookup(&acl->v6, in6->sin6_addr.s6_addr, 16);
+    }
+    return action != IP_ACL_DENY;
+}
+
+int ip_acl_check(const char * path, const struct sockaddr * addr) {
+    if (path == NULL)
+        return 1;
+    time_t now = time(NULL);
+    if (current.path == NULL || now != current.checked || strcmp(path, current.path) != 0) {
+        refresh(path);
+        current.checked = now;
+    }
+    return current.acl == NULL || ip_acl_allows(current.acl, addr);
+}
+
+static void refresh(const char * path) {
+    struct stat st;
+    if (stat(path, &st) == -1)
+        return;
+    if (current.path != NULL && strcmp(path, current.path) == 0 && st.st_ino == current.ino && st.st_size == current.size
+            && st.st_mtim.tv_sec == current.mtime.tv_sec && st.st_mtim.tv_nsec == current.mtime.tv_nsec)
+        return;
+
+    ip_acl * acl = ip_acl_compile(path);
+    if (acl == NULL)
+        return;
+    ip_acl_destroy(current.acl);
+    free(current.path);
+    current.acl = acl;
+    current.path = strdup(path);
+    current.ino = st.st_ino;
+    current.size = st.st_size;
+    current.mtime = st.st_mtim;
+}
+
+static int parse_rule(char * line, acl_rule * rule, int * family) {
+    *family = AF_UNSPEC;
+    char * comment = strchr(line, '#');
+    if (comment != NULL)
+        *comment = '\0';
+
+    char * save;
+    char * action = strtok_r(line, " \t\r\n", &save);
+    if (action == NULL)
+        return 0;
+    char * cidr = strtok_r(NULL, " \t\r\n", &save);
+    if (cidr == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL)
+        return -1;
+
+    memset(rule, 0, sizeof(*rule));
+    if (strcasecmp(action, "allow") == 0)
+        rule->action = IP_ACL_ALLOW;
+    else if (strcasecmp(action, "deny") == 0)
+        rule->action = IP_ACL_DENY;
+    else
+        return -1;
+
+    char * slash = strchr(cidr, '/');
+    if (slash != NULL)
+        *slash = '\0';
+    int max_len;
+    if (inet_pton(AF_INET, cidr, rule->addr) == 1) {
+        *family = AF_INET;
+        max_len = 32;
+    } else if (inet_pton(AF_INET6, cidr, rule->addr) == 1) {
+        *family = AF_INET6;
+        max_len = 128;
+    } else {
+        return -1;
+    }
+
+    long len = max_len;
+    if (slash != NULL) {
+        char * end;
+        len = strtol(slash + 1, &end, 10);
+        if (slash[1] == '\0' || *end != '\0' || len < 0 || len > max_len) {
+            *family = AF_UNSPEC;
+            return -1;
+        }
+    }
+    rule->len = (uint8_t) len;
+    return 0;
+}
+
+static int add_rule(rule_list * list, const acl_rule * rule) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 64 : list->capacity * 2;
+        acl_rule * rules = realloc(list->rules, capacity * sizeof(acl_rule));
+        if (rules == NULL)
+            return -1;
+        list->rules = rules;
+        list->capacity = capacity;
+    }
+    list->rules[list->count++] = *rule;
+    return 0;
+}
+
+static int compare_rules(const void * a, const void * b) {
+    const acl_rule * x = a;
+    const acl_rule * y = b;
+    if (x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int build_trie(ip_acl_trie * trie, rule_list * list, size_t addr_len) {
+    // Shorter prefixes go first so longer ones overwrite the slots they share
+    if (list->count > 0)
+        qsort(list->rules, list->count, sizeof(acl_rule), compare_rules);
+
+    builder b = {0};
+    int result = -1;
+    b.capacity = 1;
+    b.nodes = malloc(sizeof(build_node));
+    if (b.nodes == NULL)
+        return -1;
+    memset(b.nodes, 0, sizeof(build_node));
+    b.count = 1;
+
+    size_t i;
+    for (i = 0; i < list->count; i++) {
+        if (insert_rule(&b, &list->rules[i], addr_len) == -1)
+            break;
+    }
+    if (i == list->count)
+        result = compress(trie, &b);
+    free(b.nodes);
+    return result;
+}
+
+static uint32_t new_node(builder * b, uint8_t action) {
+    if (b->count == b->capacity) {
+        size_t capacity = b->capacity * 2;
+        build_node * nodes = realloc(b->nodes, capacity * sizeof(build_node));
+        if (nodes == NULL)
+            return 0;
+        b->nodes = nodes;
+        b->capacity = capacity;
+    }
+    build_node * node = &b->nodes[b->count];
+    memset(node->leaf, action, sizeof(node->leaf));
+    memset(node->child, 0, sizeof(node->child));
+    return (uint32_t) b->count++;
+}
+
+static int insert_rule(builder * b, const acl_rule * rule, size_t addr_len) {
+    uint32_t node = 0;
+    unsigned off = 0;
+    while (rule->len > off + IP_ACL_STRIDE) {
+        unsigned slot = chunk(rule->addr, addr_len, off);
+        if (b->nodes[node].child[slot] == 0) {
+            // The new child inherits whatever shorter prefix covered its slot
+            uint32_t child = new_node(b, b->nodes[node].leaf[slot]);
+            if (child == 0)
+                return -1;
+            b->nodes[node].child[slot] = child;
+        }
+        node = b->nodes[node].child[slot];
+        off += IP_ACL_STRIDE;
+    }
+
+    // No slot in range has a child yet, since children only exist below
+    // longer prefixes and those are inserted later
+    unsigned free_bits = IP_ACL_STRIDE - (rule->len - off);
+    unsigned first = chunk(rule->addr, addr_len, off) & ~((1u << free_bits) - 1);
+    memset(b->nodes[node].leaf + first, rule->action, 1u << free_bits);
+    return 0;
+}
+
+static int compress(ip_acl_trie * trie, const builder * b) {
+    uint32_t * order = malloc(b->count * sizeof(uint32_t));
+    ip_acl_node * nodes = calloc(b->count, sizeof(ip_acl_node));
+    size_t leaves_capacity = b->count * 2;
+    uint8_t * leaves = malloc(leaves_capacity);
+    if (order == NULL || nodes == NULL || leaves == NULL) {
+        free(order);
+        free(nodes);
+        free(leaves);
+        return -1;
+    }
+
+    size_t leaf_count = 0;
+    size_t tail = 1;
+    order[0] = 0;
+    for (size_t head = 0; head < tail; head++) {
+        const build_node * in = &b->nodes[order[head]];
+        ip_acl_node * out = &nodes[head];
+        out->base1 = (uint32_t) tail;
+        out->base0 = (uint32_t) leaf_count;
+        int previous = -1;
+        for (unsigned slot = 0; slot < SLOTS; slot++) {
+            if (in->child[slot] != 0) {
+                out->vector |= 1ULL << slot;
+                order[tail++] = in->child[slot];
+                continue;
+            }
+            if (in->leaf[slot] == previous)
+                continue;
+            if (leaf_count == leaves_capacity) {
+                leaves_capacity *= 2;
+                uint8_t * grown = realloc(leaves, leaves_capacity);
+                if (grown == NULL) {
+                    free(order);
+                    free(nodes);
+                    free(leaves);
+                    return -1;
+                }
+                leaves = grown;
+            }
+            out->leafvec |= 1ULL << slot;
+            leaves[leaf_count++] = in->leaf[slot];
+            previous = in->leaf[slot];
+        }
+    }
+    free(order);
+
+    uint8_t * trimmed = realloc(leaves, leaf_count > 0 ? leaf_count : 1);
+    trie->nodes = nodes;
+    trie->leaves = trimmed != NULL ? trimmed : leaves;
+    return 0;
+}
+
+static int trie_lookup(const ip_acl_trie * trie, const uint8_t * addr, size_t addr_len) {
+    const ip_acl_node * node = trie->nodes;
+    for (unsigned off = 0;; off += IP_ACL_STRIDE) {
+        unsigned slot = chunk(addr, addr_len, off);
+        uint64_t below = (2ULL << slot) - 1;
+        if (node->vector >> slot & 1) {
+            node = &trie->nodes[node->base1 + __builtin_popcountll(node->vector & below) - 1];
+            continue;
+        }
+        return trie->leaves[node->base0 + __builtin_popcountll(node->leafvec & below) - 1];
+    }
+}
+
+static unsigned chunk(const uint8_t * addr, size_t addr_len, unsigned off) {
+    unsigned byte = off / 8;
+    unsigned high = byte < addr_len ? addr[byte] : 0;
+    unsigned low = byte + 1 < addr_len ? addr[byte + 1] : 0;
+    return ((high << 8 | low) >> (10 - off % 8)) & (SLOTS - 1);
+}
@@ -0,0 +1,76 @@
+#ifndef IP_ACL_H
+#define IP_ACL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define IP_ACL_NONE 0
+#define IP_ACL_ALLOW 1
+#define IP_ACL_DENY 2
+#define IP_ACL_STRIDE 6
+#define IP_ACL_MAX_LINE 256
+
+/**
+ * A node of a compiled trie, which consumes IP_ACL_STRIDE bits of the
+ * address. vector has a bit for every one of the 64 slots that leads to a
+ * child node, and the children are stored consecutively from base1, so the
+ * child of a slot is found by counting the bits set below it. leafvec has a
+ * bit where a run of equal actions starts among the other slots, and the
+ * runs' actions are stored consecutively from base0.
+ */
+typedef struct {
+    uint64_t vector;
+    uint64_t leafvec;
+    uint32_t base0;
+    uint32_t base1;
+} ip_acl_node;
+
+/**
+ * A poptrie of the rules of one address family. nodes[0] is the root.
+ */
+typedef struct {
+    ip_acl_node * nodes;
+    uint8_t * leaves;
+} ip_acl_trie;
+
+/**
+ * The compiled rules of an access list file, one trie per address family.
+ */
+typedef struct {
+    ip_acl_trie v4;
+    ip_acl_trie v6;
+    size_t rules;
+} ip_acl;
+
+/**
+ * Compiles the rules in the file at path. Every line holds 'allow' or 'deny'
+ * followed by an IPv4 or IPv6 address with an optional /prefix length, and
+ * '#' starts a comment. The rule with the longest prefix matching a client
+ * decides, the last one winning if a prefix is listed twice, and clients no
+ * rule matches are allowed. Lines that cannot be parsed are reported and
+ * skipped. Returns NULL if the file could not be read.
+ */
+ip_acl * ip_acl_compile(const char * path);
+
+/**
+ * Frees acl.
+ */
+void ip_acl_destroy(ip_acl * acl);
+
+/**
+ * Returns whether acl allows the client at addr, an AF_INET or AF_INET6
+ * address. IPv4-mapped IPv6 addresses are matched against the IPv4 rules.
+ */
+int ip_acl_allows(const ip_acl * acl, const struct sockaddr * addr);
+
+/**
+ * Returns whether the rules in the file at path allow the client at addr,
+ * or 1 if path is NULL. The compiled rules are kept and the file is checked
+ * for changes at most once a second, recompiling it when it changed. If it
+ * can no longer be read the previous rules stay in force. Not thread safe,
+ * it is meant for the accepting thread.
+ */
+int ip_acl_check(const char * path, const struct sockaddr * addr);
+
+#endif
@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+
+#include "modules.h"
+#include "http_module.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MODULE_BODY_CAPACITY 4096
+
+_Static_assert(HTTP_MODULE_HEAD == METHOD_HEAD && HTTP_MODULE_GET == METHOD_GET
+        && HTTP_MODULE_POST == METHOD_POST && HTTP_MODULE_PUT == METHOD_PUT,
+        "module methods must match the server's");
+
+typedef struct {
+    http_module_handler handler;
+    void * arg;
+} module_route;
+
+typedef struct {
+    char * path;
+    struct stat st;
+    void * handle;
+    int copy_fd;
+    const http_module * exports;
+} module;
+
+struct module_set {
+    char * list;
+    module * modules;
+    size_t count;
+    module_route * routes;
+    router * router;
+    atomic_uint refs;
+};
+
+struct http_module_response {
+    http_response * response;
+    size_t capacity;
+    int status;
+};
+
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+static module_set * current;
+static time_t checked;
+
+/**
+ * Returns whether list or any of the files of set changed since set was
+ * loaded.
+ * @param set
+ * @param list
+ * @return whether set is out of date
+ */
+static int is_stale(const module_set * set, const char * list);
+/**
+ * Loads every module listed in list and adds their routes to a new set.
+ * @param list
+ * @return the set or NULL if out of memory
+ */
+static module_set * load_set(const char * list);
+/**
+ * Loads the module at mod->path from a private copy of the file. dlopen
+ * hands back the object it already has for a path, so loading the file
+ * itself would keep serving the old code of a rebuilt module.
+ * @param mod
+ * @return 0 on success, -1 if the module could not be loaded
+ */
+static int load_module(module * mod);
+/**
+ * Unloads the modules of set and frees it.
+ * @param set
+ */
+static void destroy_set(module_set * set);
+/**
+ * Calls the module handler the request was routed to, matching http_handler.
+ * @param conf
+ * @param request
+ * @param response
+ * @param match
+ */
+static void call_handler(config * conf, http_request * request, http_response * response, const router_match * match);
+static http_module_view get_header(const http_module_request * request, const char * name);
+static void set_status(http_module_response * out, int status);
+static int set_header(http_module_response * out, const char * name, const char * value);
+static int write_body(http_module_response * out, const void * data, size_t len);
+static void register_fork_handlers(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+static const http_module_api api = {
+    HTTP_MODULE_ABI,
+    get_header,
+    set_status,
+    set_header,
+    write_body
+};
+
+module_set * modules_acquire(const char * list) {
+    if (list != NULL && list[0] == '\0')
+        list = NULL;
+    pthread_once(&fork_once, register_fork_handlers);
+
+    time_t now = time(NULL);
+    pthread_rwlock_rdlock(&lock);
+    if (checked != now || (current == NULL) != (list == NULL) || (list != NULL && strcmp(current->list, list) != 0)) {
+        pthread_rwlock_unlock(&lock);
+        pthread_rwlock_wrlock(&lock);
+        if (checked != now || (current == NULL) != (list == NULL) || (list != NULL && strcmp(current->list, list) != 0)) {
+            if (current != NULL && (list == NULL || is_stale(current, list))) {
+                modules_release(current);
+                current = NULL;
+            }
+            if (current == NULL && list != NULL)
+                current = load_set(list);
+            checked = now;
+        }
+        pthread_rwlock_unlock(&lock);
+        pthread_rwlock_rdlock(&lock);
+    }
+    module_set * set = current;
+    if (set != NULL)
+        atomic_fetch_add(&set->refs, 1);
+    pthread_rwlock_unlock(&lock);
+    return set;
+}
+
+void modules_release(module_set * set) {
+    if (set != NULL && atomic_fetch_sub(&set->refs, 1) == 1)
+        destroy_set(set);
+}
+
+const router * modules_routes(const module_set * set) {
+    return set->router;
+}
+
+static int is_stale(const module_set * set, const char * list) {
+    if (strcmp(set->list, list) != 0)
+        return 1;
+    for (size_t i = 0; i < set->count; i++) {
+        struct stat st;
+        if (stat(set->modules[i].path, &st) == -1)
+            memset(&st, 0, sizeof(st));
+        const struct stat * old = &set->modules[i].st;
+        if (st.st_ino != old->st_ino || st.st_size != old->st_size
+                || st.st_mtim.tv_sec != old->st_mtim.tv_sec || st.st_mtim.tv_nsec != old->st_mtim.tv_nsec)
+            return 1;
+    }
+    return 0;
+}
+
+static module_set * load_set(const char * list) {
+    module_set * set = calloc(1, sizeof(module_set));
+    if (set == NULL)
+        return NULL;
+    atomic_init(&set->refs, 1);
+    set->list = strdup(list);
+    set->router = router_create();
+    size_t capacity = 1;
+    for (const char * c = list; *c != '\0'; c++) capacity += *c == ':';
+    set->modules = calloc(capacity, sizeof(module));
+    if (set->list == NULL || set->router == NULL || set->modules == NULL) {
+        destroy_set(set);
+        return NULL;
+    }
+
+    char * paths = strdup(list);
+    char * save;
+    size_t route_count = 0;
+    for (char * path = strtok_r(paths, ":", &save); path != NULL; path = strtok_r(NULL, ":", &save)) {
+        module * mod = &set->modules[set->count++];
+        mod->path = strdup(path);
+        mod->copy_fd = -1;
+        if (stat(path, &mod->st) == -1) {
+            perror(path);
+            continue;
+        }
+        if (load_module(mod) == -1) {
+            const char * error = dlerror();
+            fprintf(stderr, "%s - could not load module%s%s\n", path, error != NULL ? ": " : "", error != NULL ? error : "");
+            continue;
+        }
+        route_count += mod->exports->route_count;
+    }
+    free(paths);
+
+    set->routes = calloc(route_count, sizeof(module_route));
+    size_t next = 0;
+    for (size_t i = 0; i < set->count && set->routes != NULL; i++) {
+        const http_module * exports = set->modules[i].exports;
+        if (exports == NULL)
+            continue;
+        for (size_t r = 0; r < exports->route_count; r++) {
+            const http_module_route * route = &exports->routes[r];
+            module_route * target = &set->routes[next++];
+            target->handler = route->handler;
+            target->arg = route->arg;
+            if (route->method < METHOD_HEAD || route->method > METHOD_PUT
+                    || router_add(set->router, route->method, route->pattern, call_handler, target) == -1)
+                fprintf(stderr, "%s - invalid or duplicate route %s\n", set->modules[i].path, route->pattern);
+        }
+    }
+    return set;
+}
+
+static int load_module(module * mod) {
+    int fd = open(mod->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    // The copy stays open while the module is loaded, which also keeps the
+    // name it is loaded under unique
+    mod->copy_fd = memfd_create("http_module", MFD_CLOEXEC);
+    off_t offset = 0;
+    while (mod->copy_fd != -1 && offset < mod->st.st_size) {
+        if (sendfile(mod->copy_fd, fd, &offset, mod->st.st_size - offset) <= 0)
+            break;
+    }
+    close(fd);
+    if (mod->copy_fd == -1 || offset < mod->st.st_size)
+        return -1;
+
+    char name[32];
+    snprintf(name, sizeof(name), "/proc/self/fd/%d", mod->copy_fd);
+    mod->handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    if (mod->handle == NULL)
+        return -1;
+
+    const http_module * exports = dlsym(mod->handle, HTTP_MODULE_SYMBOL);
+    if (exports == NULL || exports->abi != HTTP_MODULE_ABI || (exports->load != NULL && exports->load() != 0))
+        return -1;
+    mod->exports = exports;
+    return 0;
+}
+
+static void destroy_set(module_set * set) {
+    for (size_t i = 0; i < set->count; i++) {
+        module * mod = &set->modules[i];
+        if (mod->exports != NULL && mod->exports->unload != NULL)
+            mod->exports->unload();
+        if (mod->handle != NULL)
+            dlclose(mod->handle);
+        if (mod->copy_fd != -1)
+            close(mod->copy_fd);
+        free(mod->path);
+    }
+    router_destroy(set->router);
+    free(set->modules);
+    free(set->routes);
+    free(set->list);
+    free(set);
+}
+
+static void call_handler(config * conf, http_request * request, http_response * response, const router_match * match) {
+    (void) conf;
+    const module_route * route = match->arg;
+
+    http_module_param params[ROUTER_MAX_PARAMS];
+    for (size_t i = 0; i < match->param_count; i++) {
+        params[i].name.data = match->params[i].name;
+        params[i].name.len = match->params[i].name_len;
+        params[i].value.data = match->params[i].value;
+        params[i].value.len = match->params[i].value_len;
+    }
+
+    http_module_request view = { 0 };
+    view.method = request->method;
+    view.path.data = match->path;
+    view.path.len = strcspn(match->path, "?");
+    if (match->path[view.path.len] == '?') {
+        view.query.data = match->path + view.path.len + 1;
+        view.query.len = strlen(view.query.data);
+    }
+    view.params = params;
+    view.param_count = match->param_count;
+    view.body.data = request->request_body;
+    view.body.len = request->request_body_len;
+    if (request->content_length >= 0 && (long long) view.body.len > request->content_length)
+        view.body.len = request->content_length;
+    view.body_complete = !request->is_chunked
+            && (request->content_length < 0 || (long long) view.body.len == request->content_length);
+    view.internal = request;
+
+    struct http_module_response out = { response, 0, HTTP_OK };
+    if (route->handler(&api, &view, &out, route->arg) == -1) {
+        free(response->body);
+        response->body = NULL;
+        response->body_len = 0;
+        out.status = HTTP_SERVER_ERROR;
+    }
+
+    // A status line needs three digits
+    response->response_code = out.status >= 100 && out.status <= 999 ? out.status : HTTP_SERVER_ERROR;
+    char size_buffer[21];
+    snprintf(size_buffer, sizeof(size_buffer), "%zu", response->body_len);
+    sm_put(response->header_fields, "Content-Length", size_buffer);
+}
+
+static http_module_view get_header(const http_module_request * request, const char * name) {
+    const http_request * internal = request->internal;
+    http_module_view view = { NULL, 0 };
+    if (internal->header_fields == NULL)
+        return view;
+    view.data = http_get_header(internal->header_fields, name);
+    view.len = view.data != NULL ? strlen(view.data) : 0;
+    return view;
+}
+
+static void set_status(http_module_response * out, int status) {
+    out->status = status;
+}
+
+static int set_header(http_module_response * out, const char * name, const char * value) {
+    sm_put(out->response->header_fields, (char *) name, (char *) value);
+    return 0;
+}
+
+static int write_body(http_module_response * out, const void * data, size_t len) {
+    http_response * response = out->response;
+    if (response->body_len + len > out->capacity) {
+        size_t capacity = out->capacity == 0 ? MODULE_BODY_CAPACITY : out->capacity;
+        while (capacity < response->body_len + len) capacity *= 2;
+        char * body = realloc(response->body, capacity);
+        if (body == NULL)
+            return -1;
+        response->body = body;
+        out->capacity = capacity;
+    }
+    memcpy(response->body + response->body_len, data, len);
+    response->body_len += len;
+    return 0;
+}
+
+static void register_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void fork_prepare(void) {
+    pthread_rwlock_wrlock(&lock);
+}
+
+static void fork_parent(void) {
+    pthread_rwlock_unlock(&lock);
+}
+
+static void fork_child(void) {
+    pthread_rwlock_unlock(&lock);
+}
@@ -0,0 +1,34 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include "router.h"
+
+/**
+ * The handler modules loaded from one modules setting, with the routes they
+ * export. A set stays loaded while any request holds it.
+ */
+typedef struct module_set module_set;
+
+/**
+ * Returns the modules listed in list, a ':' separated list of shared objects
+ * built against http_module.h, and holds them until modules_release. Returns
+ * NULL if list is NULL or empty. The modules are loaded once per process and
+ * their files are checked for changes at most once a second, loading them
+ * anew when list or any file changed. Requests still running on the old
+ * modules finish on them before they are unloaded. Modules that cannot be
+ * loaded are reported and left out.
+ */
+module_set * modules_acquire(const char * list);
+
+/**
+ * Lets go of set, unloading its modules if they were replaced and no other
+ * request holds them. Does nothing if set is NULL.
+ */
+void modules_release(module_set * set);
+
+/**
+ * Returns the routes the modules of set export.
+ */
+const router * modules_routes(const module_set * set);
+
+#endif
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+#include "numa_node.h"
+
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#define NODE_PATH "/sys/devices/system/node"
+#define LIST_LEN 4096
+#define MASK_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+static int read_node_cpus(int node, cpu_set_t * cpus);
+static int find_node(int index);
+static int read_list(const char * path, char * buf, size_t len);
+static int parse_list(const char * list, cpu_set_t * set, unsigned long * mask, int max);
+
+int numa_node_count(void) {
+    int count = 0;
+    while (find_node(count) != -1) count++;
+    return count > 0 ? count : 1;
+}
+
+int numa_node_bind(int index) {
+    int node = find_node(index);
+    if (node == -1) return -1;
+
+    cpu_set_t cpus;
+    if (read_node_cpus(node, &cpus) == -1 || sched_setaffinity(0, sizeof(cpus), &cpus) == -1) return -1;
+
+    // Prefer rather than bind so allocations still succeed when the node is full
+    unsigned long nodes[NUMA_MAX_NODES / MASK_BITS] = {0};
+    nodes[node / MASK_BITS] |= 1UL << (node % MASK_BITS);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, NUMA_MAX_NODES + 1) == -1) return -1;
+
+    return 0;
+}
+
+int numa_cpu_nodes(int * nodes, int max_cpus) {
+    int cpu_count = 0;
+    for (int cpu = 0; cpu < max_cpus; cpu++) nodes[cpu] = -1;
+
+    int node;
+    for (int index = 0; (node = find_node(index)) != -1; index++) {
+        cpu_set_t cpus;
+        if (read_node_cpus(node, &cpus) == -1) continue;
+        for (int cpu = 0; cpu < max_cpus && cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &cpus)) continue;
+            nodes[cpu] = index;
+            if (cpu >= cpu_count) cpu_count = cpu + 1;
+        }
+    }
+    return cpu_count;
+}
+
+static int read_node_cpus(int node, cpu_set_t * cpus) {
+    char path[PATH_MAX];
+    char list[LIST_LEN];
+    snprintf(path, sizeof(path), NODE_PATH "/node%d/cpulist", node);
+    if (read_list(path, list, sizeof(list)) == -1) return -1;
+
+    CPU_ZERO(cpus);
+    return parse_list(list, cpus, NULL, CPU_SETSIZE) == -1 ? -1 : 0;
+}
+
+// Returns the id of the index-th online node that has CPUs, or -1
+static int find_node(int index) {
+    char list[LIST_LEN];
+    unsigned long online[NUMA_MAX_NODES / MASK_BITS] = {0};
+    if (read_list(NODE_PATH "/has_cpu", list, sizeof(list)) == -1) return -1;
+    if (parse_list(list, NULL, online, NUMA_MAX_NODES) == -1) return -1;
+
+    for (int node = 0; node < NUMA_MAX_NODES; node++) {
+        if (!(online[node / MASK_BITS] & (1UL << (node % MASK_BITS)))) continue;
+        if (index-- == 0) return node;
+    }
+    return -1;
+}
+
+static int read_list(const char * path, char * buf, size_t len) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL) return -1;
+    char * line = fgets(buf, (int) len, file);
+    fclose(file);
+    return line == NULL ? -1 : 0;
+}
+
+// Parses a sysfs list such as "0-3,8-11" into set or mask, whichever is
+// given. Returns the lowest entry or -1 if the list is empty
+static int parse_list(const char * list, cpu_set_t * set, unsigned long * mask, int max) {
+    int lowest = -1;
+    const char * pos = list;
+
+    while (*pos >= '0' && *pos <= '9') {
+        char * end;
+        long first = strtol(pos, &end, 10);
+        long last = first;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+
+        for (long i = first; i <= last && i < max; i++) {
+            if (set != NULL) CPU_SET(i, set);
+            if (mask != NULL) mask[i / MASK_BITS] |= 1UL << (i % MASK_BITS);
+        }
+        if (lowest == -1 || first < lowest) lowest = (int) first;
+
+        pos = *end == ',' ? end + 1 : end;
+    }
+    return lowest;
+}
@@ -0,0 +1,30 @@
+#ifndef NUMA_NODE_H
+#define NUMA_NODE_H
+
+#define NUMA_MAX_NODES 1024
+#define NUMA_MAX_CPUS 4096
+
+/**
+ * Returns the number of NUMA nodes that have CPUs, read from sysfs. Returns 1
+ * when the topology is not available so callers can treat the machine as a
+ * single node.
+ */
+int numa_node_count(void);
+
+/**
+ * Pins the calling process, and every thread or process it creates after
+ * this, to the CPUs of the index-th node that has CPUs, and makes its memory
+ * allocations prefer that node. Returns 0 on success or -1 if the node does
+ * not exist or could not be bound.
+ */
+int numa_node_bind(int index);
+
+/**
+ * Fills nodes[cpu] with the index of the node each CPU belongs to, as
+ * counted by numa_node_count, or -1 for CPUs that are not present. Returns
+ * one more than the highest CPU found, at most max_cpus, or 0 when the
+ * topology is not available.
+ */
+int numa_cpu_nodes(int * nodes, int max_cpus);
+
+#endif
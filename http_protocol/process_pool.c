@@ -1,130 +1,214 @@
 #include "./process_pool.h"
+#include "./codel.h"
 
-#define SEM_WORKER_READY "/worker_ready"
-#define SEM_WORKER_BINDED "/worker_binded"
-#define SEM_WAKE_WORKER "/wale_worker"
-#define SOCKET_PATH "/tmp/fd-pass.socket"
-#define SHMEM_HAME "/sharedmem"
-#define DC_S_IRUSR 0400
-#define DC_S_IWUSR 0200
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+_Static_assert(NUM_PROCESSES <= 64, "idle_workers has one bit per worker");
+
+typedef struct {
+    config * conf;
+    int cfd;
+} batch_client;
 
 /**
- * Creates and listens to a domain socket for with the path of SOCKET_PATH.
- * @return socket_fd
+ * Waits to receive a msg containing the client fds over the passed
+ * in socket. Once the msg is received it stores them in client_fds and
+ * the times their requests arrived in enqueued_at.
+ * @param socked_fd
+ * @param client_fds
+ * @param enqueued_at
+ * @return number of client fds received
  */
-static int worker_bind();
+static int worker_receive(int socked_fd, int * client_fds, long long * enqueued_at);
 /**
- * Waits to receive a msg containing the client fd over the passed
- * in socket. Once the msg is received it returns the client fd.
- * @param socked_fd
- * @return client fd
+ * Feeds the time each client waited to the worker's CoDel state, sheds every
+ * client it decides to drop and moves the rest to the front of client_fds.
+ * @param state
+ * @param client_fds
+ * @param count
+ * @param enqueued_at
+ * @return number of clients left to serve
+ */
+static int shed_clients(codel * state, int * client_fds, int count, const long long * enqueued_at);
+/**
+ * Handles every client of a batch, the first on the calling thread and the
+ * rest on their own threads, and returns once all of them are done.
+ * @param conf
+ * @param client_fds
+ * @param count
+ */
+static void worker_handle_batch(config * conf, const int * client_fds, int count);
+/**
+ * Thread entry point that handles the client described by a batch_client.
+ * @param arg
+ * @return NULL
  */
-static int worker_receive();
+static void * worker_handle_client(void * arg);
 /**
- * The loop uses semaphores to post that a worker is ready for work then waits until a worker process
- * should be woken. Once woken the worker will exit if mode is not set to process else it binds to a socket
- * then posts that the server can send the client's fd.  It uses worker receive to get the client fd then
- * handles the http request.
+ * The loop marks the worker idle and posts ready_count then waits on its wake counter until the
+ * parent picks it. Once woken the worker will exit if mode is not set to process else it uses
+ * worker receive to get the client fds from its socket then handles the http requests.
  * @param pool
+ * @param index
+ */
+static void worker_loop(process_pool * pool, int index);
+/**
+ * Takes an idle worker off the idle_workers bitmap. Must only be called
+ * after a successful futex_sem_wait on ready_count, which guarantees a bit
+ * is set.
+ * @param mem
+ * @return worker index
+ */
+static int claim_idle_worker(memory * mem);
+/**
+ * Blocks until the counter is above zero, then decrements it.
+ * @param counter
+ */
+static void futex_sem_wait(atomic_uint * counter);
+/**
+ * Increments the counter and wakes one waiter.
+ * @param counter
  */
-static void worker_loop(process_pool * pool);
+static void futex_sem_post(atomic_uint * counter);
 /**
- * Creates and connects to a domain socket at SOCKET_PATH. once connected
- * it sends the client fd to a worker process listening to the socket.
- * @param http_client_fd
+ * Wraps the futex syscall on a word that may be shared between processes.
+ * @param word
+ * @param op
+ * @param value
+ * @return syscall result
  */
-static void send_socket(int http_client_fd);
+static long futex(atomic_uint * word, int op, unsigned int value);
 /**
- * Creates the required semaphores for managing the process pool.
- * @return semaphores
+ * Sends the client fds over the socket shared with a worker process, along
+ * with the times their requests arrived.
+ * @param process_sfd
+ * @param http_client_fds
+ * @param count
+ * @param enqueued_at
  */
-static semaphores * create_semaphores();
+static void send_socket(int process_sfd, const int * http_client_fds, int count, const long long * enqueued_at);
 
 process_pool * process_pool_create(config *cfg) {
     process_pool * pool = calloc(1, sizeof(process_pool));
-    pool->sem = create_semaphores();
     pool->cfg = cfg;
-    memory *ptr;
-    int shared_mem_fd = dc_shm_open(SHMEM_HAME, O_CREAT | O_RDWR, 0666);
-    ftruncate(shared_mem_fd, sizeof(memory));
-    ptr = mmap(0, sizeof(memory), PROT_WRITE|PROT_READ, MAP_SHARED, shared_mem_fd, 0);
-    pool->mem = ptr;
+    // Anonymous and created before fork, so only this pool's workers share it
+    pool->mem = mmap(NULL, sizeof(memory), PROT_WRITE|PROT_READ, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    for(int i = 0; i < NUM_PROCESSES; i++){
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1){
+            perror("socketpair()");
+            exit(EXIT_FAILURE);
+        }
+        pool->sockets[i] = sv[0];
+        pool->worker_sockets[i] = sv[1];
+    }
     return pool;
 }
 
 void process_pool_start(process_pool * pool) {
-    pool->mem->is_running = true;
+    atomic_store(&pool->mem->is_running, true);
     for(int i = 0; i < NUM_PROCESSES; i++){
         int pid = fork();
         if(pid == -1){
             exit(EXIT_FAILURE);
         }
         if(pid == 0){
-            worker_loop(pool);
+            for(int j = 0; j < NUM_PROCESSES; j++){
+                close(pool->sockets[j]);
+                if(j != i)
+                    close(pool->worker_sockets[j]);
+            }
+            worker_loop(pool, i);
             exit(EXIT_FAILURE);
         }
     }
+    for(int i = 0; i < NUM_PROCESSES; i++)
+        close(pool->worker_sockets[i]);
 }
 
 void process_pool_stop(process_pool * pool) {
-    pool->mem->is_running = false;
-    for(int i = 0; i < NUM_PROCESSES; i++)
-        dc_sem_post(pool->sem->wake_worker);
+    atomic_store(&pool->mem->is_running, false);
+    for(int i = 0; i < NUM_PROCESSES; i++) {
+        atomic_fetch_add(&pool->mem->wake[i], 1);
+        futex(&pool->mem->wake[i], FUTEX_WAKE, 1);
+    }
 }
 
 void process_pool_notify(process_pool * pool, int http_client_fd) {
-    semaphores * sem = pool->sem;
-    dc_sem_wait(sem->worker_ready);
-    dc_sem_post(sem->wake_worker);
-    dc_sem_wait(sem->worker_binded);
-    send_socket(http_client_fd);
-    dc_close(http_client_fd);
+    process_pool_notify_batch(pool, &http_client_fd, 1);
+}
+
+void process_pool_notify_batch(process_pool * pool, const int * http_client_fds, int count) {
+    memory * mem = pool->mem;
+    long long enqueued_at[PROCESS_POOL_BATCH];
+    for (int i = 0; i < count; i++)
+        enqueued_at[i] = codel_arrival(http_client_fds[i]);
+    futex_sem_wait(&mem->ready_count);
+    int worker = claim_idle_worker(mem);
+    send_socket(pool->sockets[worker], http_client_fds, count, enqueued_at);
+    atomic_fetch_add(&mem->wake[worker], 1);
+    futex(&mem->wake[worker], FUTEX_WAKE, 1);
+    for (int i = 0; i < count; i++)
+        dc_close(http_client_fds[i]);
 }
 
 void process_pool_destroy(process_pool * pool) {
+    for(int i = 0; i < NUM_PROCESSES; i++)
+        close(pool->sockets[i]);
+    munmap(pool->mem, sizeof(memory));
     free(pool);
 }
 
-static semaphores * create_semaphores() {
-    semaphores * sem = calloc(1, sizeof(semaphores));
-    sem_unlink(SEM_WORKER_READY);
-    sem_unlink(SEM_WORKER_BINDED);
-    sem_unlink(SEM_WAKE_WORKER);
-    sem->worker_ready = dc_sem_open(SEM_WORKER_READY, O_CREAT, DC_S_IRUSR|DC_S_IWUSR, 0);
-    sem->worker_binded = dc_sem_open(SEM_WORKER_BINDED, O_CREAT, DC_S_IRUSR|DC_S_IWUSR, 0);
-    sem->wake_worker = dc_sem_open(SEM_WAKE_WORKER, O_CREAT, DC_S_IRUSR|DC_S_IWUSR, 0);
-    return sem;
+static int claim_idle_worker(memory * mem) {
+    uint64_t idle = atomic_load(&mem->idle_workers);
+    for (;;) {
+        uint64_t worker = idle & -idle;
+        if (atomic_compare_exchange_weak(&mem->idle_workers, &idle, idle & ~worker))
+            return __builtin_ctzll(worker);
+    }
+}
+
+static void futex_sem_wait(atomic_uint * counter) {
+    for (;;) {
+        unsigned int value = atomic_load(counter);
+        if (value > 0) {
+            if (atomic_compare_exchange_weak(counter, &value, value - 1))
+                return;
+            continue;
+        }
+        futex(counter, FUTEX_WAIT, 0);
+    }
 }
 
+static void futex_sem_post(atomic_uint * counter) {
+    atomic_fetch_add(counter, 1);
+    futex(counter, FUTEX_WAKE, 1);
+}
 
-static void send_socket(int http_client_fd) {
-    struct sockaddr_un process_address;
-    int process_sfd;
-        
-    process_sfd = dc_socket(AF_UNIX, SOCK_STREAM, 0);
-    memset(&process_address, 0, sizeof(struct sockaddr_un));
-    process_address.sun_family = AF_UNIX;
-    strcpy(process_address.sun_path, SOCKET_PATH);
-    dc_connect(process_sfd, (struct sockaddr *) &process_address, sizeof(struct sockaddr_un));
+// Not FUTEX_PRIVATE_FLAG: the words live in memory shared between processes
+static long futex(atomic_uint * word, int op, unsigned int value) {
+    return syscall(SYS_futex, word, op, value, NULL, NULL, 0);
+}
 
+static void send_socket(int process_sfd, const int * http_client_fds, int count, const long long * enqueued_at) {
     struct msghdr msg = {0};
     struct cmsghdr *cmsg;
-    char buf[CMSG_SPACE(sizeof(int))], *dup = "hello world";
+    char buf[CMSG_SPACE(sizeof(int) * PROCESS_POOL_BATCH)];
     memset(buf, '\0', sizeof(buf));
-    struct iovec io = { .iov_base = &dup, .iov_len = sizeof(dup) };
+    struct iovec io = { .iov_base = (void *) enqueued_at, .iov_len = sizeof(*enqueued_at) * count };
 
     msg.msg_iov = &io;
     msg.msg_iovlen = 1;
     msg.msg_control = buf;
-    msg.msg_controllen = sizeof (buf);
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
 
     cmsg = CMSG_FIRSTHDR(&msg);
     cmsg->cmsg_level = SOL_SOCKET;
     cmsg->cmsg_type = SCM_RIGHTS;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
 
-    int *fdptr = (int *)CMSG_DATA(cmsg);
-    *fdptr = http_client_fd;
+    memcpy(CMSG_DATA(cmsg), http_client_fds, sizeof(int) * count);
 
     if (sendmsg(process_sfd, &msg, 0) == -1){
         perror("sendmsg()");
@@ -132,12 +216,12 @@ static void send_socket(int http_client_fd) {
     }
 }
 
-static int worker_receive(int socked_fd) {
+static int worker_receive(int socked_fd, int * client_fds, long long * enqueued_at) {
     struct msghdr msg = {0};
     struct cmsghdr *cmsg;
-    char buf[CMSG_SPACE(sizeof(int))], dup[256];
+    char buf[CMSG_SPACE(sizeof(int) * PROCESS_POOL_BATCH)];
     memset(buf, '\0', sizeof(buf));
-    struct iovec io = { .iov_base = &dup, .iov_len = sizeof(dup) };
+    struct iovec io = { .iov_base = enqueued_at, .iov_len = sizeof(*enqueued_at) * PROCESS_POOL_BATCH };
 
     msg.msg_iov = &io;
     msg.msg_iovlen = 1;
@@ -150,50 +234,75 @@ static int worker_receive(int socked_fd) {
     }
     
     cmsg = CMSG_FIRSTHDR(&msg);
-    int *fdptr = (int *)CMSG_DATA(cmsg);
-    return *fdptr;
-}
-
-static int worker_bind() {
-    struct sockaddr_un addr;
-
-    int socket_fd = dc_socket(AF_UNIX, SOCK_STREAM, 0);
-
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+        return 0;
 
-    unlink(SOCKET_PATH);
-        
-    memset(&addr, 0, sizeof(struct sockaddr_un));
-    addr.sun_family = AF_UNIX;
-        
-    strncpy(addr.sun_path, SOCKET_PATH, sizeof(addr.sun_path) - 1);
-        
-    dc_bind(socket_fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un));
-
-    dc_listen(socket_fd, 5);
-    
-    return socket_fd;
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(client_fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    return count;
 }
 
-static void worker_loop(process_pool * pool) {
-    semaphores * sem = pool->sem;
+static void worker_loop(process_pool * pool, int index) {
+    memory * mem = pool->mem;
+    // Each worker has its own socket and so its own queue to control
+    codel state = {0};
     for (;;) {
-        dc_sem_post(sem->worker_ready);
-        dc_sem_wait(sem->wake_worker);
-        if(!pool->mem->is_running) {
+        unsigned int wake = atomic_load(&mem->wake[index]);
+        atomic_fetch_or(&mem->idle_workers, (uint64_t) 1 << index);
+        futex_sem_post(&mem->ready_count);
+        while (atomic_load(&mem->wake[index]) == wake && atomic_load(&mem->is_running))
+            futex(&mem->wake[index], FUTEX_WAIT, wake);
+        if(!atomic_load(&mem->is_running)) {
             exit(EXIT_SUCCESS);
         } 
-        int worker_fd = worker_bind();
-        dc_sem_post(sem->worker_binded);
-
-        int main_process_fd = dc_accept(worker_fd, NULL, NULL);
-        int http_client_fd = worker_receive(main_process_fd);
+        int http_client_fds[PROCESS_POOL_BATCH];
+        long long enqueued_at[PROCESS_POOL_BATCH];
+        int count = worker_receive(pool->worker_sockets[index], http_client_fds, enqueued_at);
+        count = shed_clients(&state, http_client_fds, count, enqueued_at);
+        if (count == 0)
+            continue;
 
         config * conf = get_config(pool->cfg);
-        http_handle_client(conf, http_client_fd);
+        worker_handle_batch(conf, http_client_fds, count);
         destroy_config(conf);
+    }
+}
 
-        close(worker_fd);
-        close(main_process_fd);
-        close(http_client_fd);
+static int shed_clients(codel * state, int * client_fds, int count, const long long * enqueued_at) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (codel_should_shed(state, enqueued_at[i]))
+            http_reject_client(client_fds[i], HTTP_SERVICE_UNAVAILABLE);
+        else
+            client_fds[kept++] = client_fds[i];
     }
+    return kept;
+}
+
+static void worker_handle_batch(config * conf, const int * client_fds, int count) {
+    pthread_t threads[PROCESS_POOL_BATCH];
+    batch_client clients[PROCESS_POOL_BATCH];
+    bool started[PROCESS_POOL_BATCH] = {false};
+
+    for (int i = 0; i < count; i++) {
+        clients[i].conf = conf;
+        clients[i].cfd = client_fds[i];
+    }
+    for (int i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, worker_handle_client, &clients[i]) == 0;
+        if (!started[i])
+            worker_handle_client(&clients[i]);
+    }
+    if (count > 0)
+        worker_handle_client(&clients[0]);
+    for (int i = 1; i < count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+}
+
+static void * worker_handle_client(void * arg) {
+    batch_client * client = arg;
+    http_handle_client(client->conf, client->cfd);
+    return NULL;
 }
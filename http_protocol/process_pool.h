@@ -17,36 +17,38 @@
 #include <sys/un.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
 #include <dc/sys/mman.h>
-#include <dc/semaphore.h>
 #include <dc/sys/socket.h>
 #include <dc/unistd.h>
 
 #define NUM_PROCESSES 10
+#define PROCESS_POOL_BATCH 8
 /**
- * The semaphores struct holds the named semaphores that can be used in other
- * process to control the process.
- */
-typedef struct {
-    sem_t * worker_ready;
-    sem_t * worker_binded;
-    sem_t * wake_worker;
-} semaphores;
-/**
- * The memory struct holds a is_running value that will be stored in shared memory
- * for the processes to check if they should continue running.
+ * The memory struct is stored in shared memory and holds everything the parent
+ * and the worker processes use to coordinate. idle_workers has a bit set for
+ * every worker waiting for a client and ready_count counts them so the parent
+ * can sleep on it. Each worker sleeps on its own wake counter. The counters
+ * are futex words.
  */
 typedef struct memory {
-    bool is_running;
+    atomic_bool is_running;
+    _Atomic uint64_t idle_workers;
+    atomic_uint ready_count;
+    atomic_uint wake[NUM_PROCESSES];
 } memory;
 
 /**
  * The process pool struct contains everything you need to control the processes.
+ * Client fds reach worker i over the socketpair sockets[i] and worker_sockets[i].
+ * Nothing is named, so any number of servers can run on the same host.
  */
 typedef struct {
-    semaphores * sem;
     memory * mem;
+    int sockets[NUM_PROCESSES];
+    int worker_sockets[NUM_PROCESSES];
     config * cfg;
 } process_pool;
 
@@ -57,30 +59,40 @@ typedef struct {
  */
 void process_pool_start(process_pool * pool);
 /**
- * Sets the shared memory is_running bool to false then posts every worker processes
- * to wake up. Once woken the worker processes will exit success.
+ * Sets the shared memory is_running flag to false then wakes every worker
+ * process. Once woken the worker processes will exit success.
  * @param pool
  */
 void process_pool_stop(process_pool * pool);
 /**
- * Frees the process pool struct.
+ * Closes the worker sockets, unmaps the shared memory and frees the process pool struct.
  * @param pool
  */
 void process_pool_destroy(process_pool * pool);
 /**
  * Sets up everything the process pool needs before starting and returns a
- * process pool struct holding the command line args and created shared memory for
- * managing whether or not the processes are running or not.
+ * process pool struct holding the command line args, the anonymous shared memory for
+ * managing whether or not the processes are running and a socketpair per worker.
  * @param config
  * @return process_pool
  */
 process_pool * process_pool_create(config *cfg);
 
 /**
- * Used to pass a client to a process through the uses of semaphores and domain sockets.
+ * Used to pass a client to a process through the uses of futexes and a socketpair.
  * @param pool
  * @param cfd
  */
 void process_pool_notify(process_pool * pool, int cfd);
 
+/**
+ * Passes up to PROCESS_POOL_BATCH clients to a single worker process in one
+ * SCM_RIGHTS message. The worker serves them concurrently and only reports
+ * ready again once all of them are done.
+ * @param pool
+ * @param cfds
+ * @param count
+ */
+void process_pool_notify_batch(process_pool * pool, const int * cfds, int count);
+
 #endif
@@ -0,0 +1,102 @@
+#include "rate_limit.h"
+
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define RATE_LIMIT_SETS (RATE_LIMIT_ENTRIES / RATE_LIMIT_WAYS)
+#define US_PER_SECOND 1000000u
+
+_Static_assert((RATE_LIMIT_SETS & (RATE_LIMIT_SETS - 1)) == 0, "sets are picked by the top bits of a hash");
+
+// A slot holds the address in the high half and, in the low half, the
+// microsecond at which the client's bucket would be full again (GCRA's
+// theoretical arrival time). The clock wraps every 71 minutes, so times are
+// only ever compared as signed differences.
+static _Atomic uint64_t * table;
+
+/**
+ * Returns the low 32 bits of the CLOCK_MONOTONIC time in microseconds.
+ * @return now
+ */
+static uint32_t now_us(void);
+/**
+ * Spreads addresses that differ only in their low bits over the sets.
+ * @param addr
+ * @return set index
+ */
+static uint32_t set_index(uint32_t addr);
+
+int rate_limit_init(void) {
+    void * map = mmap(NULL, sizeof(uint64_t) * RATE_LIMIT_ENTRIES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    table = map;
+    return 0;
+}
+
+int rate_limit_allow(uint32_t addr, int rate, int burst) {
+    if (rate <= 0 || table == NULL)
+        return 1;
+
+    uint32_t now = now_us();
+    uint32_t interval = US_PER_SECOND / (uint32_t) rate;
+    uint64_t window = (uint64_t) interval * (burst > 0 ? (uint32_t) burst : 1);
+    if (window > INT32_MAX)
+        window = INT32_MAX;
+
+    _Atomic uint64_t * set = table + (size_t) set_index(addr) * RATE_LIMIT_WAYS;
+    for (;;) {
+        _Atomic uint64_t * victim = set;
+        uint64_t victim_value = 0;
+        int32_t victim_age = INT32_MIN;
+        _Atomic uint64_t * slot = NULL;
+        uint64_t value = 0;
+
+        for (int i = 0; i < RATE_LIMIT_WAYS; i++) {
+            uint64_t v = atomic_load_explicit(&set[i], memory_order_relaxed);
+            if ((uint32_t) (v >> 32) == addr) {
+                slot = &set[i];
+                value = v;
+                break;
+            }
+            // Empty slots are the oldest, then whichever bucket filled longest ago
+            int32_t age = v == 0 ? INT32_MAX : (int32_t) (now - (uint32_t) v);
+            if (age > victim_age) {
+                victim = &set[i];
+                victim_value = v;
+                victim_age = age;
+            }
+        }
+
+        if (slot == NULL) {
+            uint64_t fresh = (uint64_t) addr << 32 | (uint32_t) (now + interval);
+            if (atomic_compare_exchange_weak_explicit(victim, &victim_value, fresh, memory_order_relaxed, memory_order_relaxed))
+                return 1;
+            continue;
+        }
+
+        // A time further ahead than the window can only be left over from a
+        // previous turn of the clock, so it counts as a full bucket
+        uint32_t tat = (uint32_t) value;
+        int32_t ahead = (int32_t) (tat - now);
+        if (ahead < 0 || (uint32_t) ahead > window)
+            ahead = 0;
+        if ((uint64_t) ahead + interval > window)
+            return 0;
+
+        uint64_t charged = (uint64_t) addr << 32 | (uint32_t) (now + (uint32_t) ahead + interval);
+        if (atomic_compare_exchange_weak_explicit(slot, &value, charged, memory_order_relaxed, memory_order_relaxed))
+            return 1;
+    }
+}
+
+static uint32_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((uint64_t) ts.tv_sec * US_PER_SECOND + (uint64_t) ts.tv_nsec / 1000);
+}
+
+static uint32_t set_index(uint32_t addr) {
+    return (addr * 0x9E3779B1u) >> (32 - __builtin_ctz(RATE_LIMIT_SETS));
+}
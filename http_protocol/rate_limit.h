@@ -0,0 +1,27 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+
+#define RATE_LIMIT_ENTRIES (1 << 21)
+#define RATE_LIMIT_WAYS 8
+
+/**
+ * Maps the table of per client state shared by every process forked after
+ * it, RATE_LIMIT_ENTRIES slots of 8 bytes that only take memory once touched.
+ * Must be called before the NUMA groups fork. Returns 0 on success or -1 if
+ * the table could not be mapped, in which case every client is allowed.
+ */
+int rate_limit_init(void);
+
+/**
+ * Charges one connection to the IPv4 address addr and returns whether it is
+ * within rate connections per second with bursts of up to burst. A rate of
+ * 0 allows everything. Each address is kept in one of RATE_LIMIT_WAYS slots
+ * of a cache line sized set and updated with a single compare and swap, so
+ * the check takes no lock. When every slot of a set is taken the least
+ * recently seen address is evicted, which at worst gives it a fresh burst.
+ */
+int rate_limit_allow(uint32_t addr, int rate, int burst);
+
+#endif
@@ -0,0 +1,617 @@
+#define _GNU_SOURCE
+
+#include "rewrite.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define TOKEN_ANY -1
+#define TOKEN_HOST -2
+#define TOKEN_END -3
+
+// The NFA has a position before every token of every rule and one after
+// its last. Positions of a rule are consecutive and rules follow each other
+// in file order, so the lowest accepting position is the first rule listed
+typedef struct {
+    int16_t * token;
+    int32_t * rule;
+    size_t count;
+} nfa;
+
+typedef struct {
+    uint32_t * pool;
+    size_t pool_len;
+    size_t pool_capacity;
+    size_t * offset;
+    size_t * len;
+    size_t count;
+    size_t capacity;
+    uint32_t * table;
+    size_t table_capacity;
+} state_sets;
+
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+static rewrite_rules * current;
+static char * current_path;
+static struct stat current_st;
+static time_t checked;
+
+/**
+ * Parses one line of a rules file into rule. Blank and comment lines return
+ * 0 with rule->kind set to REWRITE_NONE.
+ * @param line
+ * @param rule
+ * @return 0 on success, -1 if the line is malformed
+ */
+static int parse_rule(char * line, rewrite_rule * rule);
+/**
+ * Turns pattern into tokens. Path patterns get a leading TOKEN_HOST that
+ * matches any host, and the host part of other patterns is lower-cased.
+ * @param pattern
+ * @param rule
+ * @return 0 on success, -1 if out of memory
+ */
+static int tokenize(const char * pattern, rewrite_rule * rule);
+/**
+ * Builds the DFA of every rule by subset construction.
+ * @param rules
+ * @return 0 on success, -1 if out of memory or too many states
+ */
+static int build_dfa(rewrite_rules * rules);
+/**
+ * Adds position and every position reachable from it without consuming a
+ * byte to the set being collected in buf.
+ * @param machine
+ * @param position
+ * @param mark
+ * @param generation
+ * @param buf
+ * @param len
+ */
+static void add_closure(const nfa * machine, uint32_t position, uint32_t * mark, uint32_t generation, uint32_t * buf, size_t * len);
+/**
+ * Returns the id of the state for the sorted set buf, adding it if new.
+ * @param sets
+ * @param buf
+ * @param len
+ * @return state id or UINT32_MAX if out of memory or too many states
+ */
+static uint32_t intern_set(state_sets * sets, const uint32_t * buf, size_t len);
+/**
+ * Doubles the hash table of sets and rehashes it.
+ * @param sets
+ * @return 0 on success, -1 if out of memory
+ */
+static int grow_table(state_sets * sets);
+/**
+ * Hashes a set of positions.
+ * @param buf
+ * @param len
+ * @return hash
+ */
+static size_t hash_set(const uint32_t * buf, size_t len);
+/**
+ * Orders positions for qsort.
+ * @param a
+ * @param b
+ * @return comparison result
+ */
+static int compare_positions(const void * a, const void * b);
+/**
+ * Matches subject against the tokens of rule, letting every wildcard match
+ * as little as possible, and records what each of the first
+ * REWRITE_MAX_CAPTURES '*' matched.
+ * @param tokens
+ * @param count
+ * @param subject
+ * @param starts
+ * @param lens
+ * @param captured
+ * @return 1 if subject matches
+ */
+static int capture(const int16_t * tokens, size_t count, const char * subject, const char ** starts, size_t * lens, int captured);
+/**
+ * Writes target into out with $1 to $9 replaced by the captures.
+ * @param target
+ * @param starts
+ * @param lens
+ * @param out
+ * @return 0 on success, -1 if the result does not fit
+ */
+static int expand(const char * target, const char ** starts, const size_t * lens, char * out);
+/**
+ * Recompiles the shared rules if path changed or the file was modified.
+ * Must be called with the write lock held.
+ * @param path
+ */
+static void refresh(const char * path);
+static void register_fork_handlers(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+rewrite_rules * rewrite_compile(const char * path) {
+    FILE * file = fopen(path, "r");
+    if (file == NULL)
+        return NULL;
+
+    rewrite_rules * rules = calloc(1, sizeof(rewrite_rules));
+    size_t capacity = 0;
+    char line[REWRITE_MAX_LINE];
+    unsigned int line_no = 0;
+    int failed = rules == NULL;
+    while (!failed && fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        rewrite_rule rule;
+        if (parse_rule(line, &rule) == -1) {
+            fprintf(stderr, "%s:%u - invalid rewrite rule\n", path, line_no);
+            continue;
+        }
+        if (rule.kind == REWRITE_NONE)
+            continue;
+        if (rules->rule_count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            rewrite_rule * grown = realloc(rules->rules, capacity * sizeof(rewrite_rule));
+            if (grown == NULL) {
+                free(rule.tokens);
+                free(rule.target);
+                failed = 1;
+                break;
+            }
+            rules->rules = grown;
+        }
+        rules->rules[rules->rule_count++] = rule;
+    }
+    fclose(file);
+
+    if (!failed && build_dfa(rules) == -1) {
+        fprintf(stderr, "%s - rewrite rules need more than %d states\n", path, REWRITE_MAX_STATES);
+        failed = 1;
+    }
+    if (failed) {
+        rewrite_destroy(rules);
+        return NULL;
+    }
+    return rules;
+}
+
+void rewrite_destroy(rewrite_rules * rules) {
+    if (rules == NULL)
+        return;
+    for (size_t i = 0; i < rules->rule_count; i++) {
+        free(rules->rules[i].tokens);
+        free(rules->rules[i].target);
+    }
+    free(rules->rules);
+    free(rules->next);
+    free(rules->accept);
+    free(rules);
+}
+
+void rewrite_match(const rewrite_rules * rules, const char * host, const char * uri, rewrite_result * result) {
+    result->action = REWRITE_NONE;
+    if (uri == NULL)
+        return;
+
+    // The subject is the host without its port, then the path
+    char subject[REWRITE_MAX_SUBJECT];
+    size_t len = 0;
+    if (host != NULL) {
+        int bracketed = host[0] == '[';
+        for (const char * c = host; *c != '\0' && len < sizeof(subject) - 1; c++) {
+            if (*c == ':' && !bracketed) break;
+            if (*c == ']') bracketed = 0;
+            subject[len++] = (char) tolower((unsigned char) *c);
+        }
+    }
+    const char * query = strchr(uri, '?');
+    size_t path_len = query != NULL ? (size_t) (query - uri) : strlen(uri);
+    if (len + path_len >= sizeof(subject))
+        return;
+    memcpy(subject + len, uri, path_len);
+    len += path_len;
+    subject[len] = '\0';
+
+    uint32_t state = rules->start;
+    for (size_t i = 0; i < len && state != 0; i++)
+        state = rules->next[state * rules->class_count + rules->classes[(uint8_t) subject[i]]];
+    if (state == 0 || rules->accept[state] < 0)
+        return;
+
+    const rewrite_rule * rule = &rules->rules[rules->accept[state]];
+    const char * starts[REWRITE_MAX_CAPTURES] = {0};
+    size_t lens[REWRITE_MAX_CAPTURES] = {0};
+    if (!capture(rule->tokens, rule->token_count, subject, starts, lens, 0))
+        return;
+    if (expand(rule->target, starts, lens, result->target) == -1)
+        return;
+
+    if (rule->kind == REWRITE_REDIRECT && query != NULL && strchr(result->target, '?') == NULL) {
+        size_t target_len = strlen(result->target);
+        if (target_len + strlen(query) >= sizeof(result->target))
+            return;
+        strcpy(result->target + target_len, query);
+    }
+    result->action = rule->kind;
+    result->status = rule->status;
+}
+
+void rewrite_apply(const char * path, const char * host, const char * uri, rewrite_result * result) {
+    result->action = REWRITE_NONE;
+    if (path == NULL)
+        return;
+    pthread_once(&fork_once, register_fork_handlers);
+
+    time_t now = time(NULL);
+    pthread_rwlock_rdlock(&lock);
+    if (current_path == NULL || checked != now || strcmp(current_path, path) != 0) {
+        pthread_rwlock_unlock(&lock);
+        pthread_rwlock_wrlock(&lock);
+        if (current_path == NULL || checked != now || strcmp(current_path, path) != 0) {
+            refresh(path);
+            checked = now;
+        }
+        pthread_rwlock_unlock(&lock);
+        pthread_rwlock_rdlock(&lock);
+    }
+    if (current != NULL)
+        rewrite_match(current, host, uri, result);
+    pthread_rwlock_unlock(&lock);
+}
+
+static void refresh(const char * path) {
+    struct stat st;
+    if (stat(path, &st) == -1)
+        return;
+    if (current_path != NULL && strcmp(path, current_path) == 0 && st.st_ino == current_st.st_ino
+            && st.st_size == current_st.st_size && st.st_mtim.tv_sec == current_st.st_mtim.tv_sec
+            && st.st_mtim.tv_nsec == current_st.st_mtim.tv_nsec)
+        return;
+
+    rewrite_rules * rules = rewrite_compile(path);
+    if (rules == NULL)
+        return;
+    rewrite_destroy(current);
+    free(current_path);
+    current = rules;
+    current_path = strdup(path);
+    current_st = st;
+}
+
+static int parse_rule(char * line, rewrite_rule * rule) {
+    memset(rule, 0, sizeof(*rule));
+    char * comment = strchr(line, '#');
+    if (comment != NULL)
+        *comment = '\0';
+
+    char * save;
+    char * kind = strtok_r(line, " \t\r\n", &save);
+    if (kind == NULL)
+        return 0;
+    char * pattern = strtok_r(NULL, " \t\r\n", &save);
+    char * target = strtok_r(NULL, " \t\r\n", &save);
+    char * status = strtok_r(NULL, " \t\r\n", &save);
+    if (pattern == NULL || target == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL)
+        return -1;
+
+    if (strcasecmp(kind, "rewrite") == 0 && status == NULL) {
+        rule->kind = REWRITE_INTERNAL;
+    } else if (strcasecmp(kind, "redirect") == 0) {
+        rule->kind = REWRITE_REDIRECT;
+        rule->status = REWRITE_DEFAULT_REDIRECT;
+        if (status != NULL) {
+            rule->status = atoi(status);
+            if (rule->status != 301 && rule->status != 302 && rule->status != 307 && rule->status != 308)
+                return -1;
+        }
+    } else {
+        return -1;
+    }
+
+    if (strlen(target) >= REWRITE_MAX_TARGET || tokenize(pattern, rule) == -1)
+        return -1;
+    rule->target = strdup(target);
+    if (rule->target == NULL) {
+        free(rule->tokens);
+        return -1;
+    }
+    return 0;
+}
+
+static int tokenize(const char * pattern, rewrite_rule * rule) {
+    rule->tokens = malloc((strlen(pattern) + 1) * sizeof(int16_t));
+    if (rule->tokens == NULL)
+        return -1;
+    size_t count = 0;
+    int in_host = pattern[0] != '/';
+    if (!in_host)
+        rule->tokens[count++] = TOKEN_HOST;
+    for (const char * c = pattern; *c != '\0'; c++) {
+        if (*c == '/')
+            in_host = 0;
+        if (*c == '*') {
+            if (count == 0 || rule->tokens[count - 1] != TOKEN_ANY)
+                rule->tokens[count++] = TOKEN_ANY;
+            continue;
+        }
+        rule->tokens[count++] = (uint8_t) (in_host ? tolower((unsigned char) *c) : *c);
+    }
+    rule->token_count = count;
+    return 0;
+}
+
+static int build_dfa(rewrite_rules * rules) {
+    // Every byte a pattern names gets its own class, as does '/' which ends
+    // a host, and all other bytes share class 0
+    uint8_t representative[256] = {0};
+    memset(rules->classes, 0, sizeof(rules->classes));
+    rules->class_count = 1;
+    rules->classes['/'] = (uint8_t) rules->class_count;
+    representative[rules->class_count++] = '/';
+    for (size_t r = 0; r < rules->rule_count; r++) {
+        for (size_t t = 0; t < rules->rules[r].token_count; t++) {
+            int16_t token = rules->rules[r].tokens[t];
+            if (token >= 0 && rules->classes[token] == 0 && token != '/') {
+                rules->classes[token] = (uint8_t) rules->class_count;
+                representative[rules->class_count++] = (uint8_t) token;
+            }
+        }
+    }
+    // Class 0 must stand for a byte no pattern names
+    for (int c = 1; c < 256; c++) {
+        if (rules->classes[c] == 0) {
+            representative[0] = (uint8_t) c;
+            break;
+        }
+    }
+
+    nfa machine = {0};
+    for (size_t r = 0; r < rules->rule_count; r++)
+        machine.count += rules->rules[r].token_count + 1;
+    machine.token = malloc((machine.count + 1) * sizeof(int16_t));
+    machine.rule = malloc((machine.count + 1) * sizeof(int32_t));
+    uint32_t * mark = calloc(machine.count + 1, sizeof(uint32_t));
+    uint32_t * buf = malloc((machine.count + 1) * sizeof(uint32_t));
+    uint32_t * starts = malloc((rules->rule_count + 1) * sizeof(uint32_t));
+    state_sets sets = {0};
+    int result = -1;
+    if (machine.token == NULL || machine.rule == NULL || mark == NULL || buf == NULL || starts == NULL)
+        goto done;
+
+    size_t position = 0;
+    for (size_t r = 0; r < rules->rule_count; r++) {
+        starts[r] = (uint32_t) position;
+        for (size_t t = 0; t < rules->rules[r].token_count; t++) {
+            machine.token[position] = rules->rules[r].tokens[t];
+            machine.rule[position++] = -1;
+        }
+        machine.token[position] = TOKEN_END;
+        machine.rule[position++] = (int32_t) r;
+    }
+
+    // State 0 is the empty set, the dead state
+    uint32_t generation = 1;
+    size_t len = 0;
+    if (intern_set(&sets, buf, 0) != 0)
+        goto done;
+    for (size_t r = 0; r < rules->rule_count; r++)
+        add_closure(&machine, starts[r], mark, generation, buf, &len);
+    qsort(buf, len, sizeof(uint32_t), compare_positions);
+    rules->start = intern_set(&sets, buf, len);
+    if (rules->start == UINT32_MAX)
+        goto done;
+
+    size_t next_capacity = 0;
+    for (size_t state = 0; state < sets.count; state++) {
+        if (sets.count > next_capacity) {
+            size_t capacity = next_capacity == 0 ? 64 : next_capacity;
+            while (capacity < sets.count) capacity *= 2;
+            uint32_t * next = realloc(rules->next, capacity * rules->class_count * sizeof(uint32_t));
+            if (next == NULL)
+                goto done;
+            rules->next = next;
+            next_capacity = capacity;
+        }
+        for (size_t class = 0; class < rules->class_count; class++) {
+            uint8_t byte = representative[class];
+            generation++;
+            len = 0;
+            for (size_t i = 0; i < sets.len[state]; i++) {
+                uint32_t p = sets.pool[sets.offset[state] + i];
+                int16_t token = machine.token[p];
+                if (token == byte)
+                    add_closure(&machine, p + 1, mark, generation, buf, &len);
+                else if (token == TOKEN_ANY || (token == TOKEN_HOST && byte != '/'))
+                    add_closure(&machine, p, mark, generation, buf, &len);
+            }
+            qsort(buf, len, sizeof(uint32_t), compare_positions);
+            uint32_t target = intern_set(&sets, buf, len);
+            if (target == UINT32_MAX)
+                goto done;
+            rules->next[state * rules->class_count + class] = target;
+        }
+    }
+
+    rules->state_count = sets.count;
+    rules->accept = malloc(sets.count * sizeof(int32_t));
+    if (rules->accept == NULL)
+        goto done;
+    for (size_t state = 0; state < sets.count; state++) {
+        rules->accept[state] = -1;
+        for (size_t i = 0; i < sets.len[state]; i++) {
+            int32_t rule = machine.rule[sets.pool[sets.offset[state] + i]];
+            if (rule >= 0) {
+                rules->accept[state] = rule;
+                break;
+            }
+        }
+    }
+    result = 0;
+
+done:
+    free(machine.token);
+    free(machine.rule);
+    free(mark);
+    free(buf);
+    free(starts);
+    free(sets.pool);
+    free(sets.offset);
+    free(sets.len);
+    free(sets.table);
+    return result;
+}
+
+static void add_closure(const nfa * machine, uint32_t position, uint32_t * mark, uint32_t generation, uint32_t * buf, size_t * len) {
+    for (;;) {
+        if (mark[position] != generation) {
+            mark[position] = generation;
+            buf[(*len)++] = position;
+        }
+        int16_t token = machine->token[position];
+        if (token != TOKEN_ANY && token != TOKEN_HOST)
+            return;
+        position++;
+    }
+}
+
+static uint32_t intern_set(state_sets * sets, const uint32_t * buf, size_t len) {
+    if (sets->count * 2 >= sets->table_capacity && grow_table(sets) == -1)
+        return UINT32_MAX;
+
+    size_t mask = sets->table_capacity - 1;
+    size_t slot = hash_set(buf, len) & mask;
+    for (; sets->table[slot] != 0; slot = (slot + 1) & mask) {
+        uint32_t id = sets->table[slot] - 1;
+        if (sets->len[id] == len && memcmp(sets->pool + sets->offset[id], buf, len * sizeof(uint32_t)) == 0)
+            return id;
+    }
+
+    if (sets->count == REWRITE_MAX_STATES)
+        return UINT32_MAX;
+    if (sets->count == sets->capacity) {
+        size_t capacity = sets->capacity == 0 ? 64 : sets->capacity * 2;
+        size_t * offset = realloc(sets->offset, capacity * sizeof(size_t));
+        if (offset == NULL)
+            return UINT32_MAX;
+        sets->offset = offset;
+        size_t * lens = realloc(sets->len, capacity * sizeof(size_t));
+        if (lens == NULL)
+            return UINT32_MAX;
+        sets->len = lens;
+        sets->capacity = capacity;
+    }
+    if (sets->pool_len + len > sets->pool_capacity) {
+        size_t capacity = sets->pool_capacity == 0 ? 256 : sets->pool_capacity;
+        while (capacity < sets->pool_len + len) capacity *= 2;
+        uint32_t * pool = realloc(sets->pool, capacity * sizeof(uint32_t));
+        if (pool == NULL)
+            return UINT32_MAX;
+        sets->pool = pool;
+        sets->pool_capacity = capacity;
+    }
+
+    uint32_t id = (uint32_t) sets->count++;
+    memcpy(sets->pool + sets->pool_len, buf, len * sizeof(uint32_t));
+    sets->offset[id] = sets->pool_len;
+    sets->len[id] = len;
+    sets->pool_len += len;
+    sets->table[slot] = id + 1;
+    return id;
+}
+
+static int grow_table(state_sets * sets) {
+    size_t capacity = sets->table_capacity == 0 ? 128 : sets->table_capacity * 2;
+    uint32_t * table = calloc(capacity, sizeof(uint32_t));
+    if (table == NULL)
+        return -1;
+    for (size_t id = 0; id < sets->count; id++) {
+        size_t slot = hash_set(sets->pool + sets->offset[id], sets->len[id]) & (capacity - 1);
+        while (table[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        table[slot] = (uint32_t) id + 1;
+    }
+    free(sets->table);
+    sets->table = table;
+    sets->table_capacity = capacity;
+    return 0;
+}
+
+static size_t hash_set(const uint32_t * buf, size_t len) {
+    // FNV-1a over the positions
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= buf[i];
+        hash *= 1099511628211ULL;
+    }
+    return (size_t) (hash ^ hash >> 29);
+}
+
+static int compare_positions(const void * a, const void * b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int capture(const int16_t * tokens, size_t count, const char * subject, const char ** starts, size_t * lens, int captured) {
+    if (count == 0)
+        return *subject == '\0';
+
+    int16_t token = tokens[0];
+    if (token >= 0)
+        return (uint8_t) *subject == token && capture(tokens + 1, count - 1, subject + 1, starts, lens, captured);
+
+    int records = token == TOKEN_ANY && captured < REWRITE_MAX_CAPTURES;
+    for (size_t len = 0;; len++) {
+        if (records) {
+            starts[captured] = subject;
+            lens[captured] = len;
+        }
+        if (capture(tokens + 1, count - 1, subject + len, starts, lens, captured + (token == TOKEN_ANY)))
+            return 1;
+        if (subject[len] == '\0' || (token == TOKEN_HOST && subject[len] == '/'))
+            return 0;
+    }
+}
+
+static int expand(const char * target, const char ** starts, const size_t * lens, char * out) {
+    size_t len = 0;
+    for (const char * c = target; *c != '\0'; c++) {
+        const char * piece = c;
+        size_t piece_len = 1;
+        if (c[0] == '$' && c[1] >= '1' && c[1] <= '9') {
+            int index = c[1] - '1';
+            piece = starts[index];
+            piece_len = piece != NULL ? lens[index] : 0;
+            c++;
+        } else if (c[0] == '$' && c[1] == '$') {
+            c++;
+        }
+        if (len + piece_len >= REWRITE_MAX_TARGET)
+            return -1;
+        memcpy(out + len, piece, piece_len);
+        len += piece_len;
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+static void register_fork_handlers(void) {
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void fork_prepare(void) {
+    pthread_rwlock_wrlock(&lock);
+}
+
+static void fork_parent(void) {
+    pthread_rwlock_unlock(&lock);
+}
+
+static void fork_child(void) {
+    pthread_rwlock_unlock(&lock);
+}
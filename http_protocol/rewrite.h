@@ -0,0 +1,95 @@
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REWRITE_NONE 0
+#define REWRITE_INTERNAL 1
+#define REWRITE_REDIRECT 2
+
+#define REWRITE_MAX_TARGET 1024
+#define REWRITE_MAX_SUBJECT 2048
+#define REWRITE_MAX_LINE 1024
+#define REWRITE_MAX_CAPTURES 9
+#define REWRITE_MAX_STATES 65536
+#define REWRITE_DEFAULT_REDIRECT 302
+
+/**
+ * A rule as written in the rules file. tokens holds the pattern with a byte
+ * per literal character and negative values for wildcards.
+ */
+typedef struct {
+    int kind;
+    int status;
+    int16_t * tokens;
+    size_t token_count;
+    char * target;
+} rewrite_rule;
+
+/**
+ * Every rule of a rules file compiled into one DFA over host and path.
+ * Bytes are first mapped to one of class_count classes, so a state's
+ * transitions are next[state * class_count + class]. State 0 is the dead
+ * state and accept holds the rule a state matches, or -1.
+ */
+typedef struct {
+    rewrite_rule * rules;
+    size_t rule_count;
+    uint8_t classes[256];
+    size_t class_count;
+    uint32_t * next;
+    int32_t * accept;
+    size_t state_count;
+    uint32_t start;
+} rewrite_rules;
+
+/**
+ * The outcome of matching a request against the rules. For REWRITE_INTERNAL
+ * target is the path to resolve instead of the request's, for
+ * REWRITE_REDIRECT it is the Location to send with status.
+ */
+typedef struct {
+    int action;
+    int status;
+    char target[REWRITE_MAX_TARGET];
+} rewrite_result;
+
+/**
+ * Compiles the rules file at path. Every line holds a rule:
+ *
+ *     rewrite  PATTERN TARGET
+ *     redirect PATTERN TARGET [301|302|307|308]
+ *
+ * A pattern starting with '/' matches the path on any host, any other
+ * pattern matches the host, without its port, followed by the path. '*'
+ * matches any run of characters and TARGET refers to what the first nine
+ * matched with $1 to $9. The first rule listed wins when several match and
+ * '#' starts a comment. Lines that cannot be parsed are reported and
+ * skipped. Returns NULL if the file could not be read or the rules need more
+ * than REWRITE_MAX_STATES states.
+ */
+rewrite_rules * rewrite_compile(const char * path);
+
+/**
+ * Frees rules.
+ */
+void rewrite_destroy(rewrite_rules * rules);
+
+/**
+ * Matches host, which may be NULL, and uri against rules in one pass over
+ * them and fills result. The query string of uri is not matched, and is
+ * carried over to a redirect whose target has none.
+ */
+void rewrite_match(const rewrite_rules * rules, const char * host, const char * uri, rewrite_result * result);
+
+/**
+ * Matches a request against the rules file at path like rewrite_match,
+ * setting result->action to REWRITE_NONE if path is NULL. The compiled rules
+ * are shared by every thread of a process and the file is checked for
+ * changes at most once a second, recompiling it when it changed. If it can
+ * no longer be read the previous rules stay in force.
+ */
+void rewrite_apply(const char * path, const char * host, const char * uri, rewrite_result * result);
+
+#endif
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+
+#include "router.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_PARAM 1
+#define NODE_CATCH_ALL 2
+
+// A node of the compressed trie. Static nodes match their label, and no two
+// static children of a node start with the same byte. Parameter and
+// catch-all nodes match path text, and their label is the parameter name
+typedef struct router_node {
+    char * label;
+    size_t label_len;
+    char * first;
+    struct router_node ** children;
+    size_t child_count;
+    struct router_node * param;
+    struct router_node * catch_all;
+    http_handler handlers[ROUTER_METHODS];
+    void * args[ROUTER_METHODS];
+} router_node;
+
+static router_node default_routes;
+
+/**
+ * Returns the node at the end of the static text below node, adding and
+ * splitting nodes as needed.
+ * @param node
+ * @param text
+ * @param len
+ * @return the node or NULL if out of memory
+ */
+static router_node * add_static(router_node * node, const char * text, size_t len);
+/**
+ * Returns the parameter or catch-all child of node named name, adding it if
+ * node has none.
+ * @param node
+ * @param kind
+ * @param name
+ * @param len
+ * @return the node or NULL if node has one with another name
+ */
+static router_node * add_wildcard(router_node * node, int kind, const char * name, size_t len);
+/**
+ * Creates a node.
+ * @param label
+ * @param len
+ * @return the node or NULL if out of memory
+ */
+static router_node * create_node(const char * label, size_t len);
+/**
+ * Adds child to the static children of node.
+ * @param node
+ * @param child
+ * @return 0 on success, -1 if out of memory
+ */
+static int add_child(router_node * node, router_node * child);
+/**
+ * Splits node after len bytes of its label. The tail and everything below
+ * node move to a new and only child.
+ * @param node
+ * @param len
+ * @return 0 on success, -1 if out of memory
+ */
+static int split_node(router_node * node, size_t len);
+/**
+ * Returns the static child of node whose label starts with c.
+ * @param node
+ * @param c
+ * @return the child or NULL
+ */
+static router_node * find_child(const router_node * node, char c);
+/**
+ * Matches the len bytes of path left after node against the routes below it.
+ * Static children are tried before the parameter child, which is tried before
+ * the catch-all.
+ * @param node
+ * @param method
+ * @param path
+ * @param len
+ * @param handler
+ * @param match
+ * @param allowed gets the methods of routes that match path but not method
+ * @return 1 if a route for method matched
+ */
+static int find_route(const router_node * node, int method, const char * path, size_t len, http_handler * handler, router_match * match, unsigned * allowed);
+/**
+ * Frees node and everything below it.
+ * @param node
+ */
+static void destroy_node(router_node * node);
+/**
+ * Returns the methods node has a handler for.
+ * @param node
+ * @return the methods as bits 1 << method, 0 if node ends no route
+ */
+static unsigned node_methods(const router_node * node);
+
+router * router_default(void) {
+    return &default_routes;
+}
+
+router * router_create(void) {
+    return calloc(1, sizeof(router_node));
+}
+
+void router_destroy(router * routes) {
+    if (routes == NULL || routes == &default_routes)
+        return;
+    destroy_node(routes);
+}
+
+int router_add(router * routes, int method, const char * pattern, http_handler handler, void * arg) {
+    if (method < 0 || method >= ROUTER_METHODS || handler == NULL || pattern == NULL || pattern[0] != '/')
+        return -1;
+
+    router_node * node = routes;
+    size_t param_count = 0;
+    const char * c = pattern;
+    while (*c != '\0') {
+        if (*c == ':' || *c == '*') {
+            // Parameters take up whole segments
+            if (c[-1] != '/' || ++param_count > ROUTER_MAX_PARAMS)
+                return -1;
+            int kind = *c == ':' ? NODE_PARAM : NODE_CATCH_ALL;
+            const char * name = ++c;
+            while (*c != '\0' && *c != '/') c++;
+            if (c == name || (kind == NODE_CATCH_ALL && *c != '\0'))
+                return -1;
+            node = add_wildcard(node, kind, name, c - name);
+        } else {
+            const char * text = c;
+            while (*c != '\0' && *c != ':' && *c != '*') c++;
+            node = add_static(node, text, c - text);
+        }
+        if (node == NULL)
+            return -1;
+    }
+
+    if (node->handlers[method] != NULL)
+        return -1;
+    node->handlers[method] = handler;
+    node->args[method] = arg;
+    return 0;
+}
+
+int router_find(const router * routes, int method, const char * path, http_handler * handler, router_match * match) {
+    match->path = path;
+    match->param_count = 0;
+    match->arg = NULL;
+    match->allowed = 0;
+    *handler = NULL;
+    if (path == NULL)
+        return HTTP_NOT_FOUND;
+
+    size_t len = strcspn(path, "?");
+    unsigned allowed = 0;
+    if (method >= 0 && method < ROUTER_METHODS && find_route(routes, method, path, len, handler, match, &allowed))
+        return HTTP_OK;
+    match->allowed = allowed;
+    return allowed != 0 ? HTTP_METHOD_NOT_ALLOWED : HTTP_NOT_FOUND;
+}
+
+void router_format_allow(unsigned allowed, char * out) {
+    static const char * names[ROUTER_METHODS] = { NULL, "HEAD", "GET", "POST", "PUT" };
+    out[0] = '\0';
+    for (int method = 0; method < ROUTER_METHODS; method++) {
+        if (!(allowed & 1u << method) || names[method] == NULL)
+            continue;
+        if (out[0] != '\0')
+            strcat(out, ", ");
+        strcat(out, names[method]);
+    }
+}
+
+const char * router_get_param(const router_match * match, const char * name, size_t * len) {
+    size_t name_len = strlen(name);
+    for (size_t i = 0; i < match->param_count; i++) {
+        const router_param * param = &match->params[i];
+        if (param->name_len == name_len && memcmp(param->name, name, name_len) == 0) {
+            *len = param->value_len;
+            return param->value;
+        }
+    }
+    return NULL;
+}
+
+static router_node * add_static(router_node * node, const char * text, size_t len) {
+    while (len > 0) {
+        router_node * child = find_child(node, text[0]);
+        if (child == NULL) {
+            child = create_node(text, len);
+            if (child == NULL || add_child(node, child) == -1) {
+                if (child != NULL) free(child->label);
+                free(child);
+                return NULL;
+            }
+            return child;
+        }
+
+        size_t common = 0;
+        while (common < len && common < child->label_len && child->label[common] == text[common]) common++;
+        if (common < child->label_len && split_node(child, common) == -1)
+            return NULL;
+        node = child;
+        text += common;
+        len -= common;
+    }
+    return node;
+}
+
+static router_node * add_wildcard(router_node * node, int kind, const char * name, size_t len) {
+    router_node ** slot = kind == NODE_PARAM ? &node->param : &node->catch_all;
+    if (*slot != NULL) {
+        if ((*slot)->label_len != len || memcmp((*slot)->label, name, len) != 0)
+            return NULL;
+        return *slot;
+    }
+    *slot = create_node(name, len);
+    return *slot;
+}
+
+static router_node * create_node(const char * label, size_t len) {
+    router_node * node = calloc(1, sizeof(router_node));
+    if (node == NULL)
+        return NULL;
+    node->label = strndup(label, len);
+    if (node->label == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->label_len = len;
+    return node;
+}
+
+static int add_child(router_node * node, router_node * child) {
+    router_node ** children = realloc(node->children, (node->child_count + 1) * sizeof(router_node *));
+    if (children == NULL)
+        return -1;
+    node->children = children;
+    char * first = realloc(node->first, node->child_count + 1);
+    if (first == NULL)
+        return -1;
+    node->first = first;
+    node->children[node->child_count] = child;
+    node->first[node->child_count++] = child->label[0];
+    return 0;
+}
+
+static int split_node(router_node * node, size_t len) {
+    router_node * tail = create_node(node->label + len, node->label_len - len);
+    router_node ** children = malloc(sizeof(router_node *));
+    char * first = malloc(1);
+    if (tail == NULL || children == NULL || first == NULL) {
+        if (tail != NULL) free(tail->label);
+        free(tail);
+        free(children);
+        free(first);
+        return -1;
+    }
+
+    char * label = tail->label;
+    *tail = *node;
+    tail->label = label;
+    tail->label_len = node->label_len - len;
+
+    node->label[len] = '\0';
+    node->label_len = len;
+    node->children = children;
+    node->children[0] = tail;
+    node->first = first;
+    node->first[0] = tail->label[0];
+    node->child_count = 1;
+    node->param = NULL;
+    node->catch_all = NULL;
+    memset(node->handlers, 0, sizeof(node->handlers));
+    memset(node->args, 0, sizeof(node->args));
+    return 0;
+}
+
+static router_node * find_child(const router_node * node, char c) {
+    for (size_t i = 0; i < node->child_count; i++) {
+        if (node->first[i] == c)
+            return node->children[i];
+    }
+    return NULL;
+}
+
+static int find_route(const router_node * node, int method, const char * path, size_t len, http_handler * handler, router_match * match, unsigned * allowed) {
+    if (len == 0) {
+        if (node->handlers[method] != NULL) {
+            *handler = node->handlers[method];
+            match->arg = node->args[method];
+            return 1;
+        }
+        *allowed |= node_methods(node);
+    } else {
+        router_node * child = find_child(node, path[0]);
+        if (child != NULL && child->label_len <= len && memcmp(child->label, path, child->label_len) == 0
+                && find_route(child, method, path + child->label_len, len - child->label_len, handler, match, allowed))
+            return 1;
+
+        if (node->param != NULL && path[0] != '/' && match->param_count < ROUTER_MAX_PARAMS) {
+            size_t segment_len = 0;
+            while (segment_len < len && path[segment_len] != '/') segment_len++;
+            router_param * param = &match->params[match->param_count++];
+            param->name = node->param->label;
+            param->name_len = node->param->label_len;
+            param->value = path;
+            param->value_len = segment_len;
+            if (find_route(node->param, method, path + segment_len, len - segment_len, handler, match, allowed))
+                return 1;
+            match->param_count--;
+        }
+    }
+
+    // A catch-all also matches an empty rest, so "/files/*path" routes "/files/"
+    const router_node * catch_all = node->catch_all;
+    if (catch_all != NULL && catch_all->handlers[method] != NULL && match->param_count < ROUTER_MAX_PARAMS) {
+        router_param * param = &match->params[match->param_count++];
+        param->name = catch_all->label;
+        param->name_len = catch_all->label_len;
+        param->value = path;
+        param->value_len = len;
+        *handler = catch_all->handlers[method];
+        match->arg = catch_all->args[method];
+        return 1;
+    }
+    if (catch_all != NULL)
+        *allowed |= node_methods(catch_all);
+    return 0;
+}
+
+static void destroy_node(router_node * node) {
+    if (node == NULL)
+        return;
+    for (size_t i = 0; i < node->child_count; i++)
+        destroy_node(node->children[i]);
+    destroy_node(node->param);
+    destroy_node(node->catch_all);
+    free(node->children);
+    free(node->first);
+    free(node->label);
+    free(node);
+}
+
+static unsigned node_methods(const router_node * node) {
+    unsigned methods = 0;
+    for (int method = 0; method < ROUTER_METHODS; method++) {
+        if (node->handlers[method] != NULL)
+            methods |= 1u << method;
+    }
+    return methods;
+}
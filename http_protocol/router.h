@@ -0,0 +1,98 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "config.h"
+#include "http.h"
+
+#include <stddef.h>
+
+#define ROUTER_METHODS 5
+#define ROUTER_MAX_PARAMS 8
+#define ROUTER_ALLOW_LEN 32
+
+/**
+ * A parameter segment of a route and the part of the path it matched. Neither
+ * name nor value is NUL-terminated.
+ */
+typedef struct {
+    const char * name;
+    size_t name_len;
+    const char * value;
+    size_t value_len;
+} router_param;
+
+/**
+ * What a request was routed with: the path it was matched on, which still
+ * carries its query string, the parameters of the route and the argument the
+ * handler was registered with. When the path is only routed for other
+ * methods, allowed holds them as bits 1 << method.
+ */
+typedef struct {
+    const char * path;
+    router_param params[ROUTER_MAX_PARAMS];
+    size_t param_count;
+    void * arg;
+    unsigned allowed;
+} router_match;
+
+/**
+ * Fills in response for request. The response already carries the Server
+ * and Date header fields.
+ */
+typedef void (*http_handler)(config * conf, http_request * request, http_response * response, const router_match * match);
+
+/**
+ * A set of routes, kept as a compressed radix trie.
+ */
+typedef struct router_node router;
+
+/**
+ * Returns the routes build_response dispatches through.
+ */
+router * router_default(void);
+
+/**
+ * Creates an empty set of routes.
+ */
+router * router_create(void);
+
+/**
+ * Frees routes created with router_create.
+ */
+void router_destroy(router * routes);
+
+/**
+ * Adds handler to routes for requests of method whose path matches pattern.
+ * Patterns start with '/' and may hold parameter segments: ":name" matches
+ * one non-empty segment and "*name", which must come last, matches the rest
+ * of the path. Static text is preferred over a parameter and a parameter over
+ * a catch-all. Routes must not be added while routes is being searched.
+ * Returns -1 if the pattern is malformed, its parameter names clash with
+ * those of an existing route, or the route is already registered for method.
+ */
+int router_add(router * routes, int method, const char * pattern, http_handler handler, void * arg);
+
+/**
+ * Finds the handler in routes for method and path, ignoring the query
+ * string, in time proportional to the length of path however many routes
+ * there are.
+ * Returns HTTP_OK with match filled in, HTTP_METHOD_NOT_ALLOWED with the
+ * methods routed for path in match->allowed if only other methods are, or
+ * HTTP_NOT_FOUND.
+ */
+int router_find(const router * routes, int method, const char * path, http_handler * handler, router_match * match);
+
+/**
+ * Writes the methods in allowed, a set as in router_match, to out as the
+ * value of an Allow header field, such as "HEAD, GET". out must hold
+ * ROUTER_ALLOW_LEN bytes.
+ */
+void router_format_allow(unsigned allowed, char * out);
+
+/**
+ * Returns the value of the parameter name in match and sets len to its length,
+ * or returns NULL if the route has no such parameter.
+ */
+const char * router_get_param(const router_match * match, const char * name, size_t * len);
+
+#endif
@@ -5,7 +5,8 @@
  * The loop uses semaphores to post that a thread is ready for work then waits until a thread
  * should be woken. Once woken the thread will exit if is_running is false in the thread_pool object.
  * It will proceed to grab the client fd from the shared data then posts that it has the client fd.
- * Once it has the client fd it will handle the http request.
+ * Once it has the client fd it will handle the http request, unless CoDel decides it
+ * has waited too long and it is shed.
  * @param pool
  */
 static void * thread_loop(void * arg){
@@ -21,15 +22,22 @@ static void * thread_loop(void * arg){
         dc_sem_wait(&data->get_semaphore);
         
         int cfd = data->client_fd;
+        long long enqueued_at = data->enqueued_at;
         
         dc_sem_post(&data->get_semaphore);
         dc_sem_post(&data->empty_semaphore);
 
+        pthread_mutex_lock(&pool->codel_lock);
+        int shed = codel_should_shed(&pool->codel, enqueued_at);
+        pthread_mutex_unlock(&pool->codel_lock);
+        if (shed) {
+            http_reject_client(cfd, HTTP_SERVICE_UNAVAILABLE);
+            continue;
+        }
+
         config * conf = get_config(pool->cfg);
         http_handle_client(conf, cfd);
         destroy_config(conf);
-
-        close(cfd);
     }
 }
 void thread_pool_start(thread_pool* pool){
@@ -65,6 +73,7 @@ void thread_pool_destroy(thread_pool * pool) {
     dc_sem_destroy(&data->put_semaphore);
     dc_sem_destroy(&data->get_semaphore);
     dc_sem_destroy(&data->killed_semaphore);
+    pthread_mutex_destroy(&pool->codel_lock);
 
     free(data);
     free(pool);
@@ -81,6 +90,7 @@ thread_pool * thread_pool_create(config *cfg) {
     dc_sem_init(&data->put_semaphore, 0, 1);
     dc_sem_init(&data->get_semaphore, 0, 1);
     dc_sem_init(&data->killed_semaphore, 0, 0);
+    pthread_mutex_init(&pool->codel_lock, NULL);
 
     pool->data = data;
     return pool;
@@ -89,10 +99,12 @@ thread_pool * thread_pool_create(config *cfg) {
 void thread_pool_notify(thread_pool* pool, int cfd){
     shared_data *data;
     data = pool->data;
+    long long enqueued_at = codel_arrival(cfd);
     dc_sem_wait(&data->empty_semaphore);
     dc_sem_wait(&data->put_semaphore);
     
     data->client_fd = cfd;
+    data->enqueued_at = enqueued_at;
 
     dc_sem_post(&data->put_semaphore);
     dc_sem_post(&data->occupied_semaphore);
@@ -11,16 +11,19 @@
 #include <dc/pthread.h>
 #include <dc/unistd.h>
 #include "./http.h"
+#include "./codel.h"
 
 #define NUM_THREADS 10
 /**
  * A client fd can be passed to a thread through the use of a shared_data struct.
  * The struct contains semaphores that should be used to allow only a single
- * thread to have access to the client_fd data at a time.
+ * thread to have access to the client_fd data at a time. enqueued_at is when
+ * the client's request arrived.
  */
 struct shared_data
 {
     int client_fd;
+    long long enqueued_at;
     sem_t occupied_semaphore;
     sem_t empty_semaphore;
     sem_t put_semaphore;
@@ -30,13 +33,16 @@ struct shared_data
 typedef struct shared_data shared_data;
 /**
  * Thread pool struct is used to control a pool of threads and should be created with
- * thread_pool_create.
+ * thread_pool_create. The threads share the CoDel state of the queue, guarded by
+ * codel_lock, to decide which clients to shed.
  */
 struct thread_pool {
     struct shared_data * data;
     pthread_t threads [NUM_THREADS];
     bool is_running;
     config *cfg;
+    codel codel;
+    pthread_mutex_t codel_lock;
 };
 typedef struct thread_pool thread_pool;
 
@@ -67,7 +73,9 @@ void thread_pool_destroy(thread_pool* pool);
 thread_pool * thread_pool_create(config *cfg);
 /**
  * Used to pass a client over the thread pool struct and notify a single thread that
- * it can access the client fd through the uses of semaphores.
+ * it can access the client fd through the uses of semaphores. The time the client
+ * waits for a thread is fed to CoDel, and a client that waited too long under
+ * sustained overload is shed with a 503 instead of being served.
  * @param argc
  * @param argv
  * @return
@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+#include "tls.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#define TICKET_KEY_NAME_LEN 16
+#define TICKET_AES_KEY_LEN 32
+#define TICKET_HMAC_KEY_LEN 32
+#define SESSION_ID_CONTEXT "dc-http"
+#define ALPN_PROTOCOLS "\x02h2\x08http/1.1\x08http/1.0"
+
+typedef struct {
+    unsigned char name[TICKET_KEY_NAME_LEN];
+    unsigned char aes_key[TICKET_AES_KEY_LEN];
+    unsigned char hmac_key[TICKET_HMAC_KEY_LEN];
+    int valid;
+} ticket_key;
+
+typedef struct {
+    unsigned int id_len;
+    unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    time_t expires;
+    unsigned int der_len;
+    unsigned char der[TLS_SESSION_DER_MAX];
+} session_slot;
+
+/**
+ * Lives in a MAP_SHARED mapping created before any worker is started, so
+ * thread_pool workers and process_pool children resume each other's sessions.
+ * keys[0] issues new tickets and keys[1] still decrypts the previous ones,
+ * once there are previous ones.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    ticket_key keys[2];
+    time_t keys_rotated;
+    session_slot slots[TLS_SESSION_SLOTS];
+} shared_cache;
+
+typedef struct {
+    SSL * ssl;
+    int ktls_send;
+    int ktls_recv;
+} tls_conn;
+
+static SSL_CTX * ssl_ctx;
+static shared_cache * cache;
+static tls_conn * conns;
+static size_t max_conns;
+
+static int create_shared_cache();
+static void lock_cache();
+static int rotate_ticket_keys(time_t now);
+static int new_session_cb(SSL * ssl, SSL_SESSION * session);
+static SSL_SESSION * get_session_cb(SSL * ssl, const unsigned char * id, int id_len, int * copy);
+static void remove_session_cb(SSL_CTX * ctx, SSL_SESSION * session);
+static int ticket_key_cb(SSL * ssl, unsigned char * key_name, unsigned char * iv,
+                         EVP_CIPHER_CTX * cipher_ctx, EVP_MAC_CTX * mac_ctx, int enc);
+static int alpn_select_cb(SSL * ssl, const unsigned char ** out, unsigned char * out_len,
+                          const unsigned char * in, unsigned int in_len, void * arg);
+static session_slot * slot_for(const unsigned char * id, unsigned int id_len);
+static tls_conn * conn_for(int cfd);
+
+int tls_init(config * conf) {
+    if (conf->tls_cert == NULL || conf->tls_key == NULL) return 0;
+
+    ssl_ctx = SSL_CTX_new(TLS_server_method());
+    if (ssl_ctx == NULL) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+    // OpenSSL attaches the "tls" TCP ULP and hands over the record keys
+    // itself once the handshake completes, if the kernel supports it
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+
+    if (SSL_CTX_use_certificate_chain_file(ssl_ctx, conf->tls_cert) != 1
+            || SSL_CTX_use_PrivateKey_file(ssl_ctx, conf->tls_key, SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key(ssl_ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+        return -1;
+    }
+
+    if (create_shared_cache() == -1) {
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+        return -1;
+    }
+
+    SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *) SESSION_ID_CONTEXT, strlen(SESSION_ID_CONTEXT));
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_set_timeout(ssl_ctx, TLS_SESSION_TIMEOUT);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, new_session_cb);
+    SSL_CTX_sess_set_get_cb(ssl_ctx, get_session_cb);
+    SSL_CTX_sess_set_remove_cb(ssl_ctx, remove_session_cb);
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, ticket_key_cb);
+    SSL_CTX_set_alpn_select_cb(ssl_ctx, alpn_select_cb, NULL);
+
+    struct rlimit limit;
+    max_conns = TLS_MAX_CONNS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < TLS_MAX_CONNS) max_conns = limit.rlim_cur;
+    conns = calloc(max_conns, sizeof(tls_conn));
+    return 0;
+}
+
+int tls_is_enabled(void) {
+    return ssl_ctx != NULL;
+}
+
+int tls_accept(int cfd) {
+    if (ssl_ctx == NULL) return 0;
+
+    tls_conn * conn = conn_for(cfd);
+    if (conn == NULL) return -1;
+
+    SSL * ssl = SSL_new(ssl_ctx);
+    if (ssl == NULL) return -1;
+    SSL_set_fd(ssl, cfd);
+
+    if (SSL_accept(ssl) != 1) {
+        ERR_clear_error();
+        SSL_free(ssl);
+        return -1;
+    }
+
+    conn->ssl = ssl;
+    conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    conn->ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+    return 0;
+}
+
+int tls_alpn_h2(int cfd) {
+    tls_conn * conn = conn_for(cfd);
+    if (conn == NULL || conn->ssl == NULL) return 0;
+
+    const unsigned char * protocol;
+    unsigned int protocol_len;
+    SSL_get0_alpn_selected(conn->ssl, &protocol, &protocol_len);
+    return protocol_len == 2 && memcmp(protocol, "h2", 2) == 0;
+}
+
+int tls_pending(int cfd) {
+    tls_conn * conn = conn_for(cfd);
+    if (conn == NULL || conn->ssl == NULL || conn->ktls_recv) return 0;
+    return SSL_pending(conn->ssl);
+}
+
+void tls_close(int cfd) {
+    tls_conn * conn = conn_for(cfd);
+    if (conn == NULL || conn->ssl == NULL) return;
+
+    SSL_shutdown(conn->ssl);
+    SSL_free(conn->ssl);
+    ERR_clear_error();
+    memset(conn, 0, sizeof(tls_conn));
+}
+
+ssize_t tls_read(int cfd, void * buf, size_t len) {
+    tls_conn * conn = conn_for(cfd);
+    if (conn == NULL || conn->ssl == NULL || conn->ktls_recv) return read(cfd, buf, len);
+
+    size_t num_read;
+    if (SSL_read_ex(conn->ssl, buf, len, &num_read) == 1) return num_read;
+    return SSL_get_error(conn->ssl, 0) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+}
+
+ssize_t tls_write(int cfd, const void * buf, size_t len) {
+    tls_conn * conn = conn_for(cfd);
+    if (conn == NULL || conn->ssl == NULL || conn->ktls_send) return write(cfd, buf, len);
+
+    size_t num_written;
+    if (SSL_write_ex(conn->ssl, buf, len, &num_written) == 1) return num_written;
+    return -1;
+}
+
+ssize_t tls_writev(int cfd, const struct iovec * iov, int iovcnt) {
+    if (tls_kernel_send(cfd)) return writev(cfd, iov, iovcnt);
+
+    // Without kTLS each buffer becomes at least one record
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t written = 0;
+        while (written < iov[i].iov_len) {
+            ssize_t num_written = tls_write(cfd, (char *) iov[i].iov_base + written, iov[i].iov_len - written);
+            if (num_written <= 0) return total > 0 ? total : -1;
+            written += num_written;
+            total += num_written;
+        }
+    }
+    return total;
+}
+
+ssize_t tls_sendfile(int cfd, int in_fd, off_t offset, size_t count) {
+    size_t sent = 0;
+
+    if (tls_kernel_send(cfd)) {
+        while (sent < count) {
+            ssize_t num_sent = sendfile(cfd, in_fd, &offset, count - sent);
+            if (num_sent < 0 && errno == EINTR) continue;
+            if (num_sent <= 0) return sent > 0 ? (ssize_t) sent : -1;
+            sent += num_sent;
+        }
+        return sent;
+    }
+
+    // pread leaves the file offset alone, the fd may be shared between threads
+    char buf[TLS_SENDFILE_BUFFER];
+    while (sent < count) {
+        size_t len = count - sent < TLS_SENDFILE_BUFFER ? count - sent : TLS_SENDFILE_BUFFER;
+        ssize_t num_read = pread(in_fd, buf, len, offset + sent);
+        if (num_read <= 0) break;
+        if (tls_writev(cfd, &(struct iovec) { .iov_base = buf, .iov_len = num_read }, 1) != num_read) return -1;
+        sent += num_read;
+    }
+    return sent;
+}
+
+int tls_kernel_recv(int cfd) {
+    tls_conn * conn = conn_for(cfd);
+    return conn == NULL || conn->ssl == NULL || conn->ktls_recv;
+}
+
+int tls_kernel_send(int cfd) {
+    tls_conn * conn = conn_for(cfd);
+    return conn == NULL || conn->ssl == NULL || conn->ktls_send;
+}
+
+// Picks the first of our protocols the client offers, h2 first
+static int alpn_select_cb(SSL * ssl, const unsigned char ** out, unsigned char * out_len,
+                          const unsigned char * in, unsigned int in_len, void * arg) {
+    (void) ssl;
+    (void) arg;
+    unsigned char * selected;
+    if (SSL_select_next_proto(&selected, out_len, (const unsigned char *) ALPN_PROTOCOLS, sizeof(ALPN_PROTOCOLS) - 1,
+                              in, in_len) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static tls_conn * conn_for(int cfd) {
+    if (conns == NULL || cfd < 0 || (size_t) cfd >= max_conns) return NULL;
+    return &conns[cfd];
+}
+
+static int create_shared_cache() {
+    shared_cache * shared = mmap(NULL, sizeof(shared_cache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap()");
+        return -1;
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shared->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // The mapping starts zeroed, so keys[1] stays invalid until the first
+    // rotation that replaces a real key
+    cache = shared;
+    if (rotate_ticket_keys(time(NULL)) == -1) {
+        fprintf(stderr, "Could not generate TLS ticket keys\n");
+        munmap(shared, sizeof(shared_cache));
+        cache = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// A worker process that died while holding the lock cannot leave the cache
+// in a worse state than a stale entry, so the lock is simply recovered
+static void lock_cache() {
+    if (pthread_mutex_lock(&cache->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&cache->lock);
+    }
+}
+
+// Called with the cache locked. Keeps the current keys if no random bytes
+// can be had, as predictable keys would let anyone forge a ticket
+static int rotate_ticket_keys(time_t now) {
+    ticket_key key;
+    if (RAND_bytes(key.name, TICKET_KEY_NAME_LEN) != 1
+            || RAND_bytes(key.aes_key, TICKET_AES_KEY_LEN) != 1
+            || RAND_bytes(key.hmac_key, TICKET_HMAC_KEY_LEN) != 1) {
+        OPENSSL_cleanse(&key, sizeof(key));
+        return -1;
+    }
+    key.valid = 1;
+    cache->keys[1] = cache->keys[0];
+    cache->keys[0] = key;
+    cache->keys_rotated = now;
+    OPENSSL_cleanse(&key, sizeof(key));
+    return 0;
+}
+
+static session_slot * slot_for(const unsigned char * id, unsigned int id_len) {
+    unsigned long hash = 5381;
+    for (unsigned int i = 0; i < id_len; i++) {
+        hash = ((hash << 5) + hash) + id[i];
+    }
+    return &cache->slots[hash % TLS_SESSION_SLOTS];
+}
+
+static int new_session_cb(SSL * ssl, SSL_SESSION * session) {
+    (void) ssl;
+    unsigned int id_len;
+    const unsigned char * id = SSL_SESSION_get_id(session, &id_len);
+
+    int der_len = i2d_SSL_SESSION(session, NULL);
+    if (der_len <= 0 || der_len > TLS_SESSION_DER_MAX) return 0;
+
+    lock_cache();
+    session_slot * slot = slot_for(id, id_len);
+    unsigned char * der = slot->der;
+    slot->id_len = id_len;
+    memcpy(slot->id, id, id_len);
+    slot->der_len = i2d_SSL_SESSION(session, &der);
+    slot->expires = time(NULL) + SSL_SESSION_get_timeout(session);
+    pthread_mutex_unlock(&cache->lock);
+
+    // The cache keeps its own serialized copy, not a reference
+    return 0;
+}
+
+static SSL_SESSION * get_session_cb(SSL * ssl, const unsigned char * id, int id_len, int * copy) {
+    (void) ssl;
+    *copy = 0;
+
+    unsigned char der[TLS_SESSION_DER_MAX];
+    unsigned int der_len = 0;
+
+    lock_cache();
+    session_slot * slot = slot_for(id, id_len);
+    if (slot->id_len == (unsigned int) id_len && memcmp(slot->id, id, id_len) == 0 && slot->expires > time(NULL)) {
+        der_len = slot->der_len;
+        memcpy(der, slot->der, der_len);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (der_len == 0) return NULL;
+    const unsigned char * der_ptr = der;
+    return d2i_SSL_SESSION(NULL, &der_ptr, der_len);
+}
+
+static void remove_session_cb(SSL_CTX * ctx, SSL_SESSION * session) {
+    (void) ctx;
+    unsigned int id_len;
+    const unsigned char * id = SSL_SESSION_get_id(session, &id_len);
+
+    lock_cache();
+    session_slot * slot = slot_for(id, id_len);
+    if (slot->id_len == id_len && memcmp(slot->id, id, id_len) == 0) {
+        memset(slot, 0, sizeof(session_slot));
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Follows the contract of SSL_CTX_set_tlsext_ticket_key_evp_cb: returns 1 to
+// use the key, 2 to accept a ticket but issue a fresh one, 0 to reject it
+static int ticket_key_cb(SSL * ssl, unsigned char * key_name, unsigned char * iv,
+                         EVP_CIPHER_CTX * cipher_ctx, EVP_MAC_CTX * mac_ctx, int enc) {
+    (void) ssl;
+    ticket_key key;
+    int result = 1;
+    time_t now = time(NULL);
+
+    lock_cache();
+    if (now - cache->keys_rotated > TLS_TICKET_KEY_LIFETIME) rotate_ticket_keys(now);
+
+    if (enc) {
+        key = cache->keys[0];
+    } else if (memcmp(key_name, cache->keys[0].name, TICKET_KEY_NAME_LEN) == 0) {
+        key = cache->keys[0];
+    } else if (cache->keys[1].valid && memcmp(key_name, cache->keys[1].name, TICKET_KEY_NAME_LEN) == 0) {
+        key = cache->keys[1];
+        result = 2;
+    } else {
+        result = 0;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (result == 0) return 0;
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac_key, TICKET_HMAC_KEY_LEN),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (EVP_MAC_CTX_set_params(mac_ctx, params) != 1) return -1;
+
+    if (enc) {
+        memcpy(key_name, key.name, TICKET_KEY_NAME_LEN);
+        if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1) return -1;
+        if (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) return -1;
+    } else {
+        if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) != 1) return -1;
+    }
+    return result;
+}
@@ -0,0 +1,91 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include "config.h"
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define TLS_SESSION_SLOTS 1024
+#define TLS_SESSION_DER_MAX 1024
+#define TLS_SESSION_TIMEOUT 300
+#define TLS_TICKET_KEY_LIFETIME 3600
+#define TLS_SENDFILE_BUFFER 16384
+#define TLS_MAX_CONNS 1048576
+
+/**
+ * Creates the server's TLS context from the tls_cert and tls_key settings,
+ * along with the session cache and ticket keys shared by every worker.
+ * Must be called before the pools fork so that process_pool children inherit
+ * the shared mapping. Does nothing when TLS is not configured.
+ * Returns 0 on success or -1 if the certificate or key could not be loaded.
+ */
+int tls_init(config * conf);
+
+/**
+ * Returns whether connections are served over TLS.
+ */
+int tls_is_enabled(void);
+
+/**
+ * Performs the server handshake on cfd. When the kernel supports it, record
+ * encryption is then handed to the socket (kTLS) so plain read, write and
+ * sendfile keep working on cfd. Returns 0 on success or when TLS is disabled,
+ * -1 if the handshake failed.
+ */
+int tls_accept(int cfd);
+
+/**
+ * Returns whether the client chose h2 through ALPN during the handshake.
+ */
+int tls_alpn_h2(int cfd);
+
+/**
+ * Returns the number of decrypted bytes OpenSSL holds for cfd that poll()
+ * cannot see.
+ */
+int tls_pending(int cfd);
+
+/**
+ * Sends close_notify and releases the TLS state for cfd, if any.
+ */
+void tls_close(int cfd);
+
+/**
+ * Reads from cfd, decrypting through OpenSSL if the kernel is not doing so.
+ */
+ssize_t tls_read(int cfd, void * buf, size_t len);
+
+/**
+ * Writes len bytes of buf to cfd, encrypting through OpenSSL if the kernel
+ * is not doing so.
+ */
+ssize_t tls_write(int cfd, const void * buf, size_t len);
+
+/**
+ * Gathers iov into cfd. On plain and kTLS sockets this is a single writev.
+ */
+ssize_t tls_writev(int cfd, const struct iovec * iov, int iovcnt);
+
+/**
+ * Sends count bytes of in_fd starting at offset to cfd. The file offset of
+ * in_fd is not used or changed. Plain and kTLS sockets use sendfile so the
+ * file never passes through user space. Returns the number of bytes sent or
+ * -1 on error.
+ */
+ssize_t tls_sendfile(int cfd, int in_fd, off_t offset, size_t count);
+
+/**
+ * Returns whether bytes read from cfd arrive as plaintext from the kernel,
+ * which allows splicing them straight out of the socket.
+ */
+int tls_kernel_recv(int cfd);
+
+/**
+ * Returns whether bytes written to cfd are encrypted by the kernel, which
+ * allows writev and sendfile straight into the socket.
+ */
+int tls_kernel_send(int cfd);
+
+#endif
@@ -28,11 +28,10 @@ void create_form(const ITEM *item, FIELD **field, FORM **form, WINDOW **header,
     set_field_back(field[0], A_UNDERLINE);
     field_opts_off(field[0], O_STATIC);
     if (((config_item_t*)item_userptr(item))->field_type == TYPE_ENUM) {
-        char *list[3] = {"Processes", "Threads", NULL};
-        set_field_type(field[0], TYPE_ENUM, list, 0, 1);
+        set_field_type(field[0], TYPE_ENUM, ((config_item_t*)item_userptr(item))->enum_values, 0, 1);
     }
     else if (((config_item_t*)item_userptr(item))->field_type == TYPE_INTEGER) {
-        set_field_type(field[0], TYPE_INTEGER, 0, 0, MAX_PORT);
+        set_field_type(field[0], TYPE_INTEGER, 0, 0, ((config_item_t*)item_userptr(item))->max_value);
     }
 
     *form = new_form(field);
@@ -6,6 +6,9 @@
 #include "ncurses_form.h"
 #include "ncurses_shared.h"
 
+static char *mode_values[] = {"Processes", "Threads", NULL};
+static char *switch_values[] = {"Yes", "No", NULL};
+
 void set_keyboard_menu(){
     cbreak();
     noecho();
@@ -19,6 +22,7 @@ void create_config_item(config_item_t **config_items, int index, char *name, cha
     config_items[index]->path = path;
     config_items[index]->config_type = config_type;
     config_items[index]->field_type = field_type;
+    config_items[index]->max_value = MAX_PORT;
 }
 
 void set_item_userptrs(ITEM **items, config_item_t **config_items) {
@@ -35,12 +39,28 @@ void create_main_menu(MENU **menu, config_t *lib_config, config_item_t **config_
         fprintf(stderr, "%s:%d - %s\n", config_error_file(lib_config), config_error_line(lib_config), config_error_text(lib_config));
         return;
     }
-    int port;
+    int port, defer_accept, fastopen, zerocopy_threshold, rate_limit, rate_burst;
     const char *root_dir = NULL;
     const char *index_page = NULL;
     const char *not_found_page = NULL;
+    const char *upload_dir = NULL;
+    const char *tls_cert = NULL;
+    const char *tls_key = NULL;
+    const char *acl_file = NULL;
+    const char *rewrite_file = NULL;
+    const char *modules = NULL;
+    const char *fastcgi_socket = NULL;
+    const char *fastcgi_prefix = NULL;
     const char *mode = NULL;
+    const char *numa = NULL;
+    const char *huge_pages = NULL;
+    const char *srpt = NULL;
     char *port_s = NULL;
+    char *defer_accept_s = NULL;
+    char *fastopen_s = NULL;
+    char *zerocopy_threshold_s = NULL;
+    char *rate_limit_s = NULL;
+    char *rate_burst_s = NULL;
 
     int port_lookup_status = config_lookup_int(lib_config, "port", &port);
     if (port_lookup_status != CONFIG_FALSE) {
@@ -50,19 +70,84 @@ void create_main_menu(MENU **menu, config_t *lib_config, config_item_t **config_
     config_lookup_string(lib_config, "root_dir", &root_dir);
     config_lookup_string(lib_config, "index_page", &index_page);
     config_lookup_string(lib_config, "not_found_page", &not_found_page);
+    config_lookup_string(lib_config, "upload_dir", &upload_dir);
+    config_lookup_string(lib_config, "tls_cert", &tls_cert);
+    config_lookup_string(lib_config, "tls_key", &tls_key);
+    config_lookup_string(lib_config, "acl_file", &acl_file);
+    config_lookup_string(lib_config, "rewrite_file", &rewrite_file);
+    config_lookup_string(lib_config, "modules", &modules);
+    config_lookup_string(lib_config, "fastcgi_socket", &fastcgi_socket);
+    config_lookup_string(lib_config, "fastcgi_prefix", &fastcgi_prefix);
+    config_lookup_string(lib_config, "numa", &numa);
+    config_lookup_string(lib_config, "huge_pages", &huge_pages);
+    config_lookup_string(lib_config, "srpt", &srpt);
+    if (config_lookup_int(lib_config, "defer_accept", &defer_accept) != CONFIG_FALSE) {
+        convert_int_to_string(defer_accept, &defer_accept_s);
+    }
+    if (config_lookup_int(lib_config, "fastopen", &fastopen) != CONFIG_FALSE) {
+        convert_int_to_string(fastopen, &fastopen_s);
+    }
+    if (config_lookup_int(lib_config, "zerocopy_threshold", &zerocopy_threshold) != CONFIG_FALSE) {
+        convert_int_to_string(zerocopy_threshold, &zerocopy_threshold_s);
+    }
+    if (config_lookup_int(lib_config, "rate_limit", &rate_limit) != CONFIG_FALSE) {
+        convert_int_to_string(rate_limit, &rate_limit_s);
+    }
+    if (config_lookup_int(lib_config, "rate_burst", &rate_burst) != CONFIG_FALSE) {
+        convert_int_to_string(rate_burst, &rate_burst_s);
+    }
 
     create_config_item(config_items, 0, "Mode:", "mode", CONFIG_TYPE_STRING, TYPE_ENUM);
     create_config_item(config_items, 1, "Port:", "port", CONFIG_TYPE_INT, TYPE_INTEGER);
     create_config_item(config_items, 2, "Root Directory:", "root_dir", CONFIG_TYPE_STRING, NULL);
     create_config_item(config_items, 3, "Index Page:", "index_page", CONFIG_TYPE_STRING, NULL);
     create_config_item(config_items, 4, "Not Found Page:", "not_found_page", CONFIG_TYPE_STRING, NULL);
-    config_items[5] = NULL;
+    create_config_item(config_items, 5, "Upload Directory:", "upload_dir", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 6, "TLS Certificate:", "tls_cert", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 7, "TLS Private Key:", "tls_key", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 8, "NUMA Groups:", "numa", CONFIG_TYPE_STRING, TYPE_ENUM);
+    create_config_item(config_items, 9, "Defer Accept (s):", "defer_accept", CONFIG_TYPE_INT, TYPE_INTEGER);
+    create_config_item(config_items, 10, "TCP Fast Open Queue:", "fastopen", CONFIG_TYPE_INT, TYPE_INTEGER);
+    create_config_item(config_items, 11, "Huge Pages:", "huge_pages", CONFIG_TYPE_STRING, TYPE_ENUM);
+    create_config_item(config_items, 12, "Zerocopy Threshold (B):", "zerocopy_threshold", CONFIG_TYPE_INT, TYPE_INTEGER);
+    create_config_item(config_items, 13, "SRPT Scheduling:", "srpt", CONFIG_TYPE_STRING, TYPE_ENUM);
+    create_config_item(config_items, 14, "Rate Limit (conn/s):", "rate_limit", CONFIG_TYPE_INT, TYPE_INTEGER);
+    create_config_item(config_items, 15, "Rate Burst (conn):", "rate_burst", CONFIG_TYPE_INT, TYPE_INTEGER);
+    create_config_item(config_items, 16, "Access Rules File:", "acl_file", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 17, "Rewrite Rules File:", "rewrite_file", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 18, "Handler Modules:", "modules", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 19, "FastCGI Socket:", "fastcgi_socket", CONFIG_TYPE_STRING, NULL);
+    create_config_item(config_items, 20, "FastCGI Prefix:", "fastcgi_prefix", CONFIG_TYPE_STRING, NULL);
+    config_items[21] = NULL;
+    config_items[0]->enum_values = mode_values;
+    config_items[8]->enum_values = switch_values;
+    config_items[11]->enum_values = switch_values;
+    config_items[12]->max_value = MAX_ZEROCOPY_THRESHOLD;
+    config_items[13]->enum_values = switch_values;
+    config_items[14]->max_value = MAX_RATE_LIMIT;
+    config_items[15]->max_value = MAX_RATE_LIMIT;
     items[0] = new_item(config_items[0]->name, strdup(mode != NULL && mode[0] != '\0' ? mode : EMPTY_DESCRIPTION));
     items[1] = new_item(config_items[1]->name, port_s != NULL ? port_s : strdup(EMPTY_DESCRIPTION));
     items[2] = new_item(config_items[2]->name, strdup(root_dir != NULL && root_dir[0] != '\0' ? root_dir : EMPTY_DESCRIPTION));
     items[3] = new_item(config_items[3]->name, strdup(index_page != NULL  && index_page[0] != '\0' ? index_page : EMPTY_DESCRIPTION));
     items[4] = new_item(config_items[4]->name, strdup(not_found_page != NULL  && not_found_page[0] != '\0' ? not_found_page : EMPTY_DESCRIPTION));
-    items[5] = NULL;
+    items[5] = new_item(config_items[5]->name, strdup(upload_dir != NULL  && upload_dir[0] != '\0' ? upload_dir : EMPTY_DESCRIPTION));
+    items[6] = new_item(config_items[6]->name, strdup(tls_cert != NULL  && tls_cert[0] != '\0' ? tls_cert : EMPTY_DESCRIPTION));
+    items[7] = new_item(config_items[7]->name, strdup(tls_key != NULL  && tls_key[0] != '\0' ? tls_key : EMPTY_DESCRIPTION));
+    items[8] = new_item(config_items[8]->name, strdup(numa != NULL  && numa[0] != '\0' ? numa : EMPTY_DESCRIPTION));
+    items[9] = new_item(config_items[9]->name, defer_accept_s != NULL ? defer_accept_s : strdup(EMPTY_DESCRIPTION));
+    items[10] = new_item(config_items[10]->name, fastopen_s != NULL ? fastopen_s : strdup(EMPTY_DESCRIPTION));
+    items[11] = new_item(config_items[11]->name, strdup(huge_pages != NULL  && huge_pages[0] != '\0' ? huge_pages : EMPTY_DESCRIPTION));
+    items[12] = new_item(config_items[12]->name, zerocopy_threshold_s != NULL ? zerocopy_threshold_s : strdup(EMPTY_DESCRIPTION));
+    items[13] = new_item(config_items[13]->name, strdup(srpt != NULL  && srpt[0] != '\0' ? srpt : EMPTY_DESCRIPTION));
+    items[14] = new_item(config_items[14]->name, rate_limit_s != NULL ? rate_limit_s : strdup(EMPTY_DESCRIPTION));
+    items[15] = new_item(config_items[15]->name, rate_burst_s != NULL ? rate_burst_s : strdup(EMPTY_DESCRIPTION));
+    items[16] = new_item(config_items[16]->name, strdup(acl_file != NULL  && acl_file[0] != '\0' ? acl_file : EMPTY_DESCRIPTION));
+    items[17] = new_item(config_items[17]->name, strdup(rewrite_file != NULL  && rewrite_file[0] != '\0' ? rewrite_file : EMPTY_DESCRIPTION));
+    items[18] = new_item(config_items[18]->name, strdup(modules != NULL  && modules[0] != '\0' ? modules : EMPTY_DESCRIPTION));
+    items[19] = new_item(config_items[19]->name, strdup(fastcgi_socket != NULL  && fastcgi_socket[0] != '\0' ? fastcgi_socket : EMPTY_DESCRIPTION));
+    items[20] = new_item(config_items[20]->name, strdup(fastcgi_prefix != NULL  && fastcgi_prefix[0] != '\0' ? fastcgi_prefix : EMPTY_DESCRIPTION));
+    items[21] = NULL;
 
     set_item_userptrs(items, config_items);
     *menu = new_menu(items);
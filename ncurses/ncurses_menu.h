@@ -5,7 +5,7 @@
 #include <libconfig.h>
 #include "ncurses_shared.h"
 
-#define NUM_ITEMS 5
+#define NUM_ITEMS 21
 
 /**
  * Sets ncurses for menu input.
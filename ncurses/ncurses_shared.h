@@ -7,17 +7,22 @@
 #define ASCII_TITLE_HEIGHT 5
 #define INSTRUCTIONS_HEIGHT 1
 #define MAX_PORT 65535
+#define MAX_ZEROCOPY_THRESHOLD 1073741824
+#define MAX_RATE_LIMIT 1000000
 #define EMPTY_DESCRIPTION " "
 
 /**
  * A config item struct, with the name, the path in the config file,
- * the config type, and the field type.
+ * the config type, the field type, the accepted values for TYPE_ENUM fields
+ * and the largest value accepted by TYPE_INTEGER fields.
  */
 typedef struct config_item {
     char *name;
     char *path;
     int config_type;
     FIELDTYPE *field_type;
+    char **enum_values;
+    int max_value;
 } config_item_t;
 
 /**
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Compares TLB misses and throughput with the huge_pages switch off and on.
+#
+# Usage: scripts/bench_huge_pages.sh BUILD_DIR [FILES] [FILE_KB] [REQUESTS]
+#
+# Serves FILES random files of FILE_KB each over cleartext HTTP/2, so that
+# pooled I/O buffers and mapped files cover a working set far larger than the
+# TLB reaches with 4 KB pages. For each setting the server is started in
+# thread mode, warmed up with one pass over every file, and then measured by
+# perf stat while h2load sends REQUESTS requests spread over all files.
+# BUILD_DIR must sit directly inside the repository, as the server reads
+# ../config.cfg. Needs perf and h2load (nghttp2). Huge pages only take effect
+# with transparent huge pages set to "madvise" or "always", or with pages in
+# the hugetlb pool, so both are printed along with the results.
+
+set -e
+
+build=$(cd "${1:?usage: $0 BUILD_DIR [FILES] [FILE_KB] [REQUESTS]}" && pwd)
+files=${2:-512}
+file_kb=${3:-256}
+requests=${4:-200000}
+port=${PORT:-8199}
+events=dTLB-load-misses,dTLB-store-misses,iTLB-load-misses
+
+for tool in perf h2load; do
+    command -v "$tool" >/dev/null || { echo "$tool not found" >&2; exit 1; }
+done
+
+work=$(mktemp -d)
+pid=
+trap '[ -n "$pid" ] && kill "$pid" 2>/dev/null; rm -rf "$work"' EXIT
+mkdir "$work/root"
+i=0
+while [ "$i" -lt "$files" ]; do
+    head -c $((file_kb * 1024)) /dev/urandom > "$work/root/f$i.bin"
+    echo "http://127.0.0.1:$port/f$i.bin" >> "$work/uris"
+    i=$((i + 1))
+done
+
+echo "transparent huge pages: $(cat /sys/kernel/mm/transparent_hugepage/enabled 2>/dev/null)"
+echo "hugetlb pages free: $(awk '/HugePages_Free/ { print $2 }' /proc/meminfo)"
+echo "working set: $files files of $file_kb KB, $requests requests"
+echo
+
+for setting in No Yes; do
+    cd "$build"
+    ./server -p "$port" -m t -r "$work/root" -H "$setting" > "$work/server.log" 2>&1 &
+    pid=$!
+    sleep 1
+    kill -0 "$pid" 2>/dev/null || { cat "$work/server.log" >&2; exit 1; }
+
+    h2load -i "$work/uris" -n "$files" -c 16 -m 10 > /dev/null
+    perf stat -x, -e "$events" -o "$work/perf.csv" -p "$pid" -- \
+        h2load -i "$work/uris" -n "$requests" -c 16 -m 10 > "$work/h2load.txt"
+
+    echo "huge_pages = $setting"
+    grep '^finished in' "$work/h2load.txt"
+    grep '^requests:' "$work/h2load.txt"
+    awk -F, '$3 != "" && $1 !~ /^#/ { printf "%-20s %s\n", $3, $1 }' "$work/perf.csv"
+    echo "AnonHugePages: $(awk '/AnonHugePages/ { print $2, $3 }' "/proc/$pid/smaps_rollup")"
+    echo
+
+    kill "$pid"
+    wait "$pid" 2>/dev/null || true
+    pid=
+done
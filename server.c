@@ -4,9 +4,13 @@
 #include <unistd.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/prctl.h>
 #include <sys/un.h>
+#include <linux/filter.h>
 #include <sys/wait.h>
 #include <errno.h>
 
@@ -15,15 +19,44 @@
 #include "http_protocol/thread_pool.h"
 #include "http_protocol/process_pool.h"
 #include "http_protocol/http.h"
+#include "http_protocol/tls.h"
+#include "http_protocol/numa_node.h"
+#include "http_protocol/huge_pages.h"
+#include "http_protocol/rate_limit.h"
+#include "http_protocol/ip_acl.h"
+#include "http_protocol/fastcgi.h"
 
-#define BACKLOG 5
+// Deep enough that overload queues connections, where CoDel can see how long
+// they wait, instead of dropping SYNs that clients only retry a second later
+#define BACKLOG SOMAXCONN
 
-static int create_server_fd();
+static int create_server_fd(config * conf);
+static int create_node_server_fd(config * conf);
+static int start_node_groups(int count);
+static void attach_node_steering(int sfd, int count);
+static int accept_client(int server_fd, config * conf);
+static int accept_pending(int server_fd, config * conf, int * client_fds, int max);
 
 int main(int argc, char **argv) {
     config * cmd_conf = get_cmd_config(argc, argv);
     config * conf = get_config(cmd_conf);
-    int server_fd = create_server_fd(conf->port);
+    huge_pages_init(conf->huge_pages);
+    if (rate_limit_init() == -1) {
+        perror("rate_limit_init");
+    }
+    if (http_routes_init() == -1) {
+        fprintf(stderr, "Could not register the default routes\n");
+        exit(EXIT_FAILURE);
+    }
+    if (conf->fastcgi_prefix != NULL && fastcgi_add_routes(router_default(), conf->fastcgi_prefix) == -1) {
+        fprintf(stderr, "Could not route %s to the FastCGI backend\n", conf->fastcgi_prefix);
+        exit(EXIT_FAILURE);
+    }
+    if (tls_init(conf) == -1) {
+        fprintf(stderr, "Could not load TLS certificate %s or key %s\n", conf->tls_cert, conf->tls_key);
+        exit(EXIT_FAILURE);
+    }
+    int server_fd = conf->numa ? create_node_server_fd(conf) : create_server_fd(conf);
 
     for(;;) {
         process_pool * p_pool;
@@ -34,8 +67,16 @@ int main(int argc, char **argv) {
             process_pool_start(p_pool);
             printf("Starting processes\n");
             while(conf->mode == 'p') {
-                int client_fd = accept(server_fd, NULL, NULL);
-                process_pool_notify(p_pool, client_fd);
+                int client_fds[PROCESS_POOL_BATCH];
+                int count = 0;
+                int client_fd = accept_client(server_fd, conf);
+                if (client_fd != -1) {
+                    client_fds[count++] = client_fd;
+                }
+                count += accept_pending(server_fd, conf, client_fds + count, PROCESS_POOL_BATCH - count);
+                if (count > 0) {
+                    process_pool_notify_batch(p_pool, client_fds, count);
+                }
                 destroy_config(conf);
                 conf = get_config(cmd_conf);
             }
@@ -48,8 +89,10 @@ int main(int argc, char **argv) {
             thread_pool_start(t_pool);
             printf("Starting threads\n");
             while(conf->mode == 't') {
-                int client_fd = accept(server_fd, NULL, NULL);
-                thread_pool_notify(t_pool, client_fd);
+                int client_fd = accept_client(server_fd, conf);
+                if (client_fd != -1) {
+                    thread_pool_notify(t_pool, client_fd);
+                }
                 destroy_config(conf);
                 conf = get_config(cmd_conf);
             }
@@ -64,7 +107,74 @@ int main(int argc, char **argv) {
     return EXIT_SUCCESS;
 }
 
-static int create_server_fd(int port) {
+// Opens one listener per node before forking so they join the reuseport
+// group in node order, then keeps only the listener of this process's node
+static int create_node_server_fd(config * conf) {
+    int count = numa_node_count();
+    int server_fds[count];
+    for (int node = 0; node < count; node++) {
+        server_fds[node] = create_server_fd(conf);
+    }
+    if (count > 1) {
+        attach_node_steering(server_fds[0], count);
+    }
+
+    int node = start_node_groups(count);
+    for (int i = 0; i < count; i++) {
+        if (i != node) {
+            close(server_fds[i]);
+        }
+    }
+    numa_node_bind(node);
+    return server_fds[node];
+}
+
+// Attaches a classic BPF program to the reuseport group that returns the
+// index of the listener for the node of the CPU that received the SYN, so a
+// connection is accepted and served on the node that took its interrupt.
+// CPUs missing from the topology fall back to cpu % count
+static void attach_node_steering(int sfd, int count) {
+    static int nodes[NUMA_MAX_CPUS];
+    int cpu_count = numa_cpu_nodes(nodes, NUMA_MAX_CPUS);
+    if (cpu_count > (BPF_MAXINSNS - 3) / 2) {
+        cpu_count = (BPF_MAXINSNS - 3) / 2;
+    }
+
+    static struct sock_filter code[BPF_MAXINSNS];
+    unsigned short len = 0;
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        if (nodes[cpu] == -1) {
+            continue;
+        }
+        code[len++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpu, 0, 1);
+        code[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, nodes[cpu]);
+    }
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count);
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+    struct sock_fprog prog = { .len = len, .filter = code };
+    if (setsockopt(sfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+    }
+}
+
+// Forks a group per extra node and returns the node index this process serves
+static int start_node_groups(int count) {
+    for (int node = 1; node < count; node++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            return node;
+        }
+    }
+    return 0;
+}
+
+static int create_server_fd(config * conf) {
     struct sockaddr_in addr;
     int sfd;
     signal(SIGPIPE, SIG_IGN);
@@ -72,11 +182,57 @@ static int create_server_fd(int port) {
     sfd = dc_socket(AF_INET, SOCK_STREAM, 0);
     memset(&addr, 0, sizeof(struct sockaddr_in));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
+    addr.sin_port = htons(conf->port);
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     int optval = 1;
     setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+    // Connections are only accepted once the request has arrived, so workers
+    // never block waiting for the first byte
+    if (conf->defer_accept > 0) {
+        setsockopt(sfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &conf->defer_accept, sizeof(conf->defer_accept));
+    }
+    if (conf->fastopen > 0) {
+        setsockopt(sfd, IPPROTO_TCP, TCP_FASTOPEN, &conf->fastopen, sizeof(conf->fastopen));
+    }
     dc_bind(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
     dc_listen(sfd, BACKLOG);
     return sfd;
-}
\ No newline at end of file
+}
+
+// Accepts a connection, closing it at once if the access rules deny the
+// client's address, then charges it to the address and turns it away with a
+// 429 when the client is over its rate. Returns the client fd, or -1 if the
+// accept failed or the client was turned away
+static int accept_client(int server_fd, config * conf) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    int client_fd = accept(server_fd, (struct sockaddr *) &addr, &addr_len);
+    if (client_fd == -1) {
+        return -1;
+    }
+    if (!ip_acl_check(conf->acl_file, (struct sockaddr *) &addr)) {
+        close(client_fd);
+        return -1;
+    }
+    if (addr.ss_family == AF_INET
+            && !rate_limit_allow(((struct sockaddr_in *) &addr)->sin_addr.s_addr, conf->rate_limit, conf->rate_burst)) {
+        http_reject_client(client_fd, HTTP_TOO_MANY_REQUESTS);
+        return -1;
+    }
+    return client_fd;
+}
+
+// Takes every connection already waiting in the backlog, up to max, so a
+// burst is handed to one worker in a single message
+static int accept_pending(int server_fd, config * conf, int * client_fds, int max) {
+    struct pollfd pfd = { .fd = server_fd, .events = POLLIN };
+    int count = 0;
+    int attempts = 0;
+    while (count < max && attempts++ < PROCESS_POOL_BATCH && poll(&pfd, 1, 0) > 0) {
+        int client_fd = accept_client(server_fd, conf);
+        if (client_fd != -1) {
+            client_fds[count++] = client_fd;
+        }
+    }
+    return count;
+}
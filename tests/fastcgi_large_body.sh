@@ -0,0 +1,35 @@
+#!/bin/sh
+# Posts a body larger than the socket buffers between the server and
+# fastcgi_echo, which answers while it is still reading, and checks that it
+# comes back whole and in time.
+#
+# Usage: tests/fastcgi_large_body.sh SERVER FASTCGI_ECHO
+
+server=${1:?usage: $0 SERVER FASTCGI_ECHO}
+echo_backend=${2:?usage: $0 SERVER FASTCGI_ECHO}
+port=${PORT:-8198}
+work=$(mktemp -d)
+server_pid=
+echo_pid=
+trap 'kill $server_pid $echo_pid 2>/dev/null; rm -rf "$work"' EXIT
+
+mkdir "$work/root"
+head -c 4000000 /dev/urandom > "$work/body"
+"$echo_backend" "$work/fcgi.sock" 2> /dev/null &
+echo_pid=$!
+sleep 0.5
+"$server" -p "$port" -m t -r "$work/root" -F "$work/fcgi.sock" -P /app > "$work/server.log" 2>&1 &
+server_pid=$!
+sleep 1
+
+status=$(curl -s -m 20 -H "Expect:" -X POST --data-binary @"$work/body" -o "$work/response" \
+    -w "%{http_code}" "http://127.0.0.1:$port/app/echo")
+if [ "$status" != 200 ]; then
+    echo "expected 200, got $status" >&2
+    cat "$work/server.log" >&2
+    exit 1
+fi
+if ! tail -c 4000000 "$work/response" | cmp -s - "$work/body"; then
+    echo "the body did not come back whole" >&2
+    exit 1
+fi
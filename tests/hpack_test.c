@@ -0,0 +1,88 @@
+#include "../http_protocol/hpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Regression tests for the HPACK decoder's dynamic table.
+ */
+
+#define NAME "x-regression-header-name"
+
+typedef struct {
+    size_t count;
+    char name[64];
+    size_t value_len;
+    char value_first;
+} last_field;
+
+static int record_field(void * ctx, const hpack_field * field);
+static size_t put_string(uint8_t * out, const char * data, size_t len);
+static int test_insert_evicting_its_name(void);
+
+int main(void) {
+    int failed = 0;
+    failed |= test_insert_evicting_its_name();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int record_field(void * ctx, const hpack_field * field) {
+    last_field * last = ctx;
+    last->count++;
+    size_t name_len = field->name_len < sizeof(last->name) - 1 ? field->name_len : sizeof(last->name) - 1;
+    memcpy(last->name, field->name, name_len);
+    last->name[name_len] = '\0';
+    last->value_len = field->value_len;
+    last->value_first = field->value_len > 0 ? field->value[0] : '\0';
+    return 0;
+}
+
+// Writes a string literal without Huffman coding
+static size_t put_string(uint8_t * out, const char * data, size_t len) {
+    size_t pos = 0;
+    if (len < 127) {
+        out[pos++] = (uint8_t) len;
+    } else {
+        out[pos++] = 127;
+        size_t rest = len - 127;
+        while (rest >= 128) {
+            out[pos++] = (uint8_t) (rest & 0x7f) | 0x80;
+            rest >>= 7;
+        }
+        out[pos++] = (uint8_t) rest;
+    }
+    memcpy(out + pos, data, len);
+    return pos + len;
+}
+
+// A literal with incremental indexing whose name refers to the one dynamic
+// entry, and which is too big to fit next to it, evicts the entry its name
+// came from
+static int test_insert_evicting_its_name(void) {
+    static char first_value[2000];
+    static char second_value[2100];
+    memset(first_value, 'a', sizeof(first_value));
+    memset(second_value, 'b', sizeof(second_value));
+
+    static uint8_t block[8192];
+    size_t len = 0;
+    block[len++] = 0x40;
+    len += put_string(block + len, NAME, strlen(NAME));
+    len += put_string(block + len, first_value, sizeof(first_value));
+    block[len++] = 0x40 | (HPACK_STATIC_ENTRIES + 1);
+    len += put_string(block + len, second_value, sizeof(second_value));
+    block[len++] = 0x80 | (HPACK_STATIC_ENTRIES + 1);
+
+    hpack_decoder decoder;
+    hpack_decoder_init(&decoder);
+    last_field last = { 0 };
+    int result = hpack_decode(&decoder, block, len, record_field, &last);
+    int failed = result != 0 || last.count != 3 || decoder.count != 1
+            || strcmp(last.name, NAME) != 0 || last.value_len != sizeof(second_value) || last.value_first != 'b';
+    hpack_decoder_destroy(&decoder);
+
+    if (failed)
+        fprintf(stderr, "test_insert_evicting_its_name: got %zu fields, last %s with %zu bytes\n", last.count, last.name, last.value_len);
+    return failed;
+}